@@ -0,0 +1,503 @@
+#define _POSIX_C_SOURCE 200809L
+// only for the key and button codes recordings store
+#define GLFW_INCLUDE_NONE
+#include <GLFW/glfw3.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include "batch.h"
+#include "document.h"
+#include "export.h"
+#include "filter.h"
+#include "pool.h"
+#include "raster.h"
+#include "record.h"
+#include "stats.h"
+#include "timelapse.h"
+
+// Scripts carry no timing, so their points arrive at a typical pointer
+// rate and the brush smooths them as it would live input.
+#define SCRIPT_STEP (1.0/120)
+
+struct Session {
+    Document * doc;
+    Pool * pool;
+    CanvasFormat format;
+    size_t budget;
+    Brush brush;
+    Stroke stroke;
+    int strokes;
+    Timelapse * timelapse;
+    const char * video;
+    int dabs, frameDabs;
+    Point * points;
+    int pointCount, pointCapacity;
+
+    // Recordings only: the view and tools the input was aimed at.
+    Tool tool;
+    float scale;
+    Point origin;
+    int windowWidth, windowHeight;
+    bool minimapShown;
+    Rect minimap;
+    bool moveHeld, drawing, selecting, moving, navigating;
+    Point grab, cursor;
+    SelectionOp selectOp;
+};
+typedef struct Session Session;
+
+struct Batch {
+    const char * const * paths;
+    int count;
+    const BatchOptions * options;
+    Pool * pool;
+    // each document's share of the canvas budget
+    size_t budget;
+    atomic_int next;
+    atomic_int failed;
+};
+typedef struct Batch Batch;
+
+static bool createDocument(Session * s, int width, int height, Color fill, const BatchOptions * o)
+{
+    s->doc = documentCreate(width, height, canvasColor(s->format, fill), s->format, o->historyLimit);
+    canvasSetBudget(s->doc->canvas, s->budget);
+    if(!s->video)
+        return true;
+    if(!(s->timelapse = timelapseStart(s->doc->canvas, s->pool, s->video, o->timelapseShrink))) {
+        fprintf(stderr, "could not write %s\n", s->video);
+        return false;
+    }
+    timelapseFrame(s->timelapse);
+    return true;
+}
+
+static void paint(Session * s, InputEventType type, Point p, double time)
+{
+    if(type == INPUT_STROKE_BEGIN)
+        ++s->strokes;
+    s->dabs += rasterPaint(s->doc, &s->stroke, &s->brush, (InputEvent){type, p, time});
+    if(s->timelapse && s->dabs >= s->frameDabs) {
+        timelapseFrame(s->timelapse);
+        s->dabs = 0;
+    }
+}
+
+static void addPoint(Session * s, Point p)
+{
+    if(s->pointCount == s->pointCapacity) {
+        s->pointCapacity = s->pointCapacity ? 2*s->pointCapacity : 256;
+        s->points = realloc(s->points, sizeof(Point)*s->pointCapacity);
+    }
+    s->points[s->pointCount++] = p;
+}
+
+// Undo and blur stamp what they change, for the timelapse to pick up.
+static void touchTile(int tx, int ty, void * ctx)
+{
+    canvasTouchTile(ctx, tx, ty);
+}
+
+// The filter runs on the shared pool; this thread is not one of its
+// workers, so it may wait.
+static void blur(Session * s, float sigma)
+{
+    Filter * f = filterBlurStart(s->pool, s->doc->canvas, s->doc->selection, sigma);
+    struct timespec nap = {0, 1000000};
+    while(!filterFinished(f))
+        nanosleep(&nap, NULL);
+    filterApply(f, s->doc->history, touchTile, s->doc->canvas);
+    filterDestroy(f);
+}
+
+static void undo(Session * s, bool redo)
+{
+    if(redo)
+        historyRedo(s->doc->history, touchTile, s->doc->canvas);
+    else
+        historyUndo(s->doc->history, touchTile, s->doc->canvas);
+}
+
+// Recordings are replayed through the same decisions main.c makes for live
+// input, minus everything that only affects the window. A blur finishes
+// before the next event here, where a live one ignores input until done.
+static Point toCanvasExact(const Session * s, Point screen)
+{
+    double k = 1.0/s->scale;
+    return (Point){k*((double)screen.x - (double)s->origin.x), k*((double)screen.y - (double)s->origin.y)};
+}
+
+static Point toCanvas(const Session * s, Point screen)
+{
+    double k = 1.0/s->scale;
+    float x = (int)(k*((double)screen.x - (double)s->origin.x));
+    float y = (int)(k*((double)screen.y - (double)s->origin.y));
+    return (Point){x, y};
+}
+
+// As minimapHit: the canvas point under a window point on the minimap.
+static bool onMinimap(const Session * s, Point screen, Point * p)
+{
+    Rect m = s->minimap;
+    if(!s->minimapShown || screen.x < m.origin.x || screen.y < m.origin.y ||
+       screen.x >= m.origin.x + m.size.width || screen.y >= m.origin.y + m.size.height)
+        return false;
+    p->x = (screen.x - m.origin.x)/m.size.width*s->doc->canvas->width;
+    p->y = (screen.y - m.origin.y)/m.size.height*s->doc->canvas->height;
+    return true;
+}
+
+// Centres the view on the canvas point under the minimap.
+static void navigate(Session * s, Point screen)
+{
+    Point p;
+    if(!onMinimap(s, screen, &p))
+        return;
+    s->origin.x = s->windowWidth/2 - p.x*s->scale;
+    s->origin.y = s->windowHeight/2 - p.y*s->scale;
+}
+
+static void endSelect(Session * s, Point screen)
+{
+    s->selecting = false;
+    addPoint(s, toCanvasExact(s, screen));
+    if(s->tool == TOOL_RECT_SELECT) {
+        Point a = s->points[0];
+        Point b = s->points[s->pointCount - 1];
+        Rect r = {{fmin(a.x, b.x), fmin(a.y, b.y)}, {fabs(b.x - a.x), fabs(b.y - a.y)}};
+        selectionRect(s->doc->selection, r, s->selectOp);
+    } else {
+        selectionLasso(s->doc->selection, s->points, s->pointCount, s->selectOp);
+    }
+}
+
+static void replayKey(Session * s, const RecordEvent * e)
+{
+    int key = e->code, mods = e->mods;
+    if(key == GLFW_KEY_SPACE)
+        s->moveHeld = (e->action != GLFW_RELEASE);
+    else if(e->action != GLFW_PRESS || s->drawing || s->selecting)
+        return;
+    else if(key == GLFW_KEY_B)
+        s->tool = TOOL_BRUSH;
+    else if(key == GLFW_KEY_M)
+        s->tool = TOOL_RECT_SELECT;
+    else if(key == GLFW_KEY_L)
+        s->tool = TOOL_LASSO_SELECT;
+    else if(key == GLFW_KEY_D && (mods & GLFW_MOD_CONTROL))
+        selectionClear(s->doc->selection);
+    else if(key == GLFW_KEY_Z && (mods & GLFW_MOD_CONTROL))
+        undo(s, mods & GLFW_MOD_SHIFT);
+    else if(key == GLFW_KEY_F)
+        blur(s, mods & GLFW_MOD_SHIFT ? BLUR_SIGMA_LARGE : BLUR_SIGMA);
+    else if(key == GLFW_KEY_N)
+        s->minimapShown = !s->minimapShown;
+}
+
+static void replayButton(Session * s, const RecordEvent * e)
+{
+    Point screen = {e->x, e->y};
+    Point onMap;
+    if(e->code == GLFW_MOUSE_BUTTON_LEFT && e->action == GLFW_PRESS) {
+        if(onMinimap(s, screen, &onMap)) {
+            s->navigating = true;
+            navigate(s, screen);
+        } else if(s->moveHeld) {
+            s->moving = true;
+            s->grab = screen;
+        } else if(s->tool != TOOL_BRUSH) {
+            s->selecting = true;
+            s->selectOp = SELECTION_REPLACE;
+            if(e->mods & GLFW_MOD_SHIFT)
+                s->selectOp = SELECTION_ADD;
+            else if(e->mods & GLFW_MOD_ALT)
+                s->selectOp = SELECTION_SUBTRACT;
+            s->pointCount = 0;
+            addPoint(s, toCanvasExact(s, screen));
+        } else {
+            Point p = toCanvas(s, screen);
+            s->drawing = p.x > 0 && p.x < s->doc->canvas->width && p.y > 0 && p.y < s->doc->canvas->height;
+            if(s->drawing)
+                paint(s, INPUT_STROKE_BEGIN, toCanvasExact(s, screen), e->time);
+        }
+    } else if(e->code == GLFW_MOUSE_BUTTON_LEFT && e->action == GLFW_RELEASE) {
+        if(s->navigating) {
+            s->navigating = false;
+        } else if(s->moving) {
+            s->moving = false;
+        } else if(s->selecting) {
+            endSelect(s, screen);
+        } else if(s->drawing) {
+            s->drawing = false;
+            paint(s, INPUT_STROKE_END, toCanvasExact(s, screen), e->time);
+        }
+    } else if(e->code == GLFW_MOUSE_BUTTON_RIGHT && e->action == GLFW_RELEASE) {
+        // zoom about the cursor
+        Point before = toCanvas(s, screen);
+        s->scale *= (e->mods & GLFW_MOD_SHIFT ? 0.8 : 1.2);
+        Point after = toCanvas(s, screen);
+        s->origin.x += s->scale*(after.x - before.x);
+        s->origin.y += s->scale*(after.y - before.y);
+    }
+}
+
+static void replayMove(Session * s, const RecordEvent * e)
+{
+    Point screen = {e->x, e->y};
+    if(s->drawing) {
+        paint(s, INPUT_STROKE_MOVE, toCanvasExact(s, screen), e->time);
+    } else if(s->navigating) {
+        navigate(s, screen);
+    } else if(s->moving) {
+        s->origin.x += screen.x - s->grab.x;
+        s->origin.y += screen.y - s->grab.y;
+        s->grab = screen;
+    } else if(s->selecting && s->tool == TOOL_LASSO_SELECT) {
+        addPoint(s, toCanvasExact(s, screen));
+    }
+}
+
+static void replayEvent(const RecordEvent * e, void * ctx)
+{
+    Session * s = ctx;
+    if(e->type != RECORD_KEY)
+        s->cursor = (Point){e->x, e->y};
+    switch(e->type) {
+    case RECORD_KEY:
+        replayKey(s, e);
+        break;
+    case RECORD_BUTTON:
+        replayButton(s, e);
+        break;
+    case RECORD_MOVE:
+        replayMove(s, e);
+        break;
+    }
+}
+
+static bool renderRecording(Session * s, Player * player, const RecordState * state, const BatchOptions * o)
+{
+    if(!createDocument(s, state->width, state->height, o->fill, o))
+        return false;
+    s->tool = state->tool;
+    s->brush = state->brush;
+    s->scale = state->scale;
+    s->origin = state->origin;
+    s->windowWidth = state->windowWidth;
+    s->windowHeight = state->windowHeight;
+    s->minimapShown = state->minimapShown;
+    s->minimap = state->minimap;
+    while(playerStep(player, 0, true, replayEvent, s))
+        ;
+    // a recording cut off mid stroke still finishes it
+    if(s->drawing)
+        paint(s, INPUT_STROKE_END, toCanvasExact(s, s->cursor), s->stroke.time);
+    else if(s->selecting)
+        endSelect(s, s->cursor);
+    return true;
+}
+
+static bool fail(const char * path, int line, const char * message)
+{
+    fprintf(stderr, "%s:%d: %s\n", path, line, message);
+    return false;
+}
+
+static SelectionOp parseOp(const char * word)
+{
+    if(strcmp(word, "add") == 0)
+        return SELECTION_ADD;
+    if(strcmp(word, "subtract") == 0)
+        return SELECTION_SUBTRACT;
+    return SELECTION_REPLACE;
+}
+
+static bool runCommand(Session * s, char * text, double * time, const char * path, int line, const BatchOptions * o)
+{
+    char command[16], word[16] = "";
+    int used;
+    if(sscanf(text, "%15s%n", command, &used) != 1 || command[0] == '#')
+        return true;
+    char * args = text + used;
+
+    if(strcmp(command, "canvas") == 0) {
+        int width, height;
+        Color fill = o->fill;
+        int n = sscanf(args, "%d %d %f %f %f", &width, &height, &fill.r, &fill.g, &fill.b);
+        if(s->doc)
+            return fail(path, line, "canvas given twice");
+        if((n != 2 && n != 5) || width <= 0 || height <= 0)
+            return fail(path, line, "expected canvas <width> <height> [r g b]");
+        return createDocument(s, width, height, fill, o);
+    }
+    if(!s->doc)
+        return fail(path, line, "no canvas yet");
+
+    if(strcmp(command, "brush") == 0) {
+        if(sscanf(args, "%f %f", &s->brush.size, &s->brush.spacing) < 1 || s->brush.size <= 0 || s->brush.spacing <= 0)
+            return fail(path, line, "expected brush <size> [spacing]");
+    } else if(strcmp(command, "color") == 0) {
+        Color c = {0, 0, 0, 1};
+        if(sscanf(args, "%f %f %f %f", &c.r, &c.g, &c.b, &c.a) < 3)
+            return fail(path, line, "expected color <r> <g> <b> [a]");
+        s->brush.color = canvasColor(s->format, c);
+    } else if(strcmp(command, "stroke") == 0) {
+        s->pointCount = 0;
+        char * end;
+        for(;;) {
+            float x = strtof(args, &end);
+            if(end == args)
+                break;
+            float y = strtof(end, &args);
+            if(args == end)
+                return fail(path, line, "stroke point without y");
+            addPoint(s, (Point){x, y});
+        }
+        end += strspn(end, " \t");
+        if(s->pointCount == 0 || *end != '\0')
+            return fail(path, line, "expected stroke <x> <y> ...");
+        for(int i = 0; i < s->pointCount; ++i) {
+            InputEventType type = i == 0 ? INPUT_STROKE_BEGIN : (i == s->pointCount - 1 ? INPUT_STROKE_END : INPUT_STROKE_MOVE);
+            paint(s, type, s->points[i], *time);
+            *time += SCRIPT_STEP;
+        }
+        // a single point is a dab, begun and ended in place
+        if(s->pointCount == 1)
+            paint(s, INPUT_STROKE_END, s->points[0], *time);
+    } else if(strcmp(command, "select") == 0) {
+        Rect r;
+        if(sscanf(args, "%f %f %f %f %15s", &r.origin.x, &r.origin.y, &r.size.width, &r.size.height, word) < 4)
+            return fail(path, line, "expected select <x> <y> <w> <h> [add|subtract]");
+        selectionRect(s->doc->selection, r, parseOp(word));
+    } else if(strcmp(command, "deselect") == 0) {
+        selectionClear(s->doc->selection);
+    } else if(strcmp(command, "blur") == 0) {
+        float sigma;
+        if(sscanf(args, "%f", &sigma) != 1 || sigma <= 0)
+            return fail(path, line, "expected blur <sigma>");
+        blur(s, sigma);
+    } else if(strcmp(command, "undo") == 0 || strcmp(command, "redo") == 0) {
+        undo(s, command[0] == 'r');
+    } else {
+        return fail(path, line, "unknown command");
+    }
+    return true;
+}
+
+static bool renderScript(Session * s, const char * path, const BatchOptions * o)
+{
+    FILE * f = fopen(path, "r");
+    if(!f)
+        return fail(path, 0, "could not open");
+    s->brush = (Brush){o->brush.size, o->brush.spacing, canvasColor(s->format, o->brush.color)};
+
+    char * text = NULL;
+    size_t size = 0;
+    double time = 0;
+    bool ok = true;
+    for(int line = 1; ok && getline(&text, &size, f) >= 0; ++line) {
+        text[strcspn(text, "\r\n")] = '\0';
+        ok = runCommand(s, text, &time, path, line, o);
+    }
+    free(text);
+    fclose(f);
+    return ok && (s->doc || fail(path, 0, "no canvas"));
+}
+
+// <outDir>/<name><extension>, or the input with its extension replaced.
+static char * outputPath(const char * input, const char * outDir, const char * extension)
+{
+    const char * slash = strrchr(input, '/');
+    const char * name = outDir && slash ? slash + 1 : input;
+    const char * dot = strrchr(name, '.');
+    if(dot && (dot == name || dot[-1] == '/' || (slash && dot < slash)))
+        dot = NULL;
+    int stem = dot ? (int)(dot - name) : (int)strlen(name);
+
+    size_t size = (outDir ? strlen(outDir) + 1 : 0) + stem + strlen(extension) + 1;
+    char * path = malloc(size);
+    snprintf(path, size, "%s%s%.*s%s", outDir ? outDir : "", outDir ? "/" : "", stem, name, extension);
+    return path;
+}
+
+static void renderDocument(Batch * b, const char * input)
+{
+    const BatchOptions * o = b->options;
+    double start = statsNow();
+    Session s = {0};
+    s.pool = b->pool;
+    s.format = o->format;
+    s.budget = b->budget;
+    s.frameDabs = o->timelapseDabs;
+    char * video = o->timelapseDabs > 0 ? outputPath(input, o->outDir, ".y4m") : NULL;
+    s.video = video;
+
+    RecordState state;
+    Player * player = playerOpen(input, &state);
+    bool ok = player ? renderRecording(&s, player, &state, o) : renderScript(&s, input, o);
+    playerClose(player);
+
+    if(s.timelapse) {
+        if(ok)
+            timelapseFrame(s.timelapse);
+        int frames = timelapseFrames(s.timelapse);
+        if(!timelapseFinish(s.timelapse)) {
+            fprintf(stderr, "could not write %s\n", video);
+            ok = false;
+        } else if(ok) {
+            printf("%s -> %s: %d frames\n", input, video, frames);
+        }
+    }
+
+    char * output = outputPath(input, o->outDir, ".png");
+    if(ok && !(ok = exportWrite(s.doc->canvas, output)))
+        fprintf(stderr, "could not write %s\n", output);
+    if(ok)
+        printf("%s -> %s: %d strokes in %.2f s\n", input, output, s.strokes, statsNow() - start);
+    else
+        atomic_fetch_add(&b->failed, 1);
+
+    free(output);
+    free(video);
+    free(s.points);
+    documentDestroy(s.doc);
+}
+
+static void * batchWorker(void * arg)
+{
+    Batch * b = arg;
+    for(int i; (i = atomic_fetch_add(&b->next, 1)) < b->count; )
+        renderDocument(b, b->paths[i]);
+    return NULL;
+}
+
+int batchRun(const char * const * paths, int count, const BatchOptions * options)
+{
+    double start = statsNow();
+    Batch b = {paths, count, options, poolCreate(0)};
+    atomic_init(&b.next, 0);
+    atomic_init(&b.failed, 0);
+
+    int threads = options->threads > 0 ? options->threads : poolThreadCount(b.pool);
+    threads = threads < count ? threads : count;
+    // documents on different workers would otherwise spill each other's
+    // tiles to stay under one shared budget
+    b.budget = threads > 0 ? memoryCpuBudget(SUBSYSTEM_CANVAS)/threads : 0;
+    pthread_t * workers = malloc(sizeof(pthread_t)*threads);
+    for(int i = 0; i < threads; ++i)
+        pthread_create(&workers[i], NULL, batchWorker, &b);
+    for(int i = 0; i < threads; ++i)
+        pthread_join(workers[i], NULL);
+    free(workers);
+    poolDestroy(b.pool);
+
+    int failed = atomic_load(&b.failed);
+    double seconds = statsNow() - start;
+    printf("%d of %d documents in %.2f s on %d threads, %.1f per minute\n",
+        count - failed, count, seconds, threads, 60*(count - failed)/(seconds > 0 ? seconds : 1));
+    return failed;
+}
@@ -0,0 +1,47 @@
+#ifndef DAPPER_BATCH_H
+#define DAPPER_BATCH_H
+
+#include "canvas.h"
+#include "stroke.h"
+
+struct BatchOptions {
+    // NULL writes each image next to its input.
+    const char * outDir;
+    // Documents rendered at once; <= 0 uses every core.
+    int threads;
+    CanvasFormat format;
+    // The starting canvas colour and brush, as picked on screen.
+    Color fill;
+    Brush brush;
+    int historyLimit;
+    // With timelapseDabs > 0 each input also gets a <name>.y4m timelapse,
+    // a frame each time that many more dabs have landed (checked after
+    // every input event), shrunk by timelapseShrink.
+    int timelapseDabs;
+    int timelapseShrink;
+};
+typedef struct BatchOptions BatchOptions;
+
+// Renders documents offline with the CPU brush engine, no window or GL
+// context involved. Each input is either a recording made with F4, replayed
+// through the same tools as a live session, or a script of drawing commands
+// in canvas coordinates, one per line:
+//
+//   canvas <width> <height> [r g b]   starts the document
+//   brush <size> [spacing]
+//   color <r> <g> <b> [a]
+//   stroke <x> <y> <x> <y> ...         points 1/120 s apart
+//   select <x> <y> <w> <h> [add|subtract]
+//   deselect
+//   blur <sigma>
+//   undo
+//   redo
+//
+// Blank lines and lines starting with # are skipped. Every input becomes
+// <name>.png. Documents are spread over worker threads, one document per
+// thread at a time, so throughput scales with cores while each document
+// still paints in order. Each document keeps its tiles within an even share
+// of the canvas budget. Returns the number of inputs that failed.
+int batchRun(const char * const * paths, int count, const BatchOptions * options);
+
+#endif
@@ -0,0 +1,201 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "blob.h"
+
+// One table for the whole process, chained, doubled once it holds more
+// blobs than buckets.
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static TileBlob ** buckets = NULL;
+static size_t bucketCount = 0, internedCount = 0;
+
+// Tiles are whole numbers of 8 byte words; four lanes keep the multiplies
+// independent.
+static uint64_t hashBytes(const unsigned char * data, size_t bytes)
+{
+    const uint64_t k = 0x9e3779b97f4a7c15ull;
+    uint64_t h[4] = {k, k ^ bytes, ~k, bytes};
+    size_t words = bytes/8, i = 0;
+    for(; i + 4 <= words; i += 4) {
+        for(int l = 0; l < 4; ++l) {
+            uint64_t w;
+            memcpy(&w, &data[(i + l)*8], 8);
+            h[l] = (h[l] ^ w)*k;
+            h[l] ^= h[l] >> 29;
+        }
+    }
+    for(; i < words; ++i) {
+        uint64_t w;
+        memcpy(&w, &data[i*8], 8);
+        h[0] = (h[0] ^ w)*k;
+    }
+    for(size_t j = words*8; j < bytes; ++j)
+        h[1] = (h[1] ^ data[j])*k;
+    uint64_t r = h[0] ^ (h[1] << 1) ^ (h[2] << 2) ^ (h[3] << 3);
+    r ^= r >> 31;
+    return r*k;
+}
+
+static void charge(const TileBlob * b, Subsystem s, int sign)
+{
+    memoryCharge(s, sign*(long long)(sizeof(TileBlob) + b->bytes), 0, sign);
+}
+
+TileBlob * blobCreate(size_t bytes, Subsystem s)
+{
+    TileBlob * b = malloc(sizeof(TileBlob) + bytes);
+    memset(b, 0, sizeof(TileBlob));
+    b->data = (unsigned char *)(b + 1);
+    b->bytes = bytes;
+    b->refs = 1;
+    b->holders[s] = 1;
+    b->owner = s;
+    charge(b, s, 1);
+    return b;
+}
+
+void blobRetain(TileBlob * b, Subsystem s)
+{
+    pthread_mutex_lock(&lock);
+    ++b->refs;
+    ++b->holders[s];
+    pthread_mutex_unlock(&lock);
+}
+
+static void removeBlob(TileBlob * b)
+{
+    TileBlob ** p = &buckets[b->hash & (bucketCount - 1)];
+    while(*p != b)
+        p = &(*p)->next;
+    *p = b->next;
+    b->next = NULL;
+    b->interned = false;
+    --internedCount;
+}
+
+// Called with the lock held once s has dropped a holder; true when b is
+// left with none at all.
+static bool dropHolder(TileBlob * b, Subsystem s, size_t * uncharged)
+{
+    --b->refs;
+    --b->holders[s];
+    if(b->refs == 0) {
+        if(b->interned)
+            removeBlob(b);
+        charge(b, s, -1);
+        *uncharged = sizeof(TileBlob) + b->bytes;
+        return true;
+    }
+    if(b->owner == s && b->holders[s] == 0) {
+        Subsystem next = 0;
+        while(b->holders[next] == 0)
+            ++next;
+        charge(b, s, -1);
+        charge(b, next, 1);
+        b->owner = next;
+        *uncharged = sizeof(TileBlob) + b->bytes;
+    }
+    return false;
+}
+
+size_t blobRelease(TileBlob * b, Subsystem s)
+{
+    if(!b)
+        return 0;
+    size_t uncharged = 0;
+    pthread_mutex_lock(&lock);
+    bool last = dropHolder(b, s, &uncharged);
+    pthread_mutex_unlock(&lock);
+    if(last)
+        free(b);
+    return uncharged;
+}
+
+void blobTransfer(TileBlob * b, Subsystem from, Subsystem to)
+{
+    if(from == to)
+        return;
+    size_t uncharged;
+    pthread_mutex_lock(&lock);
+    ++b->refs;
+    ++b->holders[to];
+    dropHolder(b, from, &uncharged);
+    pthread_mutex_unlock(&lock);
+}
+
+static void grow()
+{
+    size_t count = bucketCount ? 2*bucketCount : 1024;
+    TileBlob ** fresh = calloc(count, sizeof(TileBlob *));
+    for(size_t i = 0; i < bucketCount; ++i) {
+        for(TileBlob * b = buckets[i], * next; b; b = next) {
+            next = b->next;
+            b->next = fresh[b->hash & (count - 1)];
+            fresh[b->hash & (count - 1)] = b;
+        }
+    }
+    free(buckets);
+    buckets = fresh;
+    bucketCount = count;
+}
+
+// The comparison runs under the lock, as the match could otherwise be
+// released and freed halfway through it.
+TileBlob * blobIntern(TileBlob * b, Subsystem s)
+{
+    pthread_mutex_lock(&lock);
+    bool interned = b->interned;
+    pthread_mutex_unlock(&lock);
+    if(interned)
+        return b;
+
+    uint64_t hash = hashBytes(b->data, b->bytes);
+    pthread_mutex_lock(&lock);
+    // another holder may have interned it meanwhile
+    if(b->interned) {
+        pthread_mutex_unlock(&lock);
+        return b;
+    }
+    if(internedCount >= bucketCount)
+        grow();
+    TileBlob * match = buckets[hash & (bucketCount - 1)];
+    while(match && (match->hash != hash || match->bytes != b->bytes || memcmp(match->data, b->data, b->bytes) != 0))
+        match = match->next;
+    if(!match) {
+        b->hash = hash;
+        b->next = buckets[hash & (bucketCount - 1)];
+        buckets[hash & (bucketCount - 1)] = b;
+        b->interned = true;
+        ++internedCount;
+        pthread_mutex_unlock(&lock);
+        return b;
+    }
+
+    ++match->refs;
+    ++match->holders[s];
+    size_t uncharged;
+    bool last = dropHolder(b, s, &uncharged);
+    pthread_mutex_unlock(&lock);
+    if(last)
+        free(b);
+    return match;
+}
+
+TileBlob * blobWritable(TileBlob * b, Subsystem s, bool keep)
+{
+    pthread_mutex_lock(&lock);
+    if(b->refs == 1) {
+        if(b->interned)
+            removeBlob(b);
+        pthread_mutex_unlock(&lock);
+        return b;
+    }
+    pthread_mutex_unlock(&lock);
+
+    // still held by s, so nobody can free or change it meanwhile
+    TileBlob * fresh = blobCreate(b->bytes, s);
+    if(keep)
+        memcpy(fresh->data, b->data, b->bytes);
+    blobRelease(b, s);
+    return fresh;
+}
@@ -0,0 +1,52 @@
+#ifndef DAPPER_BLOB_H
+#define DAPPER_BLOB_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "memory.h"
+
+// Tile data shared by reference between canvases, their snapshots and undo
+// history. Interned blobs are found by content, so identical tiles anywhere
+// in the process (flat fills, repeated history copies) are kept once. A
+// blob held more than once or sitting in the table is read only; writers
+// go through blobWritable first.
+//
+// Each blob is charged to one of the subsystems holding it, so their
+// accounts add up to the unique content. When that subsystem lets go while
+// others still hold the blob, the charge moves to one of them.
+struct TileBlob {
+    struct TileBlob * next;
+    uint64_t hash;
+    size_t bytes;
+    int refs;
+    int holders[SUBSYSTEM_COUNT];
+    Subsystem owner;
+    bool interned;
+    // right after the header, so it keeps the header's alignment
+    unsigned char * data;
+};
+typedef struct TileBlob TileBlob;
+
+// A new blob held once by s, with undefined contents.
+TileBlob * blobCreate(size_t bytes, Subsystem s);
+
+void blobRetain(TileBlob * b, Subsystem s);
+
+// Returns the bytes s is no longer charged for, whether the blob was freed
+// or its charge moved to another holder.
+size_t blobRelease(TileBlob * b, Subsystem s);
+
+// Hands one of from's references to to.
+void blobTransfer(TileBlob * b, Subsystem from, Subsystem to);
+
+// Swaps s's reference to b for one to the blob with the same contents in
+// the table, adding b if there is none. The contents must not change
+// while this runs.
+TileBlob * blobIntern(TileBlob * b, Subsystem s);
+
+// Returns a blob only s holds and the table does not know, for s to write:
+// b itself when it can be, otherwise a new one, with b's contents if keep.
+TileBlob * blobWritable(TileBlob * b, Subsystem s, bool keep);
+
+#endif
@@ -0,0 +1,735 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "canvas.h"
+#include "half.h"
+#include "srgb.h"
+#include "memory.h"
+#include "stats.h"
+
+// Each snapshot holds a reference to what a tile held when it was taken,
+// once the canvas has moved on from it.
+struct CanvasSnapshot {
+    Canvas * canvas;
+    unsigned epoch;
+    TileBlob ** versions;
+    CanvasSnapshot * prev, * next;
+};
+
+static size_t formatBytes(CanvasFormat format)
+{
+    switch(format) {
+    case CANVAS_HALF:
+        return sizeof(uint16_t);
+    case CANVAS_SRGB8:
+        return sizeof(uint8_t);
+    default:
+        return sizeof(float);
+    }
+}
+
+void canvasEncodePixels(const Canvas * c, void * dst, const float * src, int count)
+{
+    switch(c->format) {
+    case CANVAS_HALF:
+        halfFromFloat(dst, src, count*COLOR_COMPS);
+        break;
+    case CANVAS_SRGB8:
+        srgbFromLinear(dst, src, count*COLOR_COMPS);
+        break;
+    default:
+        memcpy(dst, src, sizeof(float)*count*COLOR_COMPS);
+        break;
+    }
+}
+
+void canvasEncodeTile(const Canvas * c, void * dst, const float * src)
+{
+    canvasEncodePixels(c, dst, src, TILE_PIXELS);
+}
+
+static void decodeTile(const Canvas * c, float * dst, const void * src)
+{
+    switch(c->format) {
+    case CANVAS_HALF:
+        halfToFloat(dst, src, TILE_PIXELS*COLOR_COMPS);
+        break;
+    case CANVAS_SRGB8:
+        srgbToLinear(dst, src, TILE_PIXELS*COLOR_COMPS);
+        break;
+    default:
+        memcpy(dst, src, TILE_BYTES);
+        break;
+    }
+}
+
+void canvasStoredPixel(const Canvas * c, const void * stored, int x, int y, float * rgb)
+{
+    size_t i = ((size_t)y*TILE_SIZE + x)*COLOR_COMPS;
+    switch(c->format) {
+    case CANVAS_HALF:
+        halfToFloat(rgb, &((const uint16_t *)stored)[i], COLOR_COMPS);
+        break;
+    case CANVAS_SRGB8:
+        srgbToLinear(rgb, &((const uint8_t *)stored)[i], COLOR_COMPS);
+        break;
+    default:
+        memcpy(rgb, &((const float *)stored)[i], sizeof(float)*COLOR_COMPS);
+        break;
+    }
+}
+
+void canvasDownsampleTile(Canvas * c, int tx, int ty, int level, float * out, int stride)
+{
+    int step = 1 << level;
+    int w = canvasTileWidth(c, tx), h = canvasTileHeight(c, ty);
+    int cols = (w + step - 1) >> level;
+    float sum[TILE_STRIDE];
+    const void * tile = canvasLockStored(c, tx, ty);
+    for(int y0 = 0; y0 < h; y0 += step) {
+        int y1 = y0 + step < h ? y0 + step : h;
+        memset(sum, 0, sizeof(float)*cols*COLOR_COMPS);
+        for(int y = y0; y < y1; ++y) {
+            for(int x = 0; x < w; ++x) {
+                float p[COLOR_COMPS];
+                canvasStoredPixel(c, tile, x, y, p);
+                for(int ch = 0; ch < COLOR_COMPS; ++ch)
+                    sum[(x >> level)*COLOR_COMPS + ch] += p[ch];
+            }
+        }
+        float * row = &out[(y0 >> level)*stride];
+        for(int ox = 0; ox < cols; ++ox) {
+            int bw = w - ox*step < step ? w - ox*step : step;
+            float k = 1.0f/(bw*(y1 - y0));
+            for(int ch = 0; ch < COLOR_COMPS; ++ch)
+                row[ox*COLOR_COMPS + ch] = k*sum[ox*COLOR_COMPS + ch];
+        }
+    }
+    canvasUnlockTile(c, tx, ty, tile);
+}
+
+Color canvasColor(CanvasFormat format, Color c)
+{
+    if(format != CANVAS_SRGB8)
+        return c;
+    return (Color){srgbDecode(c.r), srgbDecode(c.g), srgbDecode(c.b), c.a};
+}
+
+static long long canvasOverhead(const Canvas * c)
+{
+    long long fill = c->format == CANVAS_FLOAT ? 0 : TILE_BYTES;
+    return (sizeof(atomic_uint) + sizeof(CanvasTile))*(long long)c->tilesX*c->tilesY + fill;
+}
+
+Canvas * canvasCreate(int width, int height, Color fill, CanvasFormat format)
+{
+    Canvas * c = calloc(1, sizeof(Canvas));
+    c->width = width;
+    c->height = height;
+    c->tilesX = tilesFor(width);
+    c->tilesY = tilesFor(height);
+    c->format = format;
+    c->storedBytes = formatBytes(format)*TILE_PIXELS*COLOR_COMPS;
+    c->fill = fill;
+    atomic_init(&c->version, 0);
+    atomic_init(&c->faults, 0);
+    atomic_init(&c->spillFailures, 0);
+    c->tileVersions = calloc(c->tilesX*c->tilesY, sizeof(atomic_uint));
+
+    c->fillTile = malloc(TILE_BYTES);
+    for(int i = 0; i < TILE_PIXELS; ++i) {
+        c->fillTile[i*COLOR_COMPS + 0] = fill.r;
+        c->fillTile[i*COLOR_COMPS + 1] = fill.g;
+        c->fillTile[i*COLOR_COMPS + 2] = fill.b;
+    }
+    TileBlob * fillBlob = blobCreate(c->storedBytes, SUBSYSTEM_CANVAS);
+    canvasEncodeTile(c, fillBlob->data, c->fillTile);
+    c->fillBlob = blobIntern(fillBlob, SUBSYSTEM_CANVAS);
+    c->fillStored = c->fillBlob->data;
+    if(format == CANVAS_FLOAT) {
+        free(c->fillTile);
+        c->fillTile = c->fillStored;
+    }
+
+    c->tiles = calloc(c->tilesX*c->tilesY, sizeof(CanvasTile));
+    for(int i = 0; i < c->tilesX*c->tilesY; ++i) {
+        CanvasTile * t = &c->tiles[i];
+        t->prev = t->next = t->workPrev = t->workNext = -1;
+    }
+    c->lruHead = c->lruTail = -1;
+    c->workHead = c->workTail = -1;
+    pthread_mutex_init(&c->lock, NULL);
+
+    memoryCharge(SUBSYSTEM_CANVAS, canvasOverhead(c), 0, 0);
+    return c;
+}
+
+void canvasDestroy(Canvas * c)
+{
+    if(!c)
+        return;
+    for(int i = 0; i < c->tilesX*c->tilesY; ++i) {
+        free(c->tiles[i].work);
+        blobRelease(c->tiles[i].blob, SUBSYSTEM_CANVAS);
+    }
+    memoryCharge(SUBSYSTEM_CANVAS, -canvasOverhead(c) - (long long)TILE_BYTES*c->working, 0, 0);
+    if(c->scratch)
+        fclose(c->scratch);
+    pthread_mutex_destroy(&c->lock);
+    free(c->tiles);
+    if(c->fillTile != c->fillStored)
+        free(c->fillTile);
+    blobRelease(c->fillBlob, SUBSYSTEM_CANVAS);
+    free(c->tileVersions);
+    free(c);
+}
+
+// The LRU lists run from the most recently used tile at the head to the
+// next eviction candidate at the tail: one for every resident tile, one
+// for the tiles that also have a float working copy.
+static void lruUnlink(Canvas * c, int i)
+{
+    CanvasTile * t = &c->tiles[i];
+    if(t->prev >= 0)
+        c->tiles[t->prev].next = t->next;
+    else
+        c->lruHead = t->next;
+    if(t->next >= 0)
+        c->tiles[t->next].prev = t->prev;
+    else
+        c->lruTail = t->prev;
+    t->prev = t->next = -1;
+}
+
+static void lruPushFront(Canvas * c, int i)
+{
+    CanvasTile * t = &c->tiles[i];
+    t->prev = -1;
+    t->next = c->lruHead;
+    if(c->lruHead >= 0)
+        c->tiles[c->lruHead].prev = i;
+    else
+        c->lruTail = i;
+    c->lruHead = i;
+}
+
+static void workUnlink(Canvas * c, int i)
+{
+    CanvasTile * t = &c->tiles[i];
+    if(t->workPrev >= 0)
+        c->tiles[t->workPrev].workNext = t->workNext;
+    else
+        c->workHead = t->workNext;
+    if(t->workNext >= 0)
+        c->tiles[t->workNext].workPrev = t->workPrev;
+    else
+        c->workTail = t->workPrev;
+    t->workPrev = t->workNext = -1;
+}
+
+static void workPushFront(Canvas * c, int i)
+{
+    CanvasTile * t = &c->tiles[i];
+    t->workPrev = -1;
+    t->workNext = c->workHead;
+    if(c->workHead >= 0)
+        c->tiles[c->workHead].workPrev = i;
+    else
+        c->workTail = i;
+    c->workHead = i;
+}
+
+// Called before the stored data of tile i changes. Snapshots are listed
+// newest first; those taken since the tile was last shared with them still
+// read its data, and each gets a reference to it.
+static void copyOnWrite(Canvas * c, int i)
+{
+    CanvasTile * t = &c->tiles[i];
+    if(!c->snapshots || c->snapshots->epoch <= t->epoch)
+        return;
+    for(CanvasSnapshot * s = c->snapshots; s && s->epoch > t->epoch; s = s->next) {
+        if(!s->versions)
+            s->versions = calloc(c->tilesX*c->tilesY, sizeof(TileBlob *));
+        s->versions[i] = t->blob;
+        blobRetain(t->blob, SUBSYSTEM_CANVAS);
+    }
+    t->epoch = c->epoch;
+}
+
+// Leaves tile i with stored data nobody else sees, copied over from what
+// it had when keep says the writer wants that.
+static void prepareWrite(Canvas * c, int i, bool keep)
+{
+    CanvasTile * t = &c->tiles[i];
+    copyOnWrite(c, i);
+    t->blob = blobWritable(t->blob, SUBSYSTEM_CANVAS, keep);
+}
+
+// While the tile is locked a writer may still be changing the copy, so it
+// stays dirty until flushed with nobody holding it.
+static void flushWork(Canvas * c, CanvasTile * t)
+{
+    if(t->work && t->workDirty) {
+        prepareWrite(c, t - c->tiles, false);
+        canvasEncodeTile(c, t->blob->data, t->work);
+        t->workDirty = t->pins > 0;
+    }
+}
+
+static void dropWork(Canvas * c, int i)
+{
+    CanvasTile * t = &c->tiles[i];
+    flushWork(c, t);
+    workUnlink(c, i);
+    free(t->work);
+    t->work = NULL;
+    --c->working;
+    memoryCharge(SUBSYSTEM_CANVAS, -(long long)TILE_BYTES, 0, 0);
+}
+
+// Past WORK_TILES the least recently used unpinned copies go back into
+// storage. Pinned ones stay, so the set can briefly run over.
+static void trimWork(Canvas * c)
+{
+    for(int i = c->workTail; i >= 0 && c->working > WORK_TILES; ) {
+        int prev = c->tiles[i].workPrev;
+        if(!c->tiles[i].pins)
+            dropWork(c, i);
+        i = prev;
+    }
+}
+
+// pread and pwrite may stop short or be interrupted; these go on until the
+// whole tile is through.
+static bool readStored(Canvas * c, int i, void * stored)
+{
+    uint8_t * p = stored;
+    for(size_t done = 0; done < c->storedBytes; ) {
+        ssize_t n = pread(fileno(c->scratch), &p[done], c->storedBytes - done, (off_t)i*c->storedBytes + done);
+        if(n <= 0 && !(n < 0 && errno == EINTR))
+            return false;
+        done += n > 0 ? n : 0;
+    }
+    return true;
+}
+
+static bool writeStored(Canvas * c, int i, const void * stored)
+{
+    const uint8_t * p = stored;
+    for(size_t done = 0; done < c->storedBytes; ) {
+        ssize_t n = pwrite(fileno(c->scratch), &p[done], c->storedBytes - done, (off_t)i*c->storedBytes + done);
+        if(n <= 0 && !(n < 0 && errno == EINTR))
+            return false;
+        done += n > 0 ? n : 0;
+    }
+    return true;
+}
+
+// Tiles that are unchanged since they were last read back are dropped
+// without writing them out again. One that cannot be written stays in
+// memory.
+static bool spillTile(Canvas * c, int i)
+{
+    CanvasTile * t = &c->tiles[i];
+    if(!c->scratch && !(c->scratch = tmpfile())) {
+        atomic_fetch_add(&c->spillFailures, 1);
+        return false;
+    }
+    flushWork(c, t);
+    if(t->dirty || !t->spilled) {
+        if(!writeStored(c, i, t->blob->data)) {
+            atomic_fetch_add(&c->spillFailures, 1);
+            return false;
+        }
+    }
+    if(t->work)
+        dropWork(c, i);
+
+    lruUnlink(c, i);
+    blobRelease(t->blob, SUBSYSTEM_CANVAS);
+    t->blob = NULL;
+    t->spilled = true;
+    t->dirty = false;
+    --c->resident;
+    return true;
+}
+
+// Against its own budget a canvas counts every resident tile and working
+// copy, shared or not; against the process wide one, what the whole
+// subsystem holds.
+static bool overBudget(const Canvas * c, size_t budget)
+{
+    if(c->budget)
+        return (size_t)c->resident*c->storedBytes + (size_t)c->working*TILE_BYTES > budget;
+    return memoryCpu(SUBSYSTEM_CANVAS) > budget;
+}
+
+// Dropping a duplicate is cheaper than a trip to disk, so each candidate
+// is looked up by content before it is spilled. A tile stays interned
+// until it is written again.
+static void enforceBudget(Canvas * c)
+{
+    size_t budget = c->budget ? c->budget : memoryCpuBudget(SUBSYSTEM_CANVAS);
+    if(!budget)
+        return;
+    for(int i = c->lruTail; i >= 0 && overBudget(c, budget); ) {
+        CanvasTile * t = &c->tiles[i];
+        int prev = t->prev;
+        if(!t->pins) {
+            flushWork(c, t);
+            t->blob = blobIntern(t->blob, SUBSYSTEM_CANVAS);
+            if(overBudget(c, budget) && !spillTile(c, i))
+                return;
+        }
+        i = prev;
+    }
+}
+
+void canvasSetBudget(Canvas * c, size_t bytes)
+{
+    pthread_mutex_lock(&c->lock);
+    c->budget = bytes;
+    enforceBudget(c);
+    pthread_mutex_unlock(&c->lock);
+}
+
+static void faultIn(Canvas * c, int i)
+{
+    CanvasTile * t = &c->tiles[i];
+    if(t->spilled) {
+        double start = statsNow();
+        t->blob = blobCreate(c->storedBytes, SUBSYSTEM_CANVAS);
+        // the tile stays marked spilled and clean, so its copy on the file
+        // is only overwritten once it is painted again
+        if(!readStored(c, i, t->blob->data)) {
+            memcpy(t->blob->data, c->fillStored, c->storedBytes);
+            atomic_fetch_add(&c->spillFailures, 1);
+        }
+        statsRecord(STAGE_FAULT, statsNow() - start);
+        atomic_fetch_add(&c->faults, 1);
+    } else {
+        // the first write copies it
+        t->blob = c->fillBlob;
+        blobRetain(t->blob, SUBSYSTEM_CANVAS);
+    }
+
+    ++c->resident;
+    lruPushFront(c, i);
+}
+
+static void makeResident(Canvas * c, int i)
+{
+    if(c->tiles[i].blob) {
+        lruUnlink(c, i);
+        lruPushFront(c, i);
+    } else {
+        faultIn(c, i);
+    }
+}
+
+static float * workCopy(Canvas * c, int i)
+{
+    CanvasTile * t = &c->tiles[i];
+    if(c->format == CANVAS_FLOAT)
+        return (float *)t->blob->data;
+
+    if(t->work) {
+        workUnlink(c, i);
+    } else {
+        t->work = malloc(TILE_BYTES);
+        decodeTile(c, t->work, t->blob->data);
+        ++c->working;
+        memoryCharge(SUBSYSTEM_CANVAS, TILE_BYTES, 0, 0);
+    }
+    workPushFront(c, i);
+    return t->work;
+}
+
+float * canvasLockTile(Canvas * c, int tx, int ty, TileAccess access)
+{
+    int i = ty*c->tilesX + tx;
+    CanvasTile * t = &c->tiles[i];
+
+    pthread_mutex_lock(&c->lock);
+    if(!t->blob && !t->spilled && access == TILE_READ) {
+        pthread_mutex_unlock(&c->lock);
+        return c->fillTile;
+    }
+
+    makeResident(c, i);
+    // float tiles are written in place; the others only change their
+    // stored data when the working copy is flushed
+    if(access == TILE_WRITE && c->format == CANVAS_FLOAT)
+        prepareWrite(c, i, true);
+    float * data = workCopy(c, i);
+    ++t->pins;
+    if(access == TILE_WRITE)
+        t->dirty = t->workDirty = true;
+    trimWork(c);
+    enforceBudget(c);
+    pthread_mutex_unlock(&c->lock);
+    return data;
+}
+
+const void * canvasLockStored(Canvas * c, int tx, int ty)
+{
+    int i = ty*c->tilesX + tx;
+    CanvasTile * t = &c->tiles[i];
+
+    pthread_mutex_lock(&c->lock);
+    if(!t->blob && !t->spilled) {
+        pthread_mutex_unlock(&c->lock);
+        return c->fillStored;
+    }
+
+    makeResident(c, i);
+    flushWork(c, t);
+    ++t->pins;
+    const void * data = t->blob->data;
+    enforceBudget(c);
+    pthread_mutex_unlock(&c->lock);
+    return data;
+}
+
+void canvasUnlockTile(Canvas * c, int tx, int ty, const void * data)
+{
+    if(data == c->fillTile || data == c->fillStored)
+        return;
+    pthread_mutex_lock(&c->lock);
+    --c->tiles[ty*c->tilesX + tx].pins;
+    trimWork(c);
+    enforceBudget(c);
+    pthread_mutex_unlock(&c->lock);
+}
+
+// Brings the tile in with any pending working copy flushed, so its blob
+// holds the current pixels.
+static void currentBlob(Canvas * c, int i)
+{
+    makeResident(c, i);
+    flushWork(c, &c->tiles[i]);
+}
+
+TileBlob * canvasShareTile(Canvas * c, int tx, int ty, Subsystem s)
+{
+    int i = ty*c->tilesX + tx;
+    CanvasTile * t = &c->tiles[i];
+
+    pthread_mutex_lock(&c->lock);
+    if(!t->blob && !t->spilled) {
+        pthread_mutex_unlock(&c->lock);
+        blobRetain(c->fillBlob, s);
+        return c->fillBlob;
+    }
+    currentBlob(c, i);
+    TileBlob * shared = t->blob;
+    blobRetain(shared, s);
+    enforceBudget(c);
+    pthread_mutex_unlock(&c->lock);
+    return shared;
+}
+
+TileBlob * canvasSwapTile(Canvas * c, int tx, int ty, TileBlob * blob, Subsystem s)
+{
+    int i = ty*c->tilesX + tx;
+    CanvasTile * t = &c->tiles[i];
+
+    pthread_mutex_lock(&c->lock);
+    currentBlob(c, i);
+    copyOnWrite(c, i);
+    // the working copy would now be stale
+    if(t->work)
+        dropWork(c, i);
+    TileBlob * previous = t->blob;
+    blobTransfer(previous, SUBSYSTEM_CANVAS, s);
+    blobTransfer(blob, s, SUBSYSTEM_CANVAS);
+    t->blob = blob;
+    t->dirty = true;
+    enforceBudget(c);
+    pthread_mutex_unlock(&c->lock);
+    return previous;
+}
+
+Canvas * canvasCopy(Canvas * c)
+{
+    Canvas * copy = canvasCreate(c->width, c->height, c->fill, c->format);
+    copy->budget = c->budget;
+    for(int i = 0; i < c->tilesX*c->tilesY; ++i) {
+        CanvasTile * t = &c->tiles[i];
+        TileBlob * shared = NULL;
+        pthread_mutex_lock(&c->lock);
+        if(t->blob || t->spilled) {
+            currentBlob(c, i);
+            shared = t->blob;
+            blobRetain(shared, SUBSYSTEM_CANVAS);
+            enforceBudget(c);
+        }
+        pthread_mutex_unlock(&c->lock);
+        if(!shared)
+            continue;
+
+        pthread_mutex_lock(&copy->lock);
+        copy->tiles[i].blob = shared;
+        copy->tiles[i].dirty = true;
+        ++copy->resident;
+        lruPushFront(copy, i);
+        enforceBudget(copy);
+        pthread_mutex_unlock(&copy->lock);
+    }
+    return copy;
+}
+
+CanvasSnapshot * canvasSnapshot(Canvas * c)
+{
+    CanvasSnapshot * s = calloc(1, sizeof(CanvasSnapshot));
+    s->canvas = c;
+    pthread_mutex_lock(&c->lock);
+    // a snapshot shares stored data, so pending working copies go there
+    // first
+    for(int i = c->workHead; i >= 0; i = c->tiles[i].workNext)
+        flushWork(c, &c->tiles[i]);
+    s->epoch = ++c->epoch;
+    s->next = c->snapshots;
+    if(c->snapshots)
+        c->snapshots->prev = s;
+    c->snapshots = s;
+    pthread_mutex_unlock(&c->lock);
+    return s;
+}
+
+void canvasSnapshotRelease(CanvasSnapshot * s)
+{
+    if(!s)
+        return;
+    Canvas * c = s->canvas;
+    pthread_mutex_lock(&c->lock);
+    if(s->prev)
+        s->prev->next = s->next;
+    else
+        c->snapshots = s->next;
+    if(s->next)
+        s->next->prev = s->prev;
+    pthread_mutex_unlock(&c->lock);
+    for(int i = 0; s->versions && i < c->tilesX*c->tilesY; ++i)
+        blobRelease(s->versions[i], SUBSYSTEM_CANVAS);
+    free(s->versions);
+    free(s);
+}
+
+// A version belongs to the snapshot until it is released, so it can be
+// copied without the lock; a shared tile is copied under it, as a writer
+// may be about to change it.
+void canvasSnapshotRead(CanvasSnapshot * s, int tx, int ty, void * stored)
+{
+    Canvas * c = s->canvas;
+    int i = ty*c->tilesX + tx;
+    CanvasTile * t = &c->tiles[i];
+
+    pthread_mutex_lock(&c->lock);
+    TileBlob * v = s->versions ? s->versions[i] : NULL;
+    if(v) {
+        pthread_mutex_unlock(&c->lock);
+        memcpy(stored, v->data, c->storedBytes);
+        return;
+    }
+    if(t->blob)
+        memcpy(stored, t->blob->data, c->storedBytes);
+    else if(!t->spilled)
+        memcpy(stored, c->fillStored, c->storedBytes);
+    else if(!readStored(c, i, stored)) {
+        memcpy(stored, c->fillStored, c->storedBytes);
+        atomic_fetch_add(&c->spillFailures, 1);
+    }
+    pthread_mutex_unlock(&c->lock);
+}
+
+int canvasPrefetch(Canvas * c, Rect r, int maxTiles)
+{
+    int tx0 = r.origin.x/TILE_SIZE, ty0 = r.origin.y/TILE_SIZE;
+    int tx1 = (r.origin.x + r.size.width - 1)/TILE_SIZE;
+    int ty1 = (r.origin.y + r.size.height - 1)/TILE_SIZE;
+    tx0 = tx0 < 0 ? 0 : tx0;
+    ty0 = ty0 < 0 ? 0 : ty0;
+
+    int loaded = 0;
+    pthread_mutex_lock(&c->lock);
+    for(int ty = ty0; ty <= ty1 && ty < c->tilesY; ++ty) {
+        for(int tx = tx0; tx <= tx1 && tx < c->tilesX; ++tx) {
+            int i = ty*c->tilesX + tx;
+            CanvasTile * t = &c->tiles[i];
+            if(t->blob) {
+                lruUnlink(c, i);
+                lruPushFront(c, i);
+            } else if(t->spilled && loaded < maxTiles) {
+                faultIn(c, i);
+                ++loaded;
+            }
+        }
+    }
+    enforceBudget(c);
+    pthread_mutex_unlock(&c->lock);
+    return loaded;
+}
+
+unsigned canvasFaults(const Canvas * c)
+{
+    return atomic_load(&c->faults);
+}
+
+unsigned canvasSpillFailures(const Canvas * c)
+{
+    return atomic_load(&c->spillFailures);
+}
+
+void canvasTouchRect(Canvas * c, Rect r)
+{
+    int tx0 = r.origin.x/TILE_SIZE;
+    int ty0 = r.origin.y/TILE_SIZE;
+    int tx1 = (r.origin.x + r.size.width - 1)/TILE_SIZE;
+    int ty1 = (r.origin.y + r.size.height - 1)/TILE_SIZE;
+    for(int ty = ty0; ty <= ty1 && ty < c->tilesY; ++ty)
+        for(int tx = tx0; tx <= tx1 && tx < c->tilesX; ++tx)
+            canvasTouchTile(c, tx, ty);
+}
+
+void dirtyTrackerInit(DirtyTracker * t, const Canvas * c)
+{
+    t->version = 0;
+    t->seen = calloc(c->tilesX*c->tilesY, sizeof(unsigned));
+}
+
+void dirtyTrackerFree(DirtyTracker * t)
+{
+    free(t->seen);
+    t->seen = NULL;
+}
+
+void dirtyTrackerSkip(DirtyTracker * t, const Canvas * c, int tx, int ty)
+{
+    int i = ty*c->tilesX + tx;
+    t->seen[i] = atomic_load(&c->tileVersions[i]);
+}
+
+int canvasCollectDirty(Canvas * c, DirtyTracker * t, TileFunc fn, void * ctx)
+{
+    unsigned version = atomic_load(&c->version);
+    if(version == t->version)
+        return 0;
+    t->version = version;
+
+    int count = 0;
+    for(int ty = 0; ty < c->tilesY; ++ty) {
+        for(int tx = 0; tx < c->tilesX; ++tx) {
+            int i = ty*c->tilesX + tx;
+            unsigned v = atomic_load(&c->tileVersions[i]);
+            if(v == t->seen[i])
+                continue;
+            t->seen[i] = v;
+            fn(tx, ty, ctx);
+            ++count;
+        }
+    }
+    return count;
+}
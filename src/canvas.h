@@ -0,0 +1,218 @@
+#ifndef DAPPER_CANVAS_H
+#define DAPPER_CANVAS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "blob.h"
+#include "geometry.h"
+#include "tile.h"
+
+#define COLOR_COMPS 3
+// Tiles are stored at full size even on the right and bottom edges, so
+// every row of tile data is TILE_STRIDE floats apart.
+#define TILE_STRIDE (TILE_SIZE*COLOR_COMPS)
+#define TILE_BYTES (sizeof(float)*TILE_PIXELS*COLOR_COMPS)
+// Most float working copies kept for tiles stored in a narrower format.
+#define WORK_TILES 64
+
+// How tiles are kept in memory and on the scratch file. Everything outside
+// the canvas sees float RGB; narrower formats are decoded into a float
+// working copy while a tile is in use. With CANVAS_SRGB8 those floats are
+// linear light and storage is sRGB encoded bytes.
+enum CanvasFormat {
+    CANVAS_FLOAT,
+    CANVAS_HALF,
+    CANVAS_SRGB8
+};
+typedef enum CanvasFormat CanvasFormat;
+
+// Colours are picked as they look on screen; a linear canvas wants them
+// decoded first.
+Color canvasColor(CanvasFormat format, Color c);
+
+struct CanvasTile {
+    TileBlob * blob;
+    float * work;
+    int pins;
+    // The snapshot epoch the stored data was last shared with snapshots in.
+    unsigned epoch;
+    int prev, next;
+    int workPrev, workNext;
+    bool spilled, dirty, workDirty;
+};
+typedef struct CanvasTile CanvasTile;
+
+// The pixel store: RGB tiles in the canvas format, kept in memory up to
+// the canvas CPU budget (SUBSYSTEM_CANVAS, or the canvas's own) and spilled
+// least recently used first to an anonymous scratch file beyond it. A tile nobody has written
+// yet takes no memory at all and reads as the fill colour. Stored data are
+// blobs, shared with snapshots and the undo history and deduplicated by
+// content when the budget runs short, before anything is spilled; a write
+// to a shared tile copies it first.
+//
+// Pixels are reached through canvasLockTile, which faults the tile in if
+// needed and pins it until canvasUnlockTile; pinned tiles are never
+// spilled. Writers stamp each tile they finish with a new version so any
+// number of readers (texture upload, ...) can find what changed since they
+// last looked.
+struct Canvas {
+    int width, height;
+    int tilesX, tilesY;
+    atomic_uint version;
+    atomic_uint * tileVersions;
+
+    CanvasFormat format;
+    size_t storedBytes;
+    Color fill;
+    float * fillTile;
+    void * fillStored;
+    TileBlob * fillBlob;
+    CanvasTile * tiles;
+    pthread_mutex_t lock;
+    int lruHead, lruTail;
+    int workHead, workTail;
+    int resident, working;
+    // 0 keeps the canvas within the SUBSYSTEM_CANVAS budget
+    size_t budget;
+    FILE * scratch;
+    atomic_uint faults;
+    atomic_uint spillFailures;
+
+    unsigned epoch;
+    struct CanvasSnapshot * snapshots;
+};
+typedef struct Canvas Canvas;
+
+typedef struct CanvasSnapshot CanvasSnapshot;
+
+enum TileAccess {
+    TILE_READ,
+    TILE_WRITE
+};
+typedef enum TileAccess TileAccess;
+
+struct DirtyTracker {
+    unsigned version;
+    unsigned * seen;
+};
+typedef struct DirtyTracker DirtyTracker;
+
+Canvas * canvasCreate(int width, int height, Color fill, CanvasFormat format);
+void canvasDestroy(Canvas * c);
+
+// Returns the tile's pixels, TILE_STRIDE floats per row. Reading a tile
+// that was never written returns the shared fill tile and allocates
+// nothing. Pass the same pointer back to canvasUnlockTile.
+float * canvasLockTile(Canvas * c, int tx, int ty, TileAccess access);
+void canvasUnlockTile(Canvas * c, int tx, int ty, const void * data);
+
+// The tile as stored, TILE_SIZE pixels of COLOR_COMPS components per row in
+// the canvas format, for uploads that want no conversion. Unlock with
+// canvasUnlockTile.
+const void * canvasLockStored(Canvas * c, int tx, int ty);
+
+// A canvas of its own with the same pixels, sharing every stored tile
+// with c until one side writes it. Take it while no writer holds a tile.
+Canvas * canvasCopy(Canvas * c);
+
+// Freezes the canvas as it is now without copying any pixels: tiles stay
+// shared until the next write to each, which first hands the snapshot a
+// copy of what it is about to overwrite. Readers on any thread then see
+// the frozen image while painting goes on. Take it while no writer holds
+// a tile, and release every snapshot before destroying the canvas.
+CanvasSnapshot * canvasSnapshot(Canvas * c);
+void canvasSnapshotRelease(CanvasSnapshot * s);
+
+// Copies the tile as it was when the snapshot was taken into stored,
+// storedBytes in the canvas format.
+void canvasSnapshotRead(CanvasSnapshot * s, int tx, int ty, void * stored);
+
+// Returns a reference, held by s, to the tile's stored data as it is now:
+// the canvas copies it before writing there again. No writer may hold the
+// tile.
+TileBlob * canvasShareTile(Canvas * c, int tx, int ty, Subsystem s);
+
+// Makes blob, a reference s holds, the tile's stored data, and returns the
+// previous data as another reference held by s. Nobody may hold the tile.
+TileBlob * canvasSwapTile(Canvas * c, int tx, int ty, TileBlob * blob, Subsystem s);
+
+// Gives the canvas a budget of its own, in bytes of resident tiles and
+// working copies, in place of the process wide one; canvases sharing the
+// process then never spill tiles for each other. 0 goes back to the
+// process wide budget.
+void canvasSetBudget(Canvas * c, size_t bytes);
+
+// Brings spilled tiles inside r back into memory, at most maxTiles of
+// them, and marks every resident tile in r as recently used. Returns the
+// number of tiles read back from disk.
+int canvasPrefetch(Canvas * c, Rect r, int maxTiles);
+
+// Total tiles read back from the scratch file so far; the time spent on
+// them is recorded against STAGE_FAULT.
+unsigned canvasFaults(const Canvas * c);
+
+// Scratch file writes and reads that failed so far. A tile that could not
+// be written stays in memory; one that could not be read back reads as the
+// fill colour.
+unsigned canvasSpillFailures(const Canvas * c);
+
+// Call after the tile's pixels have been written.
+static inline void canvasTouchTile(Canvas * c, int tx, int ty)
+{
+    unsigned v = atomic_fetch_add(&c->version, 1) + 1;
+    atomic_store(&c->tileVersions[ty*c->tilesX + tx], v);
+}
+
+void canvasTouchRect(Canvas * c, Rect r);
+
+void dirtyTrackerInit(DirtyTracker * t, const Canvas * c);
+void dirtyTrackerFree(DirtyTracker * t);
+
+// Marks the tile's current version as seen, for readers that already have
+// the pixels by other means.
+void dirtyTrackerSkip(DirtyTracker * t, const Canvas * c, int tx, int ty);
+
+// Calls fn for every tile touched since the previous collect; returns the
+// number of tiles reported.
+int canvasCollectDirty(Canvas * c, DirtyTracker * t, TileFunc fn, void * ctx);
+
+static inline float * tilePixel(float * tile, int x, int y)
+{
+    return &tile[y*TILE_STRIDE + x*COLOR_COMPS];
+}
+
+void canvasStoredPixel(const Canvas * c, const void * stored, int x, int y, float * rgb);
+
+// Converts a float tile into the canvas format, storedBytes long.
+void canvasEncodeTile(const Canvas * c, void * stored, const float * pixels);
+void canvasEncodePixels(const Canvas * c, void * stored, const float * pixels, int count);
+
+// Shrinks a tile by 2^level, level < 8, into out with rows stride floats
+// apart. Each texel is the average of every pixel in its block, so thin
+// strokes fade rather than vanish; edge tiles fill only the texels they
+// cover, from the pixels they have. The mip levels the canvas is shown at
+// are built from these.
+void canvasDownsampleTile(Canvas * c, int tx, int ty, int level, float * out, int stride);
+
+static inline int canvasTileWidth(const Canvas * c, int tx)
+{
+    int w = c->width - tx*TILE_SIZE;
+    return w < TILE_SIZE ? w : TILE_SIZE;
+}
+
+static inline int canvasTileHeight(const Canvas * c, int ty)
+{
+    int h = c->height - ty*TILE_SIZE;
+    return h < TILE_SIZE ? h : TILE_SIZE;
+}
+
+static inline Rect canvasTileRect(const Canvas * c, int tx, int ty)
+{
+    return (Rect){{tx*TILE_SIZE, ty*TILE_SIZE}, {canvasTileWidth(c, tx), canvasTileHeight(c, ty)}};
+}
+
+#endif
@@ -0,0 +1,733 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "collab.h"
+
+#define POSITION_SCALE 16
+#define TIME_SCALE 1e6
+#define READ_CHUNK 65536
+// No stroke comes anywhere near this; anything longer is not a peer.
+#define MAX_MESSAGE (64 << 20)
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+enum MessageTag {
+    MESSAGE_WELCOME = 1,
+    MESSAGE_STROKE,
+    MESSAGE_HELLO
+};
+
+struct Bytes {
+    uint8_t * data;
+    size_t length, capacity;
+};
+typedef struct Bytes Bytes;
+
+struct Reader {
+    const uint8_t * data;
+    size_t offset, length;
+};
+typedef struct Reader Reader;
+
+// What a client still has to be sent is its own output, then the log from
+// logSent on: everything the relay sends besides the welcome is logged, so
+// the log doubles as every client's outbound queue. Only members, whose
+// canvas matched, are sent the log or heard from.
+struct RelayClient {
+    int fd;
+    unsigned id;
+    bool gone, member;
+    Bytes input;
+    Bytes output;
+    size_t logSent;
+};
+typedef struct RelayClient RelayClient;
+
+struct CollabRelay {
+    char * path;
+    int listener;
+    int wake[2];
+    pthread_t thread;
+    bool joined;
+    RelayClient * clients;
+    int clientCount, clientCapacity;
+    unsigned nextId;
+    unsigned long long sequence;
+    Bytes log;
+    // the canvas every stroke in the log was painted on, taken from the
+    // first painter to say hello
+    bool hasCanvas;
+    CollabCanvas canvas;
+};
+
+struct Collab {
+    int fd;
+    unsigned id;
+    unsigned long long sequence;
+    bool connected;
+    Bytes input;
+    CollabStroke * pending;
+    int pendingCount, pendingCapacity;
+    CollabStroke incoming;
+};
+
+static void reserve(Bytes * b, size_t more)
+{
+    if(b->length + more <= b->capacity)
+        return;
+    while(b->length + more > b->capacity)
+        b->capacity = b->capacity ? 2*b->capacity : 256;
+    b->data = realloc(b->data, b->capacity);
+}
+
+static void putBytes(Bytes * b, const void * data, size_t length)
+{
+    reserve(b, length);
+    memcpy(&b->data[b->length], data, length);
+    b->length += length;
+}
+
+static void putByte(Bytes * b, uint8_t v)
+{
+    putBytes(b, &v, 1);
+}
+
+static void putVarint(Bytes * b, unsigned long long v)
+{
+    do {
+        uint8_t byte = v & 0x7f;
+        v >>= 7;
+        putByte(b, byte | (v ? 0x80 : 0));
+    } while(v);
+}
+
+// Zigzag, so small negative deltas stay small.
+static void putSigned(Bytes * b, long long v)
+{
+    putVarint(b, v < 0 ? ((unsigned long long)-(v + 1) << 1) | 1 : (unsigned long long)v << 1);
+}
+
+// Peers share a machine, so floats go as they are in memory.
+static void putFloat(Bytes * b, float v)
+{
+    putBytes(b, &v, sizeof(float));
+}
+
+static bool getVarint(Reader * r, unsigned long long * v)
+{
+    *v = 0;
+    for(int shift = 0; r->offset < r->length && shift < 64; shift += 7) {
+        uint8_t b = r->data[r->offset++];
+        *v |= (unsigned long long)(b & 0x7f) << shift;
+        if(!(b & 0x80))
+            return true;
+    }
+    return false;
+}
+
+static bool getSigned(Reader * r, long long * v)
+{
+    unsigned long long u;
+    if(!getVarint(r, &u))
+        return false;
+    *v = u & 1 ? -(long long)(u >> 1) - 1 : (long long)(u >> 1);
+    return true;
+}
+
+static bool getFloat(Reader * r, float * v)
+{
+    if(r->length - r->offset < sizeof(float))
+        return false;
+    memcpy(v, &r->data[r->offset], sizeof(float));
+    r->offset += sizeof(float);
+    return true;
+}
+
+// Finds the next whole message in b past *offset: payload is its tag and
+// body. False when it has not all arrived yet, or on garbage (*bad).
+static bool nextMessage(const Bytes * b, size_t * offset, Reader * payload, bool * bad)
+{
+    Reader r = {b->data, *offset, b->length};
+    unsigned long long length;
+    *bad = false;
+    if(!getVarint(&r, &length)) {
+        *bad = r.offset - *offset >= 10;
+        return false;
+    }
+    if(length == 0 || length > MAX_MESSAGE) {
+        *bad = true;
+        return false;
+    }
+    if(r.length - r.offset < length)
+        return false;
+    *payload = (Reader){b->data, r.offset, r.offset + length};
+    *offset = r.offset + length;
+    return true;
+}
+
+static void dropConsumed(Bytes * b, size_t consumed)
+{
+    memmove(b->data, &b->data[consumed], b->length - consumed);
+    b->length -= consumed;
+}
+
+static void putMessage(Bytes * out, const Bytes * payload)
+{
+    putVarint(out, payload->length);
+    putBytes(out, payload->data, payload->length);
+}
+
+static void putStroke(Bytes * b, const CollabStroke * s)
+{
+    putFloat(b, s->brush.size);
+    putFloat(b, s->brush.spacing);
+    putFloat(b, s->brush.color.r);
+    putFloat(b, s->brush.color.g);
+    putFloat(b, s->brush.color.b);
+    putFloat(b, s->brush.color.a);
+    putVarint(b, s->count);
+    CollabSample last = {0, 0, 0};
+    for(int i = 0; i < s->count; ++i) {
+        const CollabSample * p = &s->samples[i];
+        putSigned(b, (long long)p->x - last.x);
+        putSigned(b, (long long)p->y - last.y);
+        putVarint(b, p->time - last.time);
+        last = *p;
+    }
+}
+
+static void reserveSamples(CollabStroke * s, int count)
+{
+    if(count <= s->capacity)
+        return;
+    s->capacity = count > 2*s->capacity ? count : 2*s->capacity;
+    s->samples = realloc(s->samples, sizeof(CollabSample)*s->capacity);
+}
+
+static bool getStroke(Reader * r, CollabStroke * s)
+{
+    Brush * b = &s->brush;
+    unsigned long long count;
+    if(!getFloat(r, &b->size) || !getFloat(r, &b->spacing) || !getFloat(r, &b->color.r) ||
+       !getFloat(r, &b->color.g) || !getFloat(r, &b->color.b) || !getFloat(r, &b->color.a) ||
+       !getVarint(r, &count) || count < 2 || count > r->length - r->offset)
+        return false;
+    reserveSamples(s, count);
+    s->count = count;
+    CollabSample last = {0, 0, 0};
+    for(int i = 0; i < s->count; ++i) {
+        long long dx, dy;
+        unsigned long long dt;
+        if(!getSigned(r, &dx) || !getSigned(r, &dy) || !getVarint(r, &dt))
+            return false;
+        last.x += dx;
+        last.y += dy;
+        last.time += dt;
+        s->samples[i] = last;
+    }
+    return true;
+}
+
+static void putCanvas(Bytes * b, const CollabCanvas * c)
+{
+    putVarint(b, c->width);
+    putVarint(b, c->height);
+    putVarint(b, c->format);
+    putFloat(b, c->fill.r);
+    putFloat(b, c->fill.g);
+    putFloat(b, c->fill.b);
+}
+
+static bool getCanvas(Reader * r, CollabCanvas * c)
+{
+    unsigned long long width, height, format;
+    if(!getVarint(r, &width) || !getVarint(r, &height) || !getVarint(r, &format))
+        return false;
+    *c = (CollabCanvas){width, height, format, {0, 0, 0, 1}};
+    return getFloat(r, &c->fill.r) && getFloat(r, &c->fill.g) && getFloat(r, &c->fill.b);
+}
+
+static bool sameCanvas(const CollabCanvas * a, const CollabCanvas * b)
+{
+    return a->width == b->width && a->height == b->height && a->format == b->format &&
+           a->fill.r == b->fill.r && a->fill.g == b->fill.g && a->fill.b == b->fill.b;
+}
+
+InputEvent collabStrokeAdd(CollabStroke * s, InputEvent e)
+{
+    if(e.type == INPUT_STROKE_BEGIN) {
+        s->count = 0;
+        s->start = e.time;
+    }
+    long long time = llround((e.time - s->start)*TIME_SCALE);
+    reserveSamples(s, s->count + 1);
+    CollabSample * p = &s->samples[s->count++];
+    p->x = lroundf(e.position.x*POSITION_SCALE);
+    p->y = lroundf(e.position.y*POSITION_SCALE);
+    // coalesced events can arrive out of order by a hair
+    p->time = s->count > 1 && time < p[-1].time ? p[-1].time : time;
+    InputEvent rounded = collabStrokeEvent(s, s->count - 1);
+    rounded.type = e.type;
+    return rounded;
+}
+
+InputEvent collabStrokeEvent(const CollabStroke * s, int i)
+{
+    const CollabSample * p = &s->samples[i];
+    InputEventType type = i == 0 ? INPUT_STROKE_BEGIN : (i == s->count - 1 ? INPUT_STROKE_END : INPUT_STROKE_MOVE);
+    Point position = {(float)p->x/POSITION_SCALE, (float)p->y/POSITION_SCALE};
+    return (InputEvent){type, position, p->time/TIME_SCALE};
+}
+
+void collabStrokeFree(CollabStroke * s)
+{
+    free(s->samples);
+    memset(s, 0, sizeof(CollabStroke));
+}
+
+static void noSigpipe(int fd)
+{
+#ifdef SO_NOSIGPIPE
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+}
+
+// Writes everything, waiting on a full socket buffer; false once the peer
+// is gone.
+static bool sendAll(int fd, const uint8_t * data, size_t length)
+{
+    while(length) {
+        ssize_t n = send(fd, data, length, MSG_NOSIGNAL);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            struct pollfd p = {fd, POLLOUT, 0};
+            poll(&p, 1, -1);
+            continue;
+        }
+        if(n <= 0)
+            return false;
+        data += n;
+        length -= n;
+    }
+    return true;
+}
+
+// Appends what has arrived; false once the peer is gone.
+static bool receive(int fd, Bytes * input)
+{
+    reserve(input, READ_CHUNK);
+    ssize_t n = recv(fd, &input->data[input->length], READ_CHUNK, 0);
+    if(n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+        return true;
+    if(n <= 0)
+        return false;
+    input->length += n;
+    return true;
+}
+
+static bool setAddress(struct sockaddr_un * address, const char * path)
+{
+    if(strlen(path) >= sizeof(address->sun_path))
+        return false;
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    strcpy(address->sun_path, path);
+    return true;
+}
+
+static int connectTo(const char * path)
+{
+    struct sockaddr_un address;
+    if(!setAddress(&address, path))
+        return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0)
+        return -1;
+    if(connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+    noSigpipe(fd);
+    return fd;
+}
+
+static void dropClient(CollabRelay * r, int i)
+{
+    close(r->clients[i].fd);
+    free(r->clients[i].input.data);
+    free(r->clients[i].output.data);
+    r->clients[i] = r->clients[--r->clientCount];
+}
+
+static bool clientWaiting(const CollabRelay * r, const RelayClient * client)
+{
+    return client->output.length || (client->member && client->logSent < r->log.length);
+}
+
+// Sends as much as the socket takes without blocking; false once the
+// client is gone.
+static bool sendSome(int fd, const uint8_t * data, size_t length, size_t * sent)
+{
+    while(*sent < length) {
+        ssize_t n = send(fd, &data[*sent], length - *sent, MSG_NOSIGNAL);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return true;
+        if(n <= 0)
+            return false;
+        *sent += n;
+    }
+    return true;
+}
+
+static bool flushClient(CollabRelay * r, RelayClient * client)
+{
+    if(client->output.length) {
+        size_t sent = 0;
+        bool ok = sendSome(client->fd, client->output.data, client->output.length, &sent);
+        dropConsumed(&client->output, sent);
+        if(!ok || client->output.length || !client->member)
+            return ok;
+    }
+    return sendSome(client->fd, r->log.data, r->log.length, &client->logSent);
+}
+
+static void acceptClient(CollabRelay * r)
+{
+    int fd = accept(r->listener, NULL, NULL);
+    if(fd < 0)
+        return;
+    noSigpipe(fd);
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    if(r->clientCount == r->clientCapacity) {
+        r->clientCapacity = r->clientCapacity ? 2*r->clientCapacity : 4;
+        r->clients = realloc(r->clients, sizeof(RelayClient)*r->clientCapacity);
+    }
+    r->clients[r->clientCount++] = (RelayClient){fd, ++r->nextId};
+}
+
+// The welcome tells a painter the relay's canvas. One whose canvas differs
+// is not let in and leaves on reading it; a member gets the whole log
+// after the welcome, a little at a time as its socket drains.
+static void welcome(CollabRelay * r, RelayClient * client, Reader * body)
+{
+    CollabCanvas canvas;
+    if(client->member || !getCanvas(body, &canvas))
+        return;
+    if(!r->hasCanvas) {
+        r->canvas = canvas;
+        r->hasCanvas = true;
+    }
+    client->member = sameCanvas(&canvas, &r->canvas);
+
+    Bytes message = {NULL, 0, 0};
+    putByte(&message, MESSAGE_WELCOME);
+    putVarint(&message, client->id);
+    putCanvas(&message, &r->canvas);
+    putMessage(&client->output, &message);
+    free(message.data);
+}
+
+// Numbers a stroke from client i and logs it for everyone. The body is
+// passed on as it came; only the number and author are added.
+static void relayStroke(CollabRelay * r, int i, Reader * body)
+{
+    Bytes message = {NULL, 0, 0};
+    putByte(&message, MESSAGE_STROKE);
+    putVarint(&message, ++r->sequence);
+    putVarint(&message, r->clients[i].id);
+    putBytes(&message, &body->data[body->offset], body->length - body->offset);
+    putMessage(&r->log, &message);
+    free(message.data);
+}
+
+static bool serveClient(CollabRelay * r, int i)
+{
+    RelayClient * client = &r->clients[i];
+    if(!receive(client->fd, &client->input))
+        return false;
+    size_t offset = 0;
+    Reader payload;
+    bool bad;
+    while(nextMessage(&client->input, &offset, &payload, &bad)) {
+        uint8_t tag = payload.data[payload.offset++];
+        if(tag == MESSAGE_HELLO)
+            welcome(r, client, &payload);
+        else if(tag == MESSAGE_STROKE && client->member)
+            relayStroke(r, i, &payload);
+    }
+    dropConsumed(&client->input, offset);
+    return !bad;
+}
+
+// No socket is ever waited on: what a client cannot take yet stays queued
+// and goes out when poll says it has room, so a slow or stuck painter only
+// falls behind itself.
+static void * relayMain(void * arg)
+{
+    CollabRelay * r = arg;
+    struct pollfd * fds = NULL;
+    for(;;) {
+        int count = r->clientCount + 2;
+        fds = realloc(fds, sizeof(struct pollfd)*count);
+        fds[0] = (struct pollfd){r->wake[0], POLLIN, 0};
+        fds[1] = (struct pollfd){r->listener, POLLIN, 0};
+        for(int i = 0; i < r->clientCount; ++i) {
+            short events = POLLIN | (clientWaiting(r, &r->clients[i]) ? POLLOUT : 0);
+            fds[i + 2] = (struct pollfd){r->clients[i].fd, events, 0};
+        }
+        if(poll(fds, count, -1) < 0 && errno != EINTR)
+            break;
+        if(fds[0].revents)
+            break;
+
+        // clients that left are only dropped at the end, so the indices
+        // match fds meanwhile
+        for(int i = 0; i < r->clientCount; ++i) {
+            if(fds[i + 2].revents & (POLLIN | POLLHUP | POLLERR))
+                r->clients[i].gone = !serveClient(r, i);
+        }
+        // anything just logged is tried at once rather than a poll later
+        for(int i = 0; i < r->clientCount; ++i) {
+            RelayClient * client = &r->clients[i];
+            if(!client->gone && clientWaiting(r, client))
+                client->gone = !flushClient(r, client);
+        }
+        for(int i = r->clientCount - 1; i >= 0; --i) {
+            if(r->clients[i].gone)
+                dropClient(r, i);
+        }
+        if(fds[1].revents & POLLIN)
+            acceptClient(r);
+    }
+    free(fds);
+    return NULL;
+}
+
+CollabRelay * collabRelayStart(const char * path)
+{
+    struct sockaddr_un address;
+    if(!setAddress(&address, path))
+        return NULL;
+    // a socket nobody answers on is left over from a relay that crashed
+    int other = connectTo(path);
+    if(other >= 0) {
+        close(other);
+        return NULL;
+    }
+    unlink(path);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(listener < 0)
+        return NULL;
+    if(bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listener, 8) != 0) {
+        close(listener);
+        return NULL;
+    }
+
+    CollabRelay * r = calloc(1, sizeof(CollabRelay));
+    r->path = strdup(path);
+    r->listener = listener;
+    if(pipe(r->wake) != 0) {
+        close(listener);
+        unlink(path);
+        free(r->path);
+        free(r);
+        return NULL;
+    }
+    pthread_create(&r->thread, NULL, relayMain, r);
+    return r;
+}
+
+void collabRelayWait(CollabRelay * r)
+{
+    pthread_join(r->thread, NULL);
+    r->joined = true;
+}
+
+void collabRelayStop(CollabRelay * r)
+{
+    if(!r)
+        return;
+    uint8_t stop = 1;
+    if(!r->joined && write(r->wake[1], &stop, 1) == 1)
+        pthread_join(r->thread, NULL);
+    while(r->clientCount)
+        dropClient(r, r->clientCount - 1);
+    close(r->wake[0]);
+    close(r->wake[1]);
+    close(r->listener);
+    unlink(r->path);
+    free(r->clients);
+    free(r->log.data);
+    free(r->path);
+    free(r);
+}
+
+Collab * collabJoin(const char * path, const CollabCanvas * canvas, bool * refused)
+{
+    if(refused)
+        *refused = false;
+    int fd = connectTo(path);
+    if(fd < 0)
+        return NULL;
+    noSigpipe(fd);
+
+    Bytes hello = {NULL, 0, 0}, out = {NULL, 0, 0};
+    putByte(&hello, MESSAGE_HELLO);
+    putCanvas(&hello, canvas);
+    putMessage(&out, &hello);
+    bool sent = sendAll(fd, out.data, out.length);
+    free(hello.data);
+    free(out.data);
+    if(!sent) {
+        close(fd);
+        return NULL;
+    }
+
+    // the welcome is the first thing the relay sends back
+    Bytes input = {NULL, 0, 0};
+    size_t offset = 0;
+    Reader payload;
+    bool bad = false;
+    unsigned long long id = 0;
+    CollabCanvas shared;
+    while(!nextMessage(&input, &offset, &payload, &bad) && !bad) {
+        struct pollfd p = {fd, POLLIN, 0};
+        poll(&p, 1, -1);
+        if(!receive(fd, &input))
+            bad = true;
+    }
+    bool welcomed = !bad && payload.data[payload.offset++] == MESSAGE_WELCOME &&
+                    getVarint(&payload, &id) && getCanvas(&payload, &shared);
+    if(!welcomed || !sameCanvas(canvas, &shared)) {
+        if(refused)
+            *refused = welcomed;
+        free(input.data);
+        close(fd);
+        return NULL;
+    }
+    dropConsumed(&input, offset);
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    Collab * c = calloc(1, sizeof(Collab));
+    c->fd = fd;
+    c->id = id;
+    c->connected = true;
+    c->input = input;
+    return c;
+}
+
+void collabLeave(Collab * c)
+{
+    if(!c)
+        return;
+    close(c->fd);
+    for(int i = 0; i < c->pendingCount; ++i)
+        collabStrokeFree(&c->pending[i]);
+    free(c->pending);
+    collabStrokeFree(&c->incoming);
+    free(c->input.data);
+    free(c);
+}
+
+bool collabConnected(const Collab * c)
+{
+    return c->connected;
+}
+
+void collabSend(Collab * c, const CollabStroke * s)
+{
+    if(!c->connected || s->count < 2)
+        return;
+    Bytes message = {NULL, 0, 0}, out = {NULL, 0, 0};
+    putByte(&message, MESSAGE_STROKE);
+    putStroke(&message, s);
+    putMessage(&out, &message);
+    c->connected = sendAll(c->fd, out.data, out.length);
+    free(message.data);
+    free(out.data);
+
+    if(c->pendingCount == c->pendingCapacity) {
+        c->pendingCapacity = c->pendingCapacity ? 2*c->pendingCapacity : 4;
+        c->pending = realloc(c->pending, sizeof(CollabStroke)*c->pendingCapacity);
+    }
+    CollabStroke * copy = &c->pending[c->pendingCount++];
+    *copy = *s;
+    copy->capacity = s->count;
+    copy->samples = malloc(sizeof(CollabSample)*s->count);
+    memcpy(copy->samples, s->samples, sizeof(CollabSample)*s->count);
+}
+
+int collabPending(const Collab * c)
+{
+    return c->pendingCount;
+}
+
+// Strokes come back in the order they were sent, so an echo is always the
+// oldest pending one.
+static int applyStroke(Collab * c, unsigned author, CollabStrokeFunc paint, CollabRewindFunc rewind, void * ctx)
+{
+    if(author == c->id && c->pendingCount) {
+        collabStrokeFree(&c->pending[0]);
+        memmove(&c->pending[0], &c->pending[1], sizeof(CollabStroke)*--c->pendingCount);
+        return 0;
+    }
+    if(c->pendingCount)
+        rewind(c->pendingCount, ctx);
+    paint(&c->incoming, ctx);
+    for(int i = 0; i < c->pendingCount; ++i)
+        paint(&c->pending[i], ctx);
+    return 1;
+}
+
+int collabPoll(Collab * c, CollabStrokeFunc paint, CollabRewindFunc rewind, void * ctx)
+{
+    if(!c->connected)
+        return 0;
+    for(;;) {
+        size_t before = c->input.length;
+        if(!receive(c->fd, &c->input)) {
+            c->connected = false;
+            break;
+        }
+        if(c->input.length == before)
+            break;
+    }
+
+    int painted = 0;
+    size_t offset = 0;
+    Reader payload;
+    bool bad;
+    while(nextMessage(&c->input, &offset, &payload, &bad)) {
+        unsigned long long sequence, author;
+        if(payload.data[payload.offset++] != MESSAGE_STROKE)
+            continue;
+        // a gap means the stream is broken, not merely late
+        if(!getVarint(&payload, &sequence) || sequence != c->sequence + 1 ||
+           !getVarint(&payload, &author) || !getStroke(&payload, &c->incoming)) {
+            bad = true;
+            break;
+        }
+        c->sequence = sequence;
+        painted += applyStroke(c, author, paint, rewind, ctx);
+    }
+    dropConsumed(&c->input, offset);
+    if(bad)
+        c->connected = false;
+    return painted;
+}
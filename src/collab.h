@@ -0,0 +1,89 @@
+#ifndef DAPPER_COLLAB_H
+#define DAPPER_COLLAB_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "raster.h"
+
+// The socket used when no path is given.
+#define COLLAB_PATH "/tmp/dapper-collab.sock"
+
+// Positions in 1/16 canvas pixels and times in microseconds since the
+// stroke began, the precision strokes are sent with.
+struct CollabSample {
+    int32_t x, y;
+    uint32_t time;
+};
+typedef struct CollabSample CollabSample;
+
+// One finished brush stroke, the only operation painters share.
+struct CollabStroke {
+    Brush brush;
+    CollabSample * samples;
+    int count, capacity;
+    double start;
+};
+typedef struct CollabStroke CollabStroke;
+
+// What every painter's canvas has to agree on for the same strokes to
+// paint the same pixels.
+struct CollabCanvas {
+    int width, height;
+    CanvasFormat format;
+    Color fill;
+};
+typedef struct CollabCanvas CollabCanvas;
+
+typedef struct Collab Collab;
+typedef struct CollabRelay CollabRelay;
+
+typedef void (*CollabStrokeFunc)(const CollabStroke * s, void * ctx);
+typedef void (*CollabRewindFunc)(int strokes, void * ctx);
+
+// Records a local stroke event into s, starting over on
+// INPUT_STROKE_BEGIN, and returns the event rounded to the precision that
+// gets sent. Painting the returned events rather than the raw ones is what
+// lets every peer place exactly the same dabs. Set s->brush at the start.
+InputEvent collabStrokeAdd(CollabStroke * s, InputEvent e);
+
+// The i-th sample of a stroke as the event to paint it with.
+InputEvent collabStrokeEvent(const CollabStroke * s, int i);
+void collabStrokeFree(CollabStroke * s);
+
+// The relay owns the order: painters send it finished strokes over a Unix
+// domain socket, it numbers them and sends every one to every painter,
+// the sender included. It keeps the numbered log, so a painter joining
+// late is sent everything painted so far. Messages are a varint length and
+// a tag byte; a stroke is its brush and its samples as varint deltas, a
+// few bytes each, so traffic follows the strokes, never the canvas.
+// Returns NULL when path cannot be bound or another relay is already
+// listening on it.
+CollabRelay * collabRelayStart(const char * path);
+void collabRelayStop(CollabRelay * r);
+// Blocks for as long as the relay runs.
+void collabRelayWait(CollabRelay * r);
+
+// Connects to the relay at path and says hello with canvas. The relay
+// takes the first painter's canvas as the shared one and refuses anyone
+// whose canvas differs. NULL when there is no relay, or, with *refused
+// set, when it refused.
+Collab * collabJoin(const char * path, const CollabCanvas * canvas, bool * refused);
+void collabLeave(Collab * c);
+bool collabConnected(const Collab * c);
+
+// Sends a finished local stroke, which the caller has already painted. It
+// stays pending until the relay sends it back numbered.
+void collabSend(Collab * c, const CollabStroke * s);
+
+// Local strokes sent but not yet back from the relay: the most collabPoll
+// may rewind.
+int collabPending(const Collab * c);
+
+// Applies whatever the relay has sent, without blocking, and returns how
+// many strokes came from other painters. Everyone paints in the relay's
+// order: a remote stroke numbered ahead of pending local ones is painted
+// by undoing the pending strokes with rewind, painting it with paint and
+// painting the pending ones again. Call between local strokes only.
+int collabPoll(Collab * c, CollabStrokeFunc paint, CollabRewindFunc rewind, void * ctx);
+
+#endif
@@ -0,0 +1,21 @@
+#include <stdlib.h>
+#include "document.h"
+
+Document * documentCreate(int width, int height, Color fill, CanvasFormat format, int historyLimit)
+{
+    Document * doc = malloc(sizeof(Document));
+    doc->canvas = canvasCreate(width, height, fill, format);
+    doc->selection = selectionCreate(width, height);
+    doc->history = historyCreate(doc->canvas, historyLimit);
+    return doc;
+}
+
+void documentDestroy(Document * doc)
+{
+    if(!doc)
+        return;
+    historyDestroy(doc->history);
+    selectionDestroy(doc->selection);
+    canvasDestroy(doc->canvas);
+    free(doc);
+}
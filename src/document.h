@@ -0,0 +1,20 @@
+#ifndef DAPPER_DOCUMENT_H
+#define DAPPER_DOCUMENT_H
+
+#include "canvas.h"
+#include "history.h"
+#include "selection.h"
+
+// Everything a brush needs to paint: the pixels, the mask restricting where
+// it may write and the undo history recording what it overwrote.
+struct Document {
+    Canvas * canvas;
+    Selection * selection;
+    History * history;
+};
+typedef struct Document Document;
+
+Document * documentCreate(int width, int height, Color fill, CanvasFormat format, int historyLimit);
+void documentDestroy(Document * doc);
+
+#endif
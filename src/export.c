@@ -0,0 +1,157 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdatomic.h>
+#include "export.h"
+#include "half.h"
+#include "memory.h"
+#include "png.h"
+
+struct ExportRow {
+    struct Export * owner;
+    int ty;
+};
+typedef struct ExportRow ExportRow;
+
+struct Export {
+    Pool * pool;
+    PoolGroup * group;
+    const Canvas * canvas;
+    CanvasSnapshot * snapshot;
+    ExportRow * rows;
+    char * path;
+    uint8_t * rgb;
+    atomic_int remaining;
+    atomic_bool finished;
+    atomic_bool succeeded;
+};
+
+static void writeJob(void * arg)
+{
+    Export * e = arg;
+    atomic_store(&e->succeeded, pngWrite(e->path, e->canvas->width, e->canvas->height, e->rgb, e->canvas->width*3));
+    atomic_store(&e->finished, true);
+}
+
+// The last row packed lets go of the snapshot and hands the image to the
+// writer.
+static void packRow(void * arg)
+{
+    ExportRow * row = arg;
+    Export * e = row->owner;
+    const Canvas * c = e->canvas;
+    void * stored = malloc(c->storedBytes);
+    for(int tx = 0; tx < c->tilesX; ++tx) {
+        canvasSnapshotRead(e->snapshot, tx, row->ty, stored);
+        exportPackStored(c, tx, row->ty, stored, &e->rgb[((size_t)row->ty*TILE_SIZE*c->width + tx*TILE_SIZE)*3], c->width*3);
+    }
+    free(stored);
+
+    if(atomic_fetch_sub(&e->remaining, 1) == 1) {
+        canvasSnapshotRelease(e->snapshot);
+        e->snapshot = NULL;
+        poolSubmitGroup(e->pool, e->group, writeJob, e);
+    }
+}
+
+Export * exportStart(Pool * pool, Canvas * canvas, const char * path)
+{
+    Export * e = calloc(1, sizeof(Export));
+    e->pool = pool;
+    e->group = poolGroupCreate();
+    e->canvas = canvas;
+    e->path = malloc(strlen(path) + 1);
+    strcpy(e->path, path);
+    e->rgb = malloc((size_t)canvas->width*canvas->height*3);
+    memoryCharge(SUBSYSTEM_EXPORT, (long long)canvas->width*canvas->height*3, 0, 0);
+    atomic_init(&e->remaining, canvas->tilesY);
+    atomic_init(&e->finished, false);
+    atomic_init(&e->succeeded, false);
+
+    e->snapshot = canvasSnapshot(canvas);
+    e->rows = malloc(sizeof(ExportRow)*canvas->tilesY);
+    for(int ty = 0; ty < canvas->tilesY; ++ty) {
+        e->rows[ty] = (ExportRow){e, ty};
+        poolSubmitGroup(pool, e->group, packRow, &e->rows[ty]);
+    }
+    return e;
+}
+
+float exportProgress(const Export * e)
+{
+    return 1 - (float)atomic_load(&e->remaining)/e->canvas->tilesY;
+}
+
+bool exportFinished(const Export * e)
+{
+    return atomic_load(&e->finished);
+}
+
+bool exportSucceeded(const Export * e)
+{
+    return atomic_load(&e->succeeded);
+}
+
+void exportDestroy(Export * e)
+{
+    if(!e)
+        return;
+    poolGroupWait(e->group);
+    poolGroupDestroy(e->group);
+    memoryCharge(SUBSYSTEM_EXPORT, -(long long)e->canvas->width*e->canvas->height*3, 0, 0);
+    free(e->rows);
+    free(e->rgb);
+    free(e->path);
+    free(e);
+}
+
+static uint8_t toByte(float v)
+{
+    return v <= 0 ? 0 : (v >= 1 ? 255 : (uint8_t)lroundf(v*255));
+}
+
+// sRGB8 tiles are already the bytes the texture holds; float and half ones
+// are quantised the way the upload to an RGBA8 texture does.
+void exportPackStored(const Canvas * c, int tx, int ty, const void * stored, uint8_t * rgb, size_t stride)
+{
+    int w = canvasTileWidth(c, tx);
+    int h = canvasTileHeight(c, ty);
+    float row[TILE_STRIDE];
+    for(int y = 0; y < h; ++y) {
+        uint8_t * dst = &rgb[y*stride];
+        const float * src = row;
+        if(c->format == CANVAS_SRGB8) {
+            memcpy(dst, &((const uint8_t *)stored)[y*TILE_STRIDE], w*3);
+            continue;
+        } else if(c->format == CANVAS_HALF) {
+            halfToFloat(row, &((const uint16_t *)stored)[y*TILE_STRIDE], w*3);
+        } else {
+            src = &((const float *)stored)[y*TILE_STRIDE];
+        }
+        for(int x = 0; x < w*3; ++x)
+            dst[x] = toByte(src[x]);
+    }
+}
+
+void exportPackTile(Canvas * c, int tx, int ty, uint8_t * rgb, size_t stride)
+{
+    const void * stored = canvasLockStored(c, tx, ty);
+    exportPackStored(c, tx, ty, stored, rgb, stride);
+    canvasUnlockTile(c, tx, ty, stored);
+}
+
+bool exportWrite(Canvas * canvas, const char * path)
+{
+    long long bytes = (long long)canvas->width*canvas->height*3;
+    uint8_t * rgb = malloc(bytes);
+    if(!rgb)
+        return false;
+    memoryCharge(SUBSYSTEM_EXPORT, bytes, 0, 0);
+    for(int ty = 0; ty < canvas->tilesY; ++ty)
+        for(int tx = 0; tx < canvas->tilesX; ++tx)
+            exportPackTile(canvas, tx, ty, &rgb[((size_t)ty*TILE_SIZE*canvas->width + tx*TILE_SIZE)*3], canvas->width*3);
+    bool written = pngWrite(path, canvas->width, canvas->height, rgb, canvas->width*3);
+    memoryCharge(SUBSYSTEM_EXPORT, -bytes, 0, 0);
+    free(rgb);
+    return written;
+}
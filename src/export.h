@@ -0,0 +1,32 @@
+#ifndef DAPPER_EXPORT_H
+#define DAPPER_EXPORT_H
+
+#include <stdbool.h>
+#include "canvas.h"
+#include "pool.h"
+
+typedef struct Export Export;
+
+// Saves the canvas as a PNG. It is frozen in a snapshot, whose rows of
+// tiles are packed into an 8-bit image by pool jobs; encoding and writing
+// then run as one more, so painting goes on throughout. Take it while no
+// writer holds a tile, as for canvasSnapshot.
+Export * exportStart(Pool * pool, Canvas * canvas, const char * path);
+
+float exportProgress(const Export * e);
+bool exportFinished(const Export * e);
+bool exportSucceeded(const Export * e);
+
+// Waits for an in-flight write before freeing.
+void exportDestroy(Export * e);
+
+// Saves the canvas as a PNG straight from its tiles on the calling thread,
+// for callers that can wait. The bytes match what exportStart writes.
+bool exportWrite(Canvas * canvas, const char * path);
+
+// One tile as the 8-bit RGB those exports contain, rows stride bytes apart,
+// from the canvas or from stored data read out of a snapshot.
+void exportPackTile(Canvas * canvas, int tx, int ty, uint8_t * rgb, size_t stride);
+void exportPackStored(const Canvas * canvas, int tx, int ty, const void * stored, uint8_t * rgb, size_t stride);
+
+#endif
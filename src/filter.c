@@ -0,0 +1,346 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "filter.h"
+#include "memory.h"
+
+// Above this sigma the kernel gets long enough that three running box sums
+// are cheaper than the direct convolution.
+#define MAX_KERNEL_SIGMA 8.0f
+#define BOX_PASSES 3
+
+typedef float v4sf __attribute__((vector_size(16)));
+
+struct FilterJob {
+    Filter * filter;
+    int tx, ty;
+};
+typedef struct FilterJob FilterJob;
+
+struct Filter {
+    Canvas * canvas;
+    const Selection * selection;
+    float sigma;
+
+    float * kernel;
+    int kernelRadius;
+    int boxRadius[BOX_PASSES];
+    int halo;
+
+    float ** results;
+    FilterJob * jobs;
+    int total;
+    PoolGroup * group;
+};
+
+// dst[i] += a*src[i], four lanes at a time; this is where blur time goes.
+static void axpy(float * restrict dst, const float * restrict src, float a, int n)
+{
+    v4sf va = {a, a, a, a};
+    int i = 0;
+    for(; i + 4 <= n; i += 4) {
+        v4sf d, s;
+        memcpy(&d, &dst[i], sizeof(v4sf));
+        memcpy(&s, &src[i], sizeof(v4sf));
+        d += va*s;
+        memcpy(&dst[i], &d, sizeof(v4sf));
+    }
+    for(; i < n; ++i)
+        dst[i] += a*src[i];
+}
+
+// dst[i] += src[i] - sub[i]
+static void slide(float * restrict dst, const float * restrict add, const float * restrict sub, int n)
+{
+    int i = 0;
+    for(; i + 4 <= n; i += 4) {
+        v4sf d, a, s;
+        memcpy(&d, &dst[i], sizeof(v4sf));
+        memcpy(&a, &add[i], sizeof(v4sf));
+        memcpy(&s, &sub[i], sizeof(v4sf));
+        d += a - s;
+        memcpy(&dst[i], &d, sizeof(v4sf));
+    }
+    for(; i < n; ++i)
+        dst[i] += add[i] - sub[i];
+}
+
+static void scaleRow(float * restrict dst, const float * restrict src, float a, int n)
+{
+    for(int i = 0; i < n; ++i)
+        dst[i] = a*src[i];
+}
+
+static void boxesForGauss(float sigma, int * radius)
+{
+    float ideal = sqrtf(12*sigma*sigma/BOX_PASSES + 1);
+    int wl = floorf(ideal);
+    if(wl % 2 == 0)
+        --wl;
+    int wu = wl + 2;
+    float mIdeal = (12*sigma*sigma - BOX_PASSES*wl*wl - 4*BOX_PASSES*wl - 3*BOX_PASSES)/(-4.0f*wl - 4);
+    int m = roundf(mIdeal);
+    for(int i = 0; i < BOX_PASSES; ++i)
+        radius[i] = ((i < m ? wl : wu) - 1)/2;
+}
+
+static int clamp(int v, int lo, int hi)
+{
+    return v < lo ? lo : (v > hi ? hi : v);
+}
+
+// Copies the tile plus halo, clamping reads to the canvas edge. The
+// neighbouring tiles the halo reaches into stay locked for the copy.
+static void gatherSource(Filter * f, int x0, int y0, int w, int h, float * dst)
+{
+    Canvas * c = f->canvas;
+    int R = f->halo;
+    int sw = w + 2*R;
+
+    int tx0 = clamp(x0 - R, 0, c->width-1)/TILE_SIZE;
+    int tx1 = clamp(x0 + w + R - 1, 0, c->width-1)/TILE_SIZE;
+    int ty0 = clamp(y0 - R, 0, c->height-1)/TILE_SIZE;
+    int ty1 = clamp(y0 + h + R - 1, 0, c->height-1)/TILE_SIZE;
+    int nx = tx1 - tx0 + 1;
+    int ny = ty1 - ty0 + 1;
+    float ** tiles = malloc(sizeof(float *)*nx*ny);
+    for(int ty = ty0; ty <= ty1; ++ty)
+        for(int tx = tx0; tx <= tx1; ++tx)
+            tiles[(ty - ty0)*nx + tx - tx0] = canvasLockTile(c, tx, ty, TILE_READ);
+
+    for(int y = 0; y < h + 2*R; ++y) {
+        int sy = clamp(y0 - R + y, 0, c->height-1);
+        float ** tileRow = &tiles[(sy/TILE_SIZE - ty0)*nx];
+        float * row = &dst[(size_t)y*sw*COLOR_COMPS];
+        for(int x = 0; x < sw; ++x) {
+            int sx = clamp(x0 - R + x, 0, c->width-1);
+            const float * p = tilePixel(tileRow[sx/TILE_SIZE - tx0], sx % TILE_SIZE, sy % TILE_SIZE);
+            row[x*COLOR_COMPS + 0] = p[0];
+            row[x*COLOR_COMPS + 1] = p[1];
+            row[x*COLOR_COMPS + 2] = p[2];
+        }
+    }
+
+    for(int ty = ty0; ty <= ty1; ++ty)
+        for(int tx = tx0; tx <= tx1; ++tx)
+            canvasUnlockTile(c, tx, ty, tiles[(ty - ty0)*nx + tx - tx0]);
+    free(tiles);
+}
+
+// Horizontal box pass: rows of width inW shrink to inW - 2r.
+static void boxRows(const float * src, int inW, int rows, int r, float * dst)
+{
+    int outW = inW - 2*r;
+    float inv = 1.0f/(2*r + 1);
+    for(int y = 0; y < rows; ++y) {
+        const float * in = &src[(size_t)y*inW*COLOR_COMPS];
+        float * out = &dst[(size_t)y*outW*COLOR_COMPS];
+        float sum[COLOR_COMPS] = {0};
+        for(int k = 0; k <= 2*r; ++k)
+            for(int ch = 0; ch < COLOR_COMPS; ++ch)
+                sum[ch] += in[k*COLOR_COMPS + ch];
+        for(int x = 0; x < outW; ++x) {
+            for(int ch = 0; ch < COLOR_COMPS; ++ch) {
+                out[x*COLOR_COMPS + ch] = sum[ch]*inv;
+                if(x + 1 < outW)
+                    sum[ch] += in[(x + 2*r + 1)*COLOR_COMPS + ch] - in[x*COLOR_COMPS + ch];
+            }
+        }
+    }
+}
+
+// Vertical box pass over rows of n floats: inRows shrink to inRows - 2r.
+static void boxColumns(const float * src, int n, int inRows, int r, float * dst, float * acc)
+{
+    int outRows = inRows - 2*r;
+    float inv = 1.0f/(2*r + 1);
+    memset(acc, 0, sizeof(float)*n);
+    for(int k = 0; k <= 2*r; ++k)
+        axpy(acc, &src[(size_t)k*n], 1.0f, n);
+    for(int y = 0; y < outRows; ++y) {
+        scaleRow(&dst[(size_t)y*n], acc, inv, n);
+        if(y + 1 < outRows)
+            slide(acc, &src[(size_t)(y + 2*r + 1)*n], &src[(size_t)y*n], n);
+    }
+}
+
+static void blurTile(Filter * f, int tx, int ty, float * out)
+{
+    Canvas * c = f->canvas;
+    int w = canvasTileWidth(c, tx);
+    int h = canvasTileHeight(c, ty);
+    int R = f->halo;
+    int sw = w + 2*R;
+    int sh = h + 2*R;
+
+    float * a = malloc(sizeof(float)*sw*sh*COLOR_COMPS);
+    float * b = malloc(sizeof(float)*sw*sh*COLOR_COMPS);
+    gatherSource(f, tx*TILE_SIZE, ty*TILE_SIZE, w, h, a);
+
+    if(f->kernel) {
+        int rowN = w*COLOR_COMPS;
+        memset(b, 0, sizeof(float)*rowN*sh);
+        for(int y = 0; y < sh; ++y)
+            for(int k = 0; k <= 2*R; ++k)
+                axpy(&b[(size_t)y*rowN], &a[((size_t)y*sw + k)*COLOR_COMPS], f->kernel[k], rowN);
+
+        memset(out, 0, sizeof(float)*rowN*h);
+        for(int y = 0; y < h; ++y)
+            for(int k = 0; k <= 2*R; ++k)
+                axpy(&out[(size_t)y*rowN], &b[(size_t)(y + k)*rowN], f->kernel[k], rowN);
+    } else {
+        int curW = sw;
+        for(int i = 0; i < BOX_PASSES; ++i) {
+            boxRows(a, curW, sh, f->boxRadius[i], b);
+            curW -= 2*f->boxRadius[i];
+            float * t = a; a = b; b = t;
+        }
+
+        int rowN = w*COLOR_COMPS;
+        int curH = sh;
+        float * acc = malloc(sizeof(float)*rowN);
+        for(int i = 0; i < BOX_PASSES; ++i) {
+            boxColumns(a, rowN, curH, f->boxRadius[i], b, acc);
+            curH -= 2*f->boxRadius[i];
+            float * t = a; a = b; b = t;
+        }
+        free(acc);
+        memcpy(out, a, sizeof(float)*rowN*h);
+    }
+
+    free(a);
+    free(b);
+}
+
+static void runJob(void * arg)
+{
+    FilterJob * job = arg;
+    Filter * f = job->filter;
+    Canvas * c = f->canvas;
+    size_t bytes = sizeof(float)*canvasTileWidth(c, job->tx)*canvasTileHeight(c, job->ty)*COLOR_COMPS;
+    float * out = malloc(bytes);
+    memoryCharge(SUBSYSTEM_FILTER, bytes, 0, 1);
+    blurTile(f, job->tx, job->ty, out);
+    f->results[job->ty*c->tilesX + job->tx] = out;
+}
+
+Filter * filterBlurStart(Pool * pool, Canvas * canvas, const Selection * selection, float sigma)
+{
+    Filter * f = calloc(1, sizeof(Filter));
+    f->canvas = canvas;
+    f->selection = selection;
+    f->sigma = sigma;
+    f->group = poolGroupCreate();
+
+    if(sigma <= MAX_KERNEL_SIGMA) {
+        int r = ceilf(3*sigma);
+        float sum = 0;
+        f->kernelRadius = r;
+        f->kernel = malloc(sizeof(float)*(2*r + 1));
+        for(int k = -r; k <= r; ++k)
+            sum += f->kernel[k + r] = expf(-(k*k)/(2*sigma*sigma));
+        for(int k = 0; k <= 2*r; ++k)
+            f->kernel[k] /= sum;
+        f->halo = r;
+    } else {
+        boxesForGauss(sigma, f->boxRadius);
+        for(int i = 0; i < BOX_PASSES; ++i)
+            f->halo += f->boxRadius[i];
+    }
+
+    int tileCount = canvas->tilesX*canvas->tilesY;
+    f->results = calloc(tileCount, sizeof(float *));
+    f->jobs = malloc(sizeof(FilterJob)*tileCount);
+    for(int ty = 0; ty < canvas->tilesY; ++ty) {
+        for(int tx = 0; tx < canvas->tilesX; ++tx) {
+            if(selectionTile(selection, tx, ty) == TILE_OUT)
+                continue;
+            f->jobs[f->total++] = (FilterJob){f, tx, ty};
+        }
+    }
+
+    for(int i = 0; i < f->total; ++i)
+        poolSubmitGroup(pool, f->group, runJob, &f->jobs[i]);
+
+    return f;
+}
+
+float filterProgress(const Filter * f)
+{
+    return poolGroupProgress(f->group);
+}
+
+bool filterFinished(const Filter * f)
+{
+    return poolGroupIdle(f->group);
+}
+
+void filterCancel(Filter * f)
+{
+    poolGroupCancel(f->group);
+}
+
+bool filterCancelled(const Filter * f)
+{
+    return poolGroupCancelled(f->group);
+}
+
+void filterApply(Filter * f, History * history, TileFunc onTile, void * ctx)
+{
+    if(!filterFinished(f) || filterCancelled(f))
+        return;
+
+    Canvas * c = f->canvas;
+    historyBegin(history);
+    for(int i = 0; i < f->total; ++i) {
+        int tx = f->jobs[i].tx;
+        int ty = f->jobs[i].ty;
+        int w = canvasTileWidth(c, tx);
+        int h = canvasTileHeight(c, ty);
+        const float * src = f->results[ty*c->tilesX + tx];
+        TileCoverage cov = selectionTile(f->selection, tx, ty);
+
+        historySaveTile(history, tx, ty);
+        float * tile = canvasLockTile(c, tx, ty, TILE_WRITE);
+        for(int y = 0; y < h; ++y) {
+            float * dst = &tile[y*TILE_STRIDE];
+            const float * row = &src[(size_t)y*w*COLOR_COMPS];
+            if(cov == TILE_IN) {
+                memcpy(dst, row, sizeof(float)*w*COLOR_COMPS);
+                continue;
+            }
+            const uint8_t * mask = &selectionMask(f->selection, tx, ty)[y*TILE_SIZE];
+            for(int x = 0; x < w; ++x) {
+                if(mask[x])
+                    memcpy(&dst[x*COLOR_COMPS], &row[x*COLOR_COMPS], sizeof(float)*COLOR_COMPS);
+            }
+        }
+        canvasUnlockTile(c, tx, ty, tile);
+        if(onTile)
+            onTile(tx, ty, ctx);
+    }
+    historyEnd(history);
+}
+
+void filterDestroy(Filter * f)
+{
+    if(!f)
+        return;
+
+    filterCancel(f);
+    poolGroupWait(f->group);
+    poolGroupDestroy(f->group);
+
+    Canvas * c = f->canvas;
+    for(int i = 0; i < c->tilesX*c->tilesY; ++i) {
+        if(!f->results[i])
+            continue;
+        int tx = i % c->tilesX, ty = i / c->tilesX;
+        memoryCharge(SUBSYSTEM_FILTER, -(long long)(sizeof(float)*canvasTileWidth(c, tx)*canvasTileHeight(c, ty)*COLOR_COMPS), 0, -1);
+        free(f->results[i]);
+    }
+    free(f->results);
+    free(f->jobs);
+    free(f->kernel);
+    free(f);
+}
@@ -0,0 +1,33 @@
+#ifndef DAPPER_FILTER_H
+#define DAPPER_FILTER_H
+
+#include <stdbool.h>
+#include "canvas.h"
+#include "history.h"
+#include "pool.h"
+#include "selection.h"
+
+// The blurs on offer: F and Shift+F.
+#define BLUR_SIGMA 4.0f
+#define BLUR_SIGMA_LARGE 24.0f
+
+typedef struct Filter Filter;
+
+// Starts a Gaussian blur of the selected tiles on the pool. Small sigmas use
+// a separable kernel, large ones three box passes. Every tile is computed
+// from the canvas plus a halo into a private buffer, so the canvas must not
+// be written to until the filter has been applied or destroyed.
+Filter * filterBlurStart(Pool * pool, Canvas * canvas, const Selection * selection, float sigma);
+
+float filterProgress(const Filter * f);
+bool filterFinished(const Filter * f);
+void filterCancel(Filter * f);
+bool filterCancelled(const Filter * f);
+
+// Copies the finished result into the canvas as a single undo step.
+void filterApply(Filter * f, History * history, TileFunc onTile, void * ctx);
+
+// Cancels outstanding work and waits for running jobs before freeing.
+void filterDestroy(Filter * f);
+
+#endif
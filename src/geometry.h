@@ -0,0 +1,25 @@
+#ifndef DAPPER_GEOMETRY_H
+#define DAPPER_GEOMETRY_H
+
+struct Point {
+    float x, y;
+};
+typedef struct Point Point;
+
+struct Size {
+    float width, height;
+};
+typedef struct Size Size;
+
+struct Rect {
+    Point origin;
+    Size size;
+};
+typedef struct Rect Rect;
+
+struct Color {
+    float r,g,b,a;
+};
+typedef struct Color Color;
+
+#endif
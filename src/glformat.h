@@ -0,0 +1,71 @@
+#ifndef DAPPER_GLFORMAT_H
+#define DAPPER_GLFORMAT_H
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+#include "canvas.h"
+
+// Texture format and upload type for each canvas format, for textures that
+// show the canvas. Tiles upload in the type they are stored in; a float
+// canvas is shown through 8 bits per channel.
+static inline GLint canvasTextureFormat(CanvasFormat format)
+{
+    switch(format) {
+    case CANVAS_HALF:
+        return GL_RGBA16F;
+    case CANVAS_SRGB8:
+        return GL_SRGB8_ALPHA8;
+    default:
+        return GL_RGBA8;
+    }
+}
+
+// The GPU painter's texture holds painted tiles until they are read back
+// into the canvas, so unlike the ones that only show the canvas it has to
+// keep everything the canvas can: a float canvas needs float texels.
+static inline GLint canvasPaintFormat(CanvasFormat format)
+{
+    return format == CANVAS_FLOAT ? GL_RGBA32F : canvasTextureFormat(format);
+}
+
+// Bytes each texel of a texture in one of the formats above takes, for
+// charging it to SUBSYSTEM_TEXTURES.
+static inline int canvasTexelBytes(GLint internalFormat)
+{
+    switch(internalFormat) {
+    case GL_RGBA32F:
+        return 16;
+    case GL_RGBA16F:
+        return 8;
+    default:
+        return 4;
+    }
+}
+
+static inline GLenum canvasPixelType(CanvasFormat format)
+{
+    switch(format) {
+    case CANVAS_HALF:
+        return GL_HALF_FLOAT;
+    case CANVAS_SRGB8:
+        return GL_UNSIGNED_BYTE;
+    default:
+        return GL_FLOAT;
+    }
+}
+
+// sRGB textures decode to linear when sampled; writes to them, and to the
+// window, need GL_FRAMEBUFFER_SRGB to encode again.
+static inline void canvasLinearBegin(CanvasFormat format)
+{
+    if(format == CANVAS_SRGB8)
+        glEnable(GL_FRAMEBUFFER_SRGB);
+}
+
+static inline void canvasLinearEnd(CanvasFormat format)
+{
+    if(format == CANVAS_SRGB8)
+        glDisable(GL_FRAMEBUFFER_SRGB);
+}
+
+#endif
@@ -0,0 +1,365 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "glformat.h"
+#include "gpupaint.h"
+#include "memory.h"
+#include "program.h"
+
+#define GLSL(src) "#version 150 core\n" #src
+
+static const GLchar * dabVertexSource = GLSL(
+    uniform vec2 canvasSize;
+    in vec2 corner;
+    in vec4 dab;
+    in vec4 color;
+    out vec4 Color;
+
+    void main() {
+        vec2 origin = floor(dab.xy - 0.5*dab.z + 0.5);
+        vec2 p = origin + corner*dab.z;
+        Color = color;
+        gl_Position = vec4(2.0*p/canvasSize - 1.0, 0.0, 1.0);
+    }
+);
+
+// Blends the dab over the canvas with its alpha; hard square dabs match
+// what placeRect does on the CPU.
+static const GLchar * dabFragmentSource = GLSL(
+    in vec4 Color;
+    out vec4 outColor;
+
+    void main() {
+        outColor = Color;
+    }
+);
+
+struct GpuPainter {
+    Document * doc;
+    DirtyTracker * uploadTracker;
+    GLuint texture;
+    bool enabled;
+    GLuint fbo, program, vao, cornerVbo, dabVbo;
+    GLint canvasSizeLoc;
+    int dabCapacity;
+
+    Stroke stroke;
+    bool stroking, endPending;
+    Dab * dabs;
+    int dabCount, dabAlloc;
+
+    uint8_t * stale;
+    uint8_t * loaded;
+    unsigned version;
+    unsigned * tileVersions;
+};
+
+static long long textureBytes(const Canvas * c)
+{
+    return (long long)c->width*c->height*canvasTexelBytes(canvasPaintFormat(c->format));
+}
+
+static void allocate(GLuint texture, const Canvas * c, int width, int height)
+{
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, canvasPaintFormat(c->format), width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+GpuPainter * gpuPainterCreate(GLuint canvasTex, Document * doc, DirtyTracker * uploadTracker)
+{
+    if(!GLEW_ARB_instanced_arrays) {
+        fputs("GPU painting needs ARB_instanced_arrays\n", stderr);
+        return NULL;
+    }
+
+    // a texel is enough to tell whether the format can be rendered to
+    allocate(canvasTex, doc->canvas, 1, 1);
+    GLuint fbo;
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, canvasTex, 0);
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if(status != GL_FRAMEBUFFER_COMPLETE) {
+        fputs("GPU painting: canvas texture is not renderable\n", stderr);
+        glDeleteFramebuffers(1, &fbo);
+        return NULL;
+    }
+
+    GpuPainter * g = calloc(1, sizeof(GpuPainter));
+    g->doc = doc;
+    g->uploadTracker = uploadTracker;
+    g->texture = canvasTex;
+    g->fbo = fbo;
+    g->program = programBuild(dabVertexSource, dabFragmentSource);
+    g->canvasSizeLoc = glGetUniformLocation(g->program, "canvasSize");
+    g->stale = calloc(doc->canvas->tilesX*doc->canvas->tilesY, 1);
+    g->loaded = calloc(doc->canvas->tilesX*doc->canvas->tilesY, 1);
+    g->tileVersions = calloc(doc->canvas->tilesX*doc->canvas->tilesY, sizeof(unsigned));
+
+    GLint previousVao;
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previousVao);
+    glGenVertexArrays(1, &g->vao);
+    glBindVertexArray(g->vao);
+
+    GLfloat corners[] = {0,0, 1,0, 1,1, 0,0, 1,1, 0,1};
+    glGenBuffers(1, &g->cornerVbo);
+    glBindBuffer(GL_ARRAY_BUFFER, g->cornerVbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+    GLint cornerAttrib = glGetAttribLocation(g->program, "corner");
+    glEnableVertexAttribArray(cornerAttrib);
+    glVertexAttribPointer(cornerAttrib, 2, GL_FLOAT, GL_FALSE, 0, 0);
+
+    glGenBuffers(1, &g->dabVbo);
+    glBindBuffer(GL_ARRAY_BUFFER, g->dabVbo);
+    GLint dabAttrib = glGetAttribLocation(g->program, "dab");
+    glEnableVertexAttribArray(dabAttrib);
+    glVertexAttribPointer(dabAttrib, 4, GL_FLOAT, GL_FALSE, sizeof(Dab), 0);
+    glVertexAttribDivisorARB(dabAttrib, 1);
+    GLint colorAttrib = glGetAttribLocation(g->program, "color");
+    glEnableVertexAttribArray(colorAttrib);
+    glVertexAttribPointer(colorAttrib, 4, GL_FLOAT, GL_FALSE, sizeof(Dab), (void*)(4 * sizeof(GLfloat)));
+    glVertexAttribDivisorARB(colorAttrib, 1);
+
+    glBindVertexArray(previousVao);
+    return g;
+}
+
+void gpuPainterDestroy(GpuPainter * g)
+{
+    if(!g)
+        return;
+    glDeleteBuffers(1, &g->dabVbo);
+    glDeleteBuffers(1, &g->cornerVbo);
+    glDeleteVertexArrays(1, &g->vao);
+    glDeleteProgram(g->program);
+    glDeleteFramebuffers(1, &g->fbo);
+    memoryCharge(SUBSYSTEM_TEXTURES, 0, -(long long)sizeof(Dab)*g->dabCapacity, 0);
+    if(g->enabled)
+        memoryCharge(SUBSYSTEM_TEXTURES, 0, -textureBytes(g->doc->canvas), 0);
+    free(g->dabs);
+    free(g->stale);
+    free(g->loaded);
+    free(g->tileVersions);
+    free(g);
+}
+
+static void queueDab(Point p, const Brush * brush, void * ctx)
+{
+    GpuPainter * g = ctx;
+    if(g->dabCount == g->dabAlloc) {
+        g->dabAlloc = g->dabAlloc ? 2*g->dabAlloc : 1024;
+        g->dabs = realloc(g->dabs, sizeof(Dab)*g->dabAlloc);
+    }
+    g->dabs[g->dabCount++] = (Dab){p.x, p.y, brush->size, 0, brush->color};
+}
+
+void gpuPainterBeginStroke(GpuPainter * g, const Brush * brush, Point p, double time)
+{
+    gpuPainterFlush(g);
+    historyBegin(g->doc->history);
+    g->stroking = true;
+    strokeBegin(&g->stroke, brush, p, time, queueDab, g);
+}
+
+void gpuPainterAddStroke(GpuPainter * g, Point p, double time)
+{
+    if(g->stroking)
+        strokeAdd(&g->stroke, p, time, queueDab, g);
+}
+
+void gpuPainterEndStroke(GpuPainter * g, Point p, double time)
+{
+    if(!g->stroking)
+        return;
+    strokeEnd(&g->stroke, p, time, queueDab, g);
+    g->stroking = false;
+    g->endPending = true;
+}
+
+void gpuPainterSyncTile(GpuPainter * g, int tx, int ty)
+{
+    Canvas * c = g->doc->canvas;
+    int i = ty*c->tilesX + tx;
+    if(!g->stale[i])
+        return;
+
+    Rect r = canvasTileRect(c, tx, ty);
+    GLint previousFbo;
+    glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &previousFbo);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, g->fbo);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glPixelStorei(GL_PACK_ROW_LENGTH, TILE_SIZE);
+    float * tile = canvasLockTile(c, tx, ty, TILE_WRITE);
+    canvasLinearBegin(c->format);
+    glReadPixels(r.origin.x, r.origin.y, r.size.width, r.size.height, GL_RGB, GL_FLOAT, tile);
+    canvasLinearEnd(c->format);
+    canvasUnlockTile(c, tx, ty, tile);
+    glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, previousFbo);
+
+    g->stale[i] = 0;
+    // the texture already holds these pixels; other readers still need to know
+    canvasTouchTile(c, tx, ty);
+    dirtyTrackerSkip(g->uploadTracker, c, tx, ty);
+}
+
+void gpuPainterSyncAll(GpuPainter * g)
+{
+    gpuPainterFlush(g);
+    Canvas * c = g->doc->canvas;
+    for(int ty = 0; ty < c->tilesY; ++ty)
+        for(int tx = 0; tx < c->tilesX; ++tx)
+            gpuPainterSyncTile(g, tx, ty);
+}
+
+void gpuPainterSetEnabled(GpuPainter * g, bool enabled)
+{
+    if(enabled == g->enabled)
+        return;
+    Canvas * c = g->doc->canvas;
+    if(!enabled)
+        gpuPainterSyncAll(g);
+    g->enabled = enabled;
+    memset(g->loaded, 0, c->tilesX*c->tilesY);
+    allocate(g->texture, c, enabled ? c->width : 1, enabled ? c->height : 1);
+    memoryCharge(SUBSYSTEM_TEXTURES, 0, enabled ? textureBytes(c) : -textureBytes(c), 0);
+}
+
+bool gpuPainterHolds(const GpuPainter * g, int tx, int ty)
+{
+    return g->loaded[ty*g->doc->canvas->tilesX + tx];
+}
+
+static void upload(GpuPainter * g, int tx, int ty)
+{
+    Canvas * c = g->doc->canvas;
+    Rect r = canvasTileRect(c, tx, ty);
+    const void * tile = canvasLockStored(c, tx, ty);
+    glBindTexture(GL_TEXTURE_2D, g->texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, TILE_SIZE);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, r.origin.x, r.origin.y, r.size.width, r.size.height, GL_RGB, canvasPixelType(c->format), tile);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    canvasUnlockTile(c, tx, ty, tile);
+    dirtyTrackerSkip(g->uploadTracker, c, tx, ty);
+}
+
+void gpuPainterUploadTile(int tx, int ty, void * ctx)
+{
+    GpuPainter * g = ctx;
+    if(gpuPainterHolds(g, tx, ty))
+        upload(g, tx, ty);
+}
+
+// Brings the tile into the texture, or up to date there if the CPU has
+// changed it since. Stale tiles are newer in the texture already.
+static void loadTile(GpuPainter * g, int tx, int ty)
+{
+    Canvas * c = g->doc->canvas;
+    int i = ty*c->tilesX + tx;
+    if(g->stale[i])
+        return;
+    if(g->loaded[i] && atomic_load(&c->tileVersions[i]) == g->uploadTracker->seen[i])
+        return;
+    upload(g, tx, ty);
+    g->loaded[i] = 1;
+}
+
+// Before the first dab of a stroke lands on a tile, its CPU copy has to be
+// current so the history step records the right pixels. Every tile a dab
+// covers gets a new GPU version.
+static void prepareTiles(GpuPainter * g)
+{
+    Canvas * c = g->doc->canvas;
+    History * h = g->doc->history;
+    for(int i = 0; i < g->dabCount; ++i) {
+        Dab d = g->dabs[i];
+        int x0 = fmax(0, floorf(d.x - 0.5f*d.size + 0.5f));
+        int y0 = fmax(0, floorf(d.y - 0.5f*d.size + 0.5f));
+        int x1 = fmin(c->width, x0 + d.size);
+        int y1 = fmin(c->height, y0 + d.size);
+        if(x0 >= x1 || y0 >= y1)
+            continue;
+        for(int ty = y0/TILE_SIZE; ty <= (y1-1)/TILE_SIZE; ++ty) {
+            for(int tx = x0/TILE_SIZE; tx <= (x1-1)/TILE_SIZE; ++tx) {
+                loadTile(g, tx, ty);
+                g->tileVersions[ty*c->tilesX + tx] = ++g->version;
+                if(historyHasTile(h, tx, ty))
+                    continue;
+                gpuPainterSyncTile(g, tx, ty);
+                historySaveTile(h, tx, ty);
+                g->stale[ty*c->tilesX + tx] = 1;
+            }
+        }
+    }
+}
+
+void gpuPainterFlush(GpuPainter * g)
+{
+    if(g->dabCount) {
+        Canvas * c = g->doc->canvas;
+        prepareTiles(g);
+
+        GLint previousProgram, previousVao, previousFbo, viewport[4];
+        glGetIntegerv(GL_CURRENT_PROGRAM, &previousProgram);
+        glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previousVao);
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previousFbo);
+        glGetIntegerv(GL_VIEWPORT, viewport);
+
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, g->fbo);
+        glViewport(0, 0, c->width, c->height);
+        glUseProgram(g->program);
+        glUniform2f(g->canvasSizeLoc, c->width, c->height);
+        glBindVertexArray(g->vao);
+
+        glBindBuffer(GL_ARRAY_BUFFER, g->dabVbo);
+        if(g->dabCount > g->dabCapacity) {
+            memoryCharge(SUBSYSTEM_TEXTURES, 0, (long long)sizeof(Dab)*(g->dabAlloc - g->dabCapacity), 0);
+            g->dabCapacity = g->dabAlloc;
+            glBufferData(GL_ARRAY_BUFFER, sizeof(Dab)*g->dabCapacity, NULL, GL_STREAM_DRAW);
+        }
+        glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(Dab)*g->dabCount, g->dabs);
+
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        canvasLinearBegin(g->doc->canvas->format);
+        glDrawArraysInstanced(GL_TRIANGLES, 0, 6, g->dabCount);
+        canvasLinearEnd(g->doc->canvas->format);
+        glDisable(GL_BLEND);
+
+        glBindVertexArray(previousVao);
+        glUseProgram(previousProgram);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, previousFbo);
+        glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+        g->dabCount = 0;
+    }
+
+    if(g->endPending) {
+        historyEnd(g->doc->history);
+        g->endPending = false;
+    }
+}
+
+int gpuPainterCollectDirty(GpuPainter * g, DirtyTracker * t, TileFunc fn, void * ctx)
+{
+    if(t->version == g->version)
+        return 0;
+    t->version = g->version;
+
+    const Canvas * c = g->doc->canvas;
+    int count = 0;
+    for(int i = 0; i < c->tilesX*c->tilesY; ++i) {
+        if(g->tileVersions[i] == t->seen[i])
+            continue;
+        t->seen[i] = g->tileVersions[i];
+        if(!g->loaded[i])
+            continue;
+        fn(i % c->tilesX, i / c->tilesX, ctx);
+        ++count;
+    }
+    return count;
+}
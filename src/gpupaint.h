@@ -0,0 +1,58 @@
+#ifndef DAPPER_GPUPAINT_H
+#define DAPPER_GPUPAINT_H
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+#include <stdbool.h>
+#include "document.h"
+#include "stroke.h"
+
+struct Dab {
+    float x, y, size, pad;
+    Color color;
+};
+typedef struct Dab Dab;
+
+typedef struct GpuPainter GpuPainter;
+
+// Optional paint path that renders dabs as instanced quads straight into
+// the canvas texture through a framebuffer object. The CPU canvas is left
+// behind: tiles the GPU painted are marked stale and only read back when
+// something on the CPU needs them (undo, filters, saving). Everything here
+// runs on the thread owning the GL context. Returns NULL when the driver
+// lacks instanced arrays or cannot render to the texture.
+//
+// The painter owns the texture's storage, which is canvas sized only while
+// the path is enabled. A tile is uploaded into it from the CPU canvas the
+// first time a dab lands there and kept current from then on; the texture
+// holds nothing else.
+GpuPainter * gpuPainterCreate(GLuint canvasTex, Document * doc, DirtyTracker * uploadTracker);
+void gpuPainterDestroy(GpuPainter * g);
+
+// Disabling reads every stale tile back and gives the storage up.
+void gpuPainterSetEnabled(GpuPainter * g, bool enabled);
+
+// True when the texture holds the tile's current pixels.
+bool gpuPainterHolds(const GpuPainter * g, int tx, int ty);
+
+// TileFunc with the painter as context for tiles changed on the CPU:
+// uploads the ones the texture holds.
+void gpuPainterUploadTile(int tx, int ty, void * ctx);
+
+void gpuPainterBeginStroke(GpuPainter * g, const Brush * brush, Point p, double time);
+void gpuPainterAddStroke(GpuPainter * g, Point p, double time);
+void gpuPainterEndStroke(GpuPainter * g, Point p, double time);
+
+// Draws the dabs queued since the last flush. Call once per frame.
+void gpuPainterFlush(GpuPainter * g);
+
+// Brings the CPU copy of GPU-painted tiles up to date.
+void gpuPainterSyncTile(GpuPainter * g, int tx, int ty);
+void gpuPainterSyncAll(GpuPainter * g);
+
+// Like canvasCollectDirty, for tiles changed on the GPU only. Tiles the
+// texture has since given up are skipped: reading them back reported them
+// through the canvas.
+int gpuPainterCollectDirty(GpuPainter * g, DirtyTracker * t, TileFunc fn, void * ctx);
+
+#endif
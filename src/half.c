@@ -0,0 +1,126 @@
+#include <string.h>
+#include <stdbool.h>
+#include "half.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_F16C 1
+#endif
+
+static uint16_t encode(float f)
+{
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    uint32_t sign = (x >> 16) & 0x8000;
+    uint32_t mant = x & 0x7fffff;
+    int exp = (x >> 23) & 0xff;
+
+    if(exp == 0xff)
+        return sign | 0x7c00 | (mant ? 0x200 : 0);
+    int e = exp - 127 + 15;
+    if(e >= 0x1f)
+        return sign | 0x7c00;
+
+    if(e <= 0) {
+        if(e < -10)
+            return sign;
+        mant |= 0x800000;
+        int shift = 14 - e;
+        uint32_t h = mant >> shift;
+        uint32_t rem = mant & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if(rem > halfway || (rem == halfway && (h & 1)))
+            ++h;
+        return sign | h;
+    }
+
+    // a carry out of the mantissa correctly bumps the exponent, up to inf
+    uint32_t h = ((uint32_t)e << 10) | (mant >> 13);
+    uint32_t rem = mant & 0x1fff;
+    if(rem > 0x1000 || (rem == 0x1000 && (h & 1)))
+        ++h;
+    return sign | h;
+}
+
+static float decode(uint16_t h)
+{
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    int exp = (h >> 10) & 0x1f;
+    uint32_t mant = h & 0x3ff;
+    uint32_t x;
+
+    if(exp == 0 && mant == 0) {
+        x = sign;
+    } else if(exp == 0) {
+        exp = 1;
+        while(!(mant & 0x400)) {
+            mant <<= 1;
+            --exp;
+        }
+        x = sign | ((uint32_t)(exp + 112) << 23) | ((mant & 0x3ff) << 13);
+    } else if(exp == 0x1f) {
+        x = sign | 0x7f800000 | (mant << 13);
+    } else {
+        x = sign | ((uint32_t)(exp + 112) << 23) | (mant << 13);
+    }
+
+    float f;
+    memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+#ifdef HAVE_F16C
+__attribute__((target("avx,f16c")))
+static void fromFloatF16c(uint16_t * dst, const float * src, size_t n)
+{
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8) {
+        __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(&src[i]), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128((__m128i *)&dst[i], h);
+    }
+    for(; i < n; ++i)
+        dst[i] = encode(src[i]);
+}
+
+__attribute__((target("avx,f16c")))
+static void toFloatF16c(float * dst, const uint16_t * src, size_t n)
+{
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8)
+        _mm256_storeu_ps(&dst[i], _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)&src[i])));
+    for(; i < n; ++i)
+        dst[i] = decode(src[i]);
+}
+
+static bool hasF16c()
+{
+    static int supported = -1;
+    if(supported < 0)
+        supported = __builtin_cpu_supports("avx") && __builtin_cpu_supports("f16c");
+    return supported;
+}
+#endif
+
+void halfFromFloat(uint16_t * dst, const float * src, size_t n)
+{
+#ifdef HAVE_F16C
+    if(hasF16c()) {
+        fromFloatF16c(dst, src, n);
+        return;
+    }
+#endif
+    for(size_t i = 0; i < n; ++i)
+        dst[i] = encode(src[i]);
+}
+
+void halfToFloat(float * dst, const uint16_t * src, size_t n)
+{
+#ifdef HAVE_F16C
+    if(hasF16c()) {
+        toFloatF16c(dst, src, n);
+        return;
+    }
+#endif
+    for(size_t i = 0; i < n; ++i)
+        dst[i] = decode(src[i]);
+}
@@ -0,0 +1,12 @@
+#ifndef DAPPER_HALF_H
+#define DAPPER_HALF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// IEEE 754 binary16 conversion of whole spans, using F16C when the CPU
+// has it. Rounding is to nearest even either way.
+void halfFromFloat(uint16_t * dst, const float * src, size_t n);
+void halfToFloat(float * dst, const uint16_t * src, size_t n);
+
+#endif
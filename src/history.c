@@ -0,0 +1,187 @@
+#include <stdlib.h>
+#include <string.h>
+#include "history.h"
+#include "memory.h"
+
+History * historyCreate(Canvas * canvas, int limit)
+{
+    History * h = calloc(1, sizeof(History));
+    h->canvas = canvas;
+    h->limit = h->capacity = limit;
+    h->entries = calloc(limit, sizeof(HistoryEntry));
+    h->saved = calloc(canvas->tilesX*canvas->tilesY, 1);
+    return h;
+}
+
+// Returns the bytes no longer charged to the history.
+static size_t freeEntry(HistoryEntry * e)
+{
+    size_t freed = 0;
+    for(int i = 0; i < e->count; ++i)
+        freed += blobRelease(e->tiles[i].blob, SUBSYSTEM_HISTORY);
+    free(e->tiles);
+    memset(e, 0, sizeof(HistoryEntry));
+    return freed;
+}
+
+void historyDestroy(History * h)
+{
+    if(!h)
+        return;
+    for(int i = 0; i < h->count; ++i)
+        freeEntry(&h->entries[i]);
+    freeEntry(&h->open);
+    free(h->entries);
+    free(h->saved);
+    free(h);
+}
+
+static void swapTile(Canvas * c, HistoryTile * t)
+{
+    TileBlob * previous = canvasSwapTile(c, t->tx, t->ty, t->blob, SUBSYSTEM_HISTORY);
+    t->blob = blobIntern(previous, SUBSYSTEM_HISTORY);
+}
+
+void historyBegin(History * h)
+{
+    freeEntry(&h->open);
+    memset(h->saved, 0, h->canvas->tilesX*h->canvas->tilesY);
+    h->recording = true;
+}
+
+void historySaveTileSlow(History * h, int tx, int ty)
+{
+    Canvas * c = h->canvas;
+    HistoryEntry * e = &h->open;
+    if(e->count == e->capacity) {
+        e->capacity = e->capacity ? 2*e->capacity : 16;
+        e->tiles = realloc(e->tiles, sizeof(HistoryTile)*e->capacity);
+    }
+
+    HistoryTile * t = &e->tiles[e->count++];
+    t->tx = tx;
+    t->ty = ty;
+    t->blob = blobIntern(canvasShareTile(c, tx, ty, SUBSYSTEM_HISTORY), SUBSYSTEM_HISTORY);
+    h->saved[ty*c->tilesX + tx] = 1;
+}
+
+void historySaveRect(History * h, Rect r)
+{
+    int tx0 = r.origin.x/TILE_SIZE;
+    int ty0 = r.origin.y/TILE_SIZE;
+    int tx1 = (r.origin.x + r.size.width - 1)/TILE_SIZE;
+    int ty1 = (r.origin.y + r.size.height - 1)/TILE_SIZE;
+    for(int ty = ty0; ty <= ty1 && ty < h->canvas->tilesY; ++ty)
+        for(int tx = tx0; tx <= tx1 && tx < h->canvas->tilesX; ++tx)
+            historySaveTile(h, tx, ty);
+}
+
+static void push(History * h, HistoryEntry e)
+{
+    // a new step discards anything that could have been redone
+    for(int i = h->position; i < h->count; ++i)
+        freeEntry(&h->entries[i]);
+    h->count = h->position;
+
+    // pinned steps stay even past the limit, which is caught up with once
+    // they are unpinned
+    while(h->count >= h->limit && h->count > atomic_load(&h->pinned)) {
+        freeEntry(&h->entries[0]);
+        memmove(&h->entries[0], &h->entries[1], sizeof(HistoryEntry)*(h->count-1));
+        --h->count;
+    }
+    if(h->count == h->capacity) {
+        h->capacity *= 2;
+        h->entries = realloc(h->entries, sizeof(HistoryEntry)*h->capacity);
+    }
+
+    h->entries[h->count++] = e;
+    h->position = h->count;
+}
+
+void historyEnd(History * h)
+{
+    h->recording = false;
+    if(h->open.count == 0 && !h->everyStep)
+        return;
+    push(h, h->open);
+    memset(&h->open, 0, sizeof(HistoryEntry));
+}
+
+void historyPin(History * h, int steps)
+{
+    atomic_store(&h->pinned, steps);
+}
+
+void historyPushExternal(History * h)
+{
+    push(h, (HistoryEntry){.external = true});
+}
+
+bool historyNextExternal(const History * h, bool redo)
+{
+    if(h->recording)
+        return false;
+    if(redo)
+        return h->position < h->count && h->entries[h->position].external;
+    return h->position > 0 && h->entries[h->position - 1].external;
+}
+
+void historyDropExternal(History * h)
+{
+    int kept = 0, position = 0;
+    for(int i = 0; i < h->count; ++i) {
+        if(h->entries[i].external)
+            continue;
+        if(i < h->position)
+            ++position;
+        h->entries[kept++] = h->entries[i];
+    }
+    memset(&h->entries[kept], 0, sizeof(HistoryEntry)*(h->count - kept));
+    h->count = kept;
+    h->position = position;
+}
+
+static void swapEntry(History * h, HistoryEntry * e, TileFunc onTile, void * ctx)
+{
+    for(int i = 0; i < e->count; ++i) {
+        swapTile(h->canvas, &e->tiles[i]);
+        if(onTile)
+            onTile(e->tiles[i].tx, e->tiles[i].ty, ctx);
+    }
+}
+
+bool historyUndo(History * h, TileFunc onTile, void * ctx)
+{
+    if(h->recording || h->position == 0)
+        return false;
+    swapEntry(h, &h->entries[--h->position], onTile, ctx);
+    return true;
+}
+
+bool historyRedo(History * h, TileFunc onTile, void * ctx)
+{
+    if(h->recording || h->position == h->count)
+        return false;
+    swapEntry(h, &h->entries[h->position++], onTile, ctx);
+    return true;
+}
+
+size_t historyTrim(History * h, size_t bytes)
+{
+    size_t freed = 0;
+    while(freed < bytes && h->count > 0) {
+        if(h->position > atomic_load(&h->pinned)) {
+            freed += freeEntry(&h->entries[0]);
+            memmove(&h->entries[0], &h->entries[1], sizeof(HistoryEntry)*(h->count-1));
+            memset(&h->entries[h->count-1], 0, sizeof(HistoryEntry));
+            --h->position;
+        } else if(h->count > h->position) {
+            freed += freeEntry(&h->entries[h->count-1]);
+        } else {
+            break;
+        }
+        --h->count;
+    }
+    return freed;
+}
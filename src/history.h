@@ -0,0 +1,92 @@
+#ifndef DAPPER_HISTORY_H
+#define DAPPER_HISTORY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "canvas.h"
+
+struct HistoryTile {
+    int tx, ty;
+    TileBlob * blob;
+};
+typedef struct HistoryTile HistoryTile;
+
+// One undo step: the previous contents of every tile the operation touched,
+// or nothing for an external step, whose undo is kept outside the canvas.
+struct HistoryEntry {
+    HistoryTile * tiles;
+    int count, capacity;
+    bool external;
+};
+typedef struct HistoryEntry HistoryEntry;
+
+// Tile based undo. An operation is bracketed by historyBegin/historyEnd and
+// calls historySaveTile before it first writes to a tile; undo and redo swap
+// the saved tiles with the canvas. Saved tiles are the canvas's own stored
+// data, shared and interned, so a tile saved over and over (or left at the
+// fill colour) costs one copy, and undo and redo move no pixels.
+struct History {
+    Canvas * canvas;
+    HistoryEntry * entries;
+    int count, position, limit, capacity;
+    // the newest steps that must stay undoable, see historyPin
+    atomic_int pinned;
+    // record operations that changed nothing as steps too
+    bool everyStep;
+    HistoryEntry open;
+    bool recording;
+    uint8_t * saved;
+};
+typedef struct History History;
+
+History * historyCreate(Canvas * canvas, int limit);
+void historyDestroy(History * h);
+
+void historyBegin(History * h);
+void historySaveRect(History * h, Rect r);
+void historyEnd(History * h);
+
+// Adds an external step, such as a stroke on the vector layer, so it is
+// undone in turn with the canvas steps around it. Undoing or redoing one
+// moves no tiles; check historyNextExternal first and undo it yourself.
+void historyPushExternal(History * h);
+
+// True when the step the next undo (or redo) would take is external.
+bool historyNextExternal(const History * h, bool redo);
+
+// Forgets every external step, for when their owner has given them up.
+void historyDropExternal(History * h);
+
+bool historyUndo(History * h, TileFunc onTile, void * ctx);
+bool historyRedo(History * h, TileFunc onTile, void * ctx);
+
+// Keeps the newest steps (up to the undo position) undoable: trimming
+// stops short of them and the limit no longer pushes them out. Someone
+// who will undo them one by one, like a rewind of strokes not yet shared,
+// pins them until then and sets everyStep, so each operation is exactly
+// one step. 0 unpins. Pinning may run while the raster thread records, so
+// pin a step before it exists rather than after.
+void historyPin(History * h, int steps);
+
+// Drops the oldest undo steps (or, with nothing left to undo, the furthest
+// redo steps) until at least bytes have been freed; the open and pinned
+// steps are kept.
+// Must not run concurrently with a writer. Returns the bytes freed.
+size_t historyTrim(History * h, size_t bytes);
+
+void historySaveTileSlow(History * h, int tx, int ty);
+
+// True when the open step already holds the tile's previous contents, or
+// when nothing is being recorded.
+static inline bool historyHasTile(const History * h, int tx, int ty)
+{
+    return !h->recording || h->saved[ty*h->canvas->tilesX + tx];
+}
+
+static inline void historySaveTile(History * h, int tx, int ty)
+{
+    if(h->recording && !h->saved[ty*h->canvas->tilesX + tx])
+        historySaveTileSlow(h, tx, ty);
+}
+
+#endif
@@ -0,0 +1,289 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "hud.h"
+#include "memory.h"
+
+#define HUD_WIDTH 200
+#define HUD_HEIGHT 240
+#define HUD_SCALE 2
+#define HUD_MARGIN 8
+#define HUD_REFRESH 0.25
+#define ROW_HEIGHT 8
+#define BAR_X 50
+#define BAR_WIDTH (HUD_WIDTH - BAR_X - 4)
+#define BAR_FULL_SCALE (1.0/30.0)
+#define HISTOGRAM_HEIGHT 52
+#define MEMORY_BAR_X 76
+#define QUERY_FRAMES 4
+#define GPU_STAGES 2
+
+// 3x5 pixel glyphs, rows top to bottom
+static const char * glyphs[128] = {
+    ['0'] = "111101101101111", ['1'] = "010110010010111", ['2'] = "111001111100111",
+    ['3'] = "111001111001111", ['4'] = "101101111001001", ['5'] = "111100111001111",
+    ['6'] = "111100111101111", ['7'] = "111001001001001", ['8'] = "111101111101111",
+    ['9'] = "111101111001111", ['A'] = "010101111101101", ['B'] = "110101110101110",
+    ['C'] = "011100100100011", ['D'] = "110101101101110", ['E'] = "111100110100111",
+    ['F'] = "111100110100100", ['G'] = "011100101101011", ['H'] = "101101111101101",
+    ['I'] = "111010010010111", ['J'] = "001001001101010", ['K'] = "101101110101101",
+    ['L'] = "100100100100111", ['M'] = "101111111101101", ['N'] = "110101101101101",
+    ['O'] = "010101101101010", ['P'] = "110101110100100", ['Q'] = "010101101110011",
+    ['R'] = "110101110101101", ['S'] = "011100010001110", ['T'] = "111010010010010",
+    ['U'] = "101101101101111", ['V'] = "101101101101010", ['W'] = "101101111111101",
+    ['X'] = "101101010101101", ['Y'] = "101101010010010", ['Z'] = "111001010100111",
+    ['.'] = "000000000000010", ['/'] = "001001010100100", [':'] = "000010000010000",
+    ['-'] = "000000111000000", ['%'] = "101001010100101",
+};
+
+struct Hud {
+    GLuint vao, vbo, tex;
+    GLint transformLoc;
+    bool visible;
+    double lastRefresh;
+    uint32_t pixels[HUD_WIDTH*HUD_HEIGHT];
+
+    bool timers;
+    GLuint queries[QUERY_FRAMES][GPU_STAGES];
+    bool issued[QUERY_FRAMES][GPU_STAGES];
+    bool active;
+    int frame;
+};
+
+static uint32_t rgba(unsigned r, unsigned g, unsigned b, unsigned a)
+{
+    return r | g << 8 | b << 16 | (uint32_t)a << 24;
+}
+
+static void fillRect(Hud * h, int x, int y, int w, int hgt, uint32_t color)
+{
+    for(int j = y; j < y + hgt && j < HUD_HEIGHT; ++j)
+        for(int i = x; i < x + w && i < HUD_WIDTH; ++i)
+            if(i >= 0 && j >= 0)
+                h->pixels[j*HUD_WIDTH + i] = color;
+}
+
+static void drawText(Hud * h, int x, int y, const char * text, uint32_t color)
+{
+    for(; *text; ++text, x += 4) {
+        const char * g = glyphs[*text & 127];
+        if(!g)
+            continue;
+        for(int p = 0; p < 15; ++p)
+            if(g[p] == '1')
+                fillRect(h, x + p%3, y + p/3, 1, 1, color);
+    }
+}
+
+Hud * hudCreate(GLuint program)
+{
+    Hud * h = calloc(1, sizeof(Hud));
+    h->transformLoc = glGetUniformLocation(program, "transform");
+
+    GLint previousVao;
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previousVao);
+    glGenVertexArrays(1, &h->vao);
+    glBindVertexArray(h->vao);
+
+    float x0 = HUD_MARGIN, y0 = HUD_MARGIN;
+    float x1 = x0 + HUD_SCALE*HUD_WIDTH, y1 = y0 + HUD_SCALE*HUD_HEIGHT;
+    GLfloat vertices[] = {
+        //  Position   Color             Texcoords
+        x0, y0, 1.0f, 1.0f, 1.0f, 0.0f, 0.0f,
+        x1, y0, 1.0f, 1.0f, 1.0f, 1.0f, 0.0f,
+        x1, y1, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f,
+        x0, y1, 1.0f, 1.0f, 1.0f, 0.0f, 1.0f
+    };
+    glGenBuffers(1, &h->vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, h->vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+
+    GLint posAttrib = glGetAttribLocation(program, "position");
+    glEnableVertexAttribArray(posAttrib);
+    glVertexAttribPointer(posAttrib, 2, GL_FLOAT, GL_FALSE, 7 * sizeof(GLfloat), 0);
+    GLint colAttrib = glGetAttribLocation(program, "color");
+    glEnableVertexAttribArray(colAttrib);
+    glVertexAttribPointer(colAttrib, 3, GL_FLOAT, GL_FALSE, 7 * sizeof(GLfloat), (void*)(2 * sizeof(GLfloat)));
+    GLint texAttrib = glGetAttribLocation(program, "texcoord");
+    glEnableVertexAttribArray(texAttrib);
+    glVertexAttribPointer(texAttrib, 2, GL_FLOAT, GL_FALSE, 7 * sizeof(GLfloat), (void*)(5 * sizeof(GLfloat)));
+    glBindVertexArray(previousVao);
+
+    glGenTextures(1, &h->tex);
+    glBindTexture(GL_TEXTURE_2D, h->tex);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, HUD_WIDTH, HUD_HEIGHT, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    memoryCharge(SUBSYSTEM_TEXTURES, 0, sizeof(h->pixels), 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    h->timers = GLEW_ARB_timer_query;
+    if(h->timers)
+        glGenQueries(QUERY_FRAMES*GPU_STAGES, &h->queries[0][0]);
+    return h;
+}
+
+void hudDestroy(Hud * h)
+{
+    if(!h)
+        return;
+    if(h->timers)
+        glDeleteQueries(QUERY_FRAMES*GPU_STAGES, &h->queries[0][0]);
+    glDeleteTextures(1, &h->tex);
+    memoryCharge(SUBSYSTEM_TEXTURES, 0, -(long long)sizeof(h->pixels), 0);
+    glDeleteBuffers(1, &h->vbo);
+    glDeleteVertexArrays(1, &h->vao);
+    free(h);
+}
+
+void hudToggle(Hud * h)
+{
+    h->visible = !h->visible;
+    h->lastRefresh = 0;
+}
+
+static int gpuSlot(Stage stage)
+{
+    return stage == STAGE_GPU_UPLOAD ? 0 : 1;
+}
+
+void hudGpuBegin(Hud * h, Stage stage)
+{
+    int slot = gpuSlot(stage);
+    int f = h->frame % QUERY_FRAMES;
+    if(!h->timers || h->issued[f][slot])
+        return;
+    glBeginQuery(GL_TIME_ELAPSED, h->queries[f][slot]);
+    h->issued[f][slot] = true;
+    h->active = true;
+}
+
+void hudGpuEnd(Hud * h)
+{
+    if(!h->active)
+        return;
+    glEndQuery(GL_TIME_ELAPSED);
+    h->active = false;
+}
+
+// Reads the oldest frame's queries; by then they have nearly always
+// finished. Unfinished ones are dropped rather than waited for.
+void hudEndFrame(Hud * h)
+{
+    if(!h->timers)
+        return;
+
+    h->frame++;
+    int f = h->frame % QUERY_FRAMES;
+    for(int slot = 0; slot < GPU_STAGES; ++slot) {
+        if(!h->issued[f][slot])
+            continue;
+        h->issued[f][slot] = false;
+
+        GLint available = 0;
+        glGetQueryObjectiv(h->queries[f][slot], GL_QUERY_RESULT_AVAILABLE, &available);
+        if(!available)
+            continue;
+        GLuint64 ns = 0;
+        glGetQueryObjectui64v(h->queries[f][slot], GL_QUERY_RESULT, &ns);
+        statsRecord(slot == 0 ? STAGE_GPU_UPLOAD : STAGE_GPU_RENDER, ns*1e-9);
+    }
+}
+
+static void redraw(Hud * h)
+{
+    uint32_t background = rgba(0, 0, 0, 180);
+    uint32_t text = rgba(230, 230, 230, 255);
+    uint32_t bar = rgba(80, 200, 120, 255);
+    uint32_t peak = rgba(230, 80, 60, 255);
+
+    fillRect(h, 0, 0, HUD_WIDTH, HUD_HEIGHT, background);
+
+    char label[32];
+    for(int s = 0; s < STAGE_COUNT; ++s) {
+        int y = 2 + s*ROW_HEIGHT;
+        double avg = statsAverage(s);
+        double max = statsMax(s);
+        snprintf(label, sizeof(label), "%s %6.2f", statsStageName(s), 1000*avg);
+        drawText(h, 2, y, label, text);
+
+        int avgW = BAR_WIDTH*fmin(avg/BAR_FULL_SCALE, 1.0);
+        int maxX = BAR_WIDTH*fmin(max/BAR_FULL_SCALE, 1.0);
+        fillRect(h, BAR_X, y, avgW, 5, bar);
+        fillRect(h, BAR_X + maxX - 1, y, 1, 5, peak);
+    }
+
+    int buckets[STATS_BUCKETS];
+    statsHistogram(STAGE_FRAME, buckets);
+    int top = 4 + STAGE_COUNT*ROW_HEIGHT;
+    int bottom = top + HISTOGRAM_HEIGHT - 8;
+    int most = 1;
+    for(int b = 0; b < STATS_BUCKETS; ++b)
+        if(buckets[b] > most)
+            most = buckets[b];
+    drawText(h, 2, top, "FRAME MS", text);
+    for(int b = 0; b < STATS_BUCKETS; ++b) {
+        int height = (bottom - top - 8)*buckets[b]/most;
+        fillRect(h, BAR_X + b*9, bottom - height, 8, height, bar);
+    }
+    snprintf(label, sizeof(label), "%.2f", 1000*statsBucketLimit(0));
+    drawText(h, BAR_X, bottom + 2, label, text);
+    snprintf(label, sizeof(label), "%.0f", 1000*statsBucketLimit(STATS_BUCKETS-1));
+    drawText(h, BAR_X + STATS_BUCKETS*9 - 4*(int)strlen(label), bottom + 2, label, text);
+
+    // memory: CPU and GPU megabytes, with a bar against the CPU budget
+    top += HISTOGRAM_HEIGHT;
+    drawText(h, 2, top, "MEM MB   CPU    GPU", text);
+    for(int s = 0; s < SUBSYSTEM_COUNT; ++s) {
+        int y = top + ROW_HEIGHT*(s + 1);
+        snprintf(label, sizeof(label), "%.4s %6.1f %6.1f", memorySubsystemName(s),
+            memoryCpu(s)/(1024.0*1024.0), memoryGpu(s)/(1024.0*1024.0));
+        drawText(h, 2, y, label, text);
+
+        size_t budget = memoryCpuBudget(s);
+        if(budget) {
+            double used = fmin((double)memoryCpu(s)/budget, 1.0);
+            int width = HUD_WIDTH - MEMORY_BAR_X - 4;
+            fillRect(h, MEMORY_BAR_X, y, width*used, 5, used < 1.0 ? bar : peak);
+        }
+    }
+
+    snprintf(label, sizeof(label), "START MS %8.1f", 1000*statsStartup());
+    drawText(h, 2, top + ROW_HEIGHT*(SUBSYSTEM_COUNT + 1), label, text);
+    // failed spills lose or pin tiles, so they show in the peak colour
+    snprintf(label, sizeof(label), "SPILL IN %u ERR %u", statsSpillFaults(), statsSpillFailures());
+    drawText(h, 2, top + ROW_HEIGHT*(SUBSYSTEM_COUNT + 2), label, statsSpillFailures() ? peak : text);
+
+    glBindTexture(GL_TEXTURE_2D, h->tex);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, HUD_WIDTH, HUD_HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, h->pixels);
+}
+
+void hudDraw(Hud * h, double now, const GLfloat * transform)
+{
+    if(!h->visible)
+        return;
+
+    if(now - h->lastRefresh > HUD_REFRESH) {
+        h->lastRefresh = now;
+        redraw(h);
+    }
+
+    static const GLfloat identity[16] = {1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1};
+    GLint previousVao;
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previousVao);
+
+    glUniformMatrix4fv(h->transformLoc, 1, false, identity);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, h->tex);
+    glBindVertexArray(h->vao);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+    glDisable(GL_BLEND);
+
+    glBindVertexArray(previousVao);
+    glUniformMatrix4fv(h->transformLoc, 1, false, transform);
+}
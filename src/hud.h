@@ -0,0 +1,32 @@
+#ifndef DAPPER_HUD_H
+#define DAPPER_HUD_H
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+#include <stdbool.h>
+#include "stats.h"
+
+typedef struct Hud Hud;
+
+// On-screen overlay with the rolling stage timings. It is a textured quad
+// drawn with the canvas shader program; the texture is redrawn on the CPU a
+// few times a second while visible. GPU stage times come from
+// GL_TIME_ELAPSED queries that are read back a few frames late so they
+// never stall the pipeline; without ARB_timer_query they stay at zero.
+Hud * hudCreate(GLuint program);
+void hudDestroy(Hud * h);
+
+void hudToggle(Hud * h);
+
+// Brackets GL work to be timed against a GPU stage, one at a time; only the
+// first bracket of each stage in a frame is timed.
+void hudGpuBegin(Hud * h, Stage stage);
+void hudGpuEnd(Hud * h);
+
+// Collects finished GPU timings; call once per frame before statsEndFrame.
+void hudEndFrame(Hud * h);
+
+// transform is the canvas matrix, restored after the overlay is drawn.
+void hudDraw(Hud * h, double now, const GLfloat * transform);
+
+#endif
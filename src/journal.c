@@ -0,0 +1,230 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "journal.h"
+
+#define JOURNAL_MAGIC "DPJ2"
+#define HEADER_BYTES 20
+#define RECORD_HEADER_BYTES 8
+
+struct Journal {
+    Pool * pool;
+    PoolGroup * group;
+    Canvas * canvas;
+    char * path;
+    char * tmpPath;
+
+    uint8_t * marked;
+    int * tiles;
+
+    // the save in flight: its tiles as they were, and their records
+    CanvasSnapshot * snapshot;
+    int count;
+    uint8_t * records;
+    size_t recordBytes;
+    bool rewrite;
+    // set by a save that did not reach the file, which may then be missing
+    // its tiles or end partway through a record
+    bool failed;
+    long fileBytes;
+    long fullBytes;
+    atomic_bool busy;
+};
+
+static void put16(uint8_t * p, unsigned v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void put32(uint8_t * p, unsigned v)
+{
+    put16(p, v);
+    put16(&p[2], v >> 16);
+}
+
+static unsigned get16(const uint8_t * p)
+{
+    return p[0] | p[1] << 8;
+}
+
+static unsigned get32(const uint8_t * p)
+{
+    return get16(p) | get16(&p[2]) << 16;
+}
+
+static char * copyString(const char * a, const char * b)
+{
+    char * s = malloc(strlen(a) + strlen(b) + 1);
+    strcpy(s, a);
+    strcat(s, b);
+    return s;
+}
+
+Journal * journalCreate(Pool * pool, Canvas * canvas, const char * path)
+{
+    Journal * j = calloc(1, sizeof(Journal));
+    j->pool = pool;
+    j->group = poolGroupCreate();
+    j->canvas = canvas;
+    j->path = copyString(path, "");
+    j->tmpPath = copyString(path, ".tmp");
+    j->marked = calloc(canvas->tilesX*canvas->tilesY, 1);
+    j->tiles = malloc(sizeof(int)*canvas->tilesX*canvas->tilesY);
+    j->fullBytes = HEADER_BYTES + (long)canvas->tilesX*canvas->tilesY*(RECORD_HEADER_BYTES + canvas->storedBytes);
+    j->rewrite = true;
+    atomic_init(&j->busy, false);
+    return j;
+}
+
+void journalDestroy(Journal * j, bool removeFile)
+{
+    if(!j)
+        return;
+    poolGroupWait(j->group);
+    poolGroupDestroy(j->group);
+    if(removeFile)
+        remove(j->path);
+    free(j->records);
+    free(j->tiles);
+    free(j->marked);
+    free(j->tmpPath);
+    free(j->path);
+    free(j);
+}
+
+void journalMarkTile(int tx, int ty, void * ctx)
+{
+    Journal * j = ctx;
+    j->marked[ty*j->canvas->tilesX + tx] = 1;
+}
+
+void journalMarkAll(Journal * j)
+{
+    memset(j->marked, 1, j->canvas->tilesX*j->canvas->tilesY);
+}
+
+bool journalBusy(const Journal * j)
+{
+    return atomic_load(&j->busy);
+}
+
+// A record is the tile exactly as stored, so recovery loses nothing
+// whatever the canvas format.
+static void addRecord(Journal * j, int tx, int ty)
+{
+    uint8_t * r = &j->records[j->recordBytes];
+    put16(r, tx);
+    put16(&r[2], ty);
+    put16(&r[4], canvasTileWidth(j->canvas, tx));
+    put16(&r[6], canvasTileHeight(j->canvas, ty));
+    canvasSnapshotRead(j->snapshot, tx, ty, &r[RECORD_HEADER_BYTES]);
+    j->recordBytes += RECORD_HEADER_BYTES + j->canvas->storedBytes;
+}
+
+static void writeJob(void * arg)
+{
+    Journal * j = arg;
+    const Canvas * c = j->canvas;
+    j->recordBytes = 0;
+    for(int i = 0; i < j->count; ++i)
+        addRecord(j, j->tiles[i] % c->tilesX, j->tiles[i] / c->tilesX);
+    canvasSnapshotRelease(j->snapshot);
+    j->snapshot = NULL;
+
+    const char * target = j->rewrite ? j->tmpPath : j->path;
+    FILE * file = fopen(target, j->rewrite ? "wb" : "ab");
+    bool written = false;
+    if(file) {
+        if(j->rewrite) {
+            uint8_t header[HEADER_BYTES];
+            memcpy(header, JOURNAL_MAGIC, 4);
+            put32(&header[4], j->canvas->width);
+            put32(&header[8], j->canvas->height);
+            put32(&header[12], TILE_SIZE);
+            put32(&header[16], j->canvas->format);
+            fwrite(header, 1, HEADER_BYTES, file);
+            j->fileBytes = HEADER_BYTES;
+        }
+        fwrite(j->records, 1, j->recordBytes, file);
+        bool ok = !ferror(file);
+        if(fclose(file) == 0 && ok) {
+            j->fileBytes += j->recordBytes;
+            written = !j->rewrite || rename(j->tmpPath, j->path) == 0;
+        }
+    }
+    if(written)
+        j->rewrite = false;
+    j->failed = !written;
+    atomic_store(&j->busy, false);
+}
+
+bool journalSave(Journal * j)
+{
+    if(journalBusy(j))
+        return false;
+
+    // the first save starts the file; a compacting rewrite needs every tile,
+    // as does one replacing a file a failed save left behind. busy being
+    // clear means writeJob is done with failed.
+    if(j->failed || j->fileBytes > 2*j->fullBytes) {
+        j->failed = false;
+        j->rewrite = true;
+        journalMarkAll(j);
+    }
+
+    const Canvas * c = j->canvas;
+    int count = 0;
+    size_t bytes = 0;
+    for(int i = 0; i < c->tilesX*c->tilesY; ++i) {
+        if(!j->marked[i])
+            continue;
+        j->marked[i] = 0;
+        j->tiles[count++] = i;
+        bytes += RECORD_HEADER_BYTES + c->storedBytes;
+    }
+    if(count == 0)
+        return false;
+
+    atomic_store(&j->busy, true);
+    free(j->records);
+    j->records = malloc(bytes);
+    j->count = count;
+    j->snapshot = canvasSnapshot(j->canvas);
+    poolSubmitGroup(j->pool, j->group, writeJob, j);
+    return true;
+}
+
+bool journalRecover(const char * path, Canvas * canvas)
+{
+    FILE * file = fopen(path, "rb");
+    if(!file)
+        return false;
+
+    uint8_t header[HEADER_BYTES];
+    bool valid = fread(header, 1, HEADER_BYTES, file) == HEADER_BYTES
+        && memcmp(header, JOURNAL_MAGIC, 4) == 0
+        && get32(&header[4]) == (unsigned)canvas->width
+        && get32(&header[8]) == (unsigned)canvas->height
+        && get32(&header[12]) == TILE_SIZE
+        && get32(&header[16]) == (unsigned)canvas->format;
+
+    uint8_t r[RECORD_HEADER_BYTES];
+    while(valid && fread(r, 1, RECORD_HEADER_BYTES, file) == RECORD_HEADER_BYTES) {
+        int tx = get16(r), ty = get16(&r[2]), w = get16(&r[4]), h = get16(&r[6]);
+        if(tx >= canvas->tilesX || ty >= canvas->tilesY || w != canvasTileWidth(canvas, tx) || h != canvasTileHeight(canvas, ty))
+            break;
+        // a torn final record from a crash mid-append is dropped
+        TileBlob * blob = blobCreate(canvas->storedBytes, SUBSYSTEM_CANVAS);
+        if(fread(blob->data, 1, canvas->storedBytes, file) != canvas->storedBytes) {
+            blobRelease(blob, SUBSYSTEM_CANVAS);
+            break;
+        }
+        blobRelease(canvasSwapTile(canvas, tx, ty, blob, SUBSYSTEM_CANVAS), SUBSYSTEM_CANVAS);
+        canvasTouchTile(canvas, tx, ty);
+    }
+
+    fclose(file);
+    return valid;
+}
@@ -0,0 +1,36 @@
+#ifndef DAPPER_JOURNAL_H
+#define DAPPER_JOURNAL_H
+
+#include <stdbool.h>
+#include "canvas.h"
+#include "pool.h"
+
+typedef struct Journal Journal;
+
+// Autosave journal: every save appends the tiles changed since the previous
+// one, each record the tile as the canvas stores it, so replaying it over a
+// fresh canvas of the same format restores the image exactly. A save freezes the canvas in a snapshot, and
+// packing and appending happen on the pool. When the file has grown to
+// twice a full image the next save rewrites it with every tile through a
+// temporary file.
+Journal * journalCreate(Pool * pool, Canvas * canvas, const char * path);
+
+// A clean shutdown removes the file; anything left over on start up is
+// unsaved work from a crash.
+void journalDestroy(Journal * j, bool removeFile);
+
+// Queues a tile for the next save; usable as a TileFunc with the journal as
+// the context.
+void journalMarkTile(int tx, int ty, void * ctx);
+void journalMarkAll(Journal * j);
+
+// Starts a save of the marked tiles unless one is still in flight. Call
+// while no writer holds a tile, as for canvasSnapshot.
+bool journalSave(Journal * j);
+bool journalBusy(const Journal * j);
+
+// Replays a journal into the canvas. Returns false when there is none or it
+// belongs to a canvas of another size or format.
+bool journalRecover(const char * path, Canvas * canvas);
+
+#endif
@@ -0,0 +1,305 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "live.h"
+#include "memory.h"
+
+#define LIVE_MAGIC 0x314c5044u
+#define LIVE_TILE_BYTES (TILE_PIXELS*3)
+// Seconds without a heartbeat before a viewer gives up on the painter.
+#define LIVE_STALE 5.0
+
+// The shared layout: this header, one sequence number per tile, then the
+// tiles, each TILE_SIZE rows of TILE_SIZE*3 bytes. A tile's sequence is odd
+// while its pixels are being written and advances by two per publish; the
+// header's sequence advances with every tile, so an idle viewer checks one
+// number per frame. The heartbeat advances every frame the painter runs;
+// with its pid it shows a painter that died without closing the canvas.
+struct LiveHeader {
+    uint32_t magic;
+    uint32_t tileSize;
+    int32_t width, height;
+    atomic_uint sequence;
+    atomic_bool closed;
+    int32_t pid;
+    atomic_uint heartbeat;
+};
+typedef struct LiveHeader LiveHeader;
+
+struct LiveLayout {
+    int tilesX, tilesY;
+    size_t sequencesOffset, tilesOffset, bytes;
+};
+typedef struct LiveLayout LiveLayout;
+
+struct LivePublisher {
+    Readback * readback;
+    const Canvas * canvas;
+    char * name;
+    void * map;
+    LiveLayout layout;
+    LiveHeader * header;
+    atomic_uint * sequences;
+    uint8_t * tiles;
+
+    uint8_t * marked;
+    int * pending;
+    bool busy;
+};
+
+// Mapped read only; the atomics are only ever loaded.
+struct LiveView {
+    void * map;
+    LiveLayout layout;
+    LiveHeader * header;
+    atomic_uint * sequences;
+    const uint8_t * tiles;
+    unsigned sequence;
+    unsigned * seen;
+    uint8_t * tile;
+    // the heartbeat last seen, and when it was seen to change
+    unsigned heartbeat;
+    double beatTime;
+};
+
+static LiveLayout layoutFor(int width, int height)
+{
+    LiveLayout l;
+    l.tilesX = tilesFor(width);
+    l.tilesY = tilesFor(height);
+    l.sequencesOffset = 64;
+    size_t end = l.sequencesOffset + sizeof(atomic_uint)*l.tilesX*l.tilesY;
+    l.tilesOffset = (end + 63) & ~(size_t)63;
+    l.bytes = l.tilesOffset + (size_t)LIVE_TILE_BYTES*l.tilesX*l.tilesY;
+    return l;
+}
+
+LivePublisher * livePublish(Readback * rb, const Canvas * canvas, const char * name)
+{
+    LiveLayout layout = layoutFor(canvas->width, canvas->height);
+    // anything under the name is left over from a painter that crashed
+    shm_unlink(name);
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if(fd < 0)
+        return NULL;
+    void * map = MAP_FAILED;
+    if(ftruncate(fd, layout.bytes) == 0)
+        map = mmap(NULL, layout.bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) {
+        shm_unlink(name);
+        return NULL;
+    }
+
+    LivePublisher * p = calloc(1, sizeof(LivePublisher));
+    p->readback = rb;
+    p->canvas = canvas;
+    p->name = strdup(name);
+    p->map = map;
+    p->layout = layout;
+    p->header = map;
+    p->sequences = (atomic_uint *)((uint8_t *)map + layout.sequencesOffset);
+    p->tiles = (uint8_t *)map + layout.tilesOffset;
+    p->marked = malloc(layout.tilesX*layout.tilesY);
+    p->pending = malloc(sizeof(int)*layout.tilesX*layout.tilesY);
+
+    // the object starts zeroed, so only the header needs filling in
+    p->header->tileSize = TILE_SIZE;
+    p->header->width = canvas->width;
+    p->header->height = canvas->height;
+    atomic_init(&p->header->sequence, 0);
+    atomic_init(&p->header->closed, false);
+    p->header->pid = getpid();
+    atomic_init(&p->header->heartbeat, 0);
+    atomic_thread_fence(memory_order_release);
+    p->header->magic = LIVE_MAGIC;
+    memoryCharge(SUBSYSTEM_EXPORT, layout.bytes, 0, 0);
+
+    liveMarkAll(p);
+    return p;
+}
+
+void livePublisherDestroy(LivePublisher * p)
+{
+    if(!p)
+        return;
+    atomic_store(&p->header->closed, true);
+    munmap(p->map, p->layout.bytes);
+    shm_unlink(p->name);
+    memoryCharge(SUBSYSTEM_EXPORT, -(long long)p->layout.bytes, 0, 0);
+    free(p->pending);
+    free(p->marked);
+    free(p->name);
+    free(p);
+}
+
+void liveMarkTile(int tx, int ty, void * ctx)
+{
+    LivePublisher * p = ctx;
+    p->marked[ty*p->layout.tilesX + tx] = 1;
+}
+
+void liveMarkAll(LivePublisher * p)
+{
+    memset(p->marked, 1, p->layout.tilesX*p->layout.tilesY);
+}
+
+static void receiveTile(int tx, int ty, const uint8_t * rgba, int stride, void * ctx)
+{
+    LivePublisher * p = ctx;
+    int i = ty*p->layout.tilesX + tx;
+    int w = canvasTileWidth(p->canvas, tx);
+    int h = canvasTileHeight(p->canvas, ty);
+    uint8_t * dst = &p->tiles[(size_t)i*LIVE_TILE_BYTES];
+
+    unsigned sequence = atomic_load_explicit(&p->sequences[i], memory_order_relaxed);
+    atomic_store_explicit(&p->sequences[i], sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    for(int y = 0; y < h; ++y) {
+        const uint8_t * src = &rgba[y*stride];
+        uint8_t * row = &dst[y*TILE_SIZE*3];
+        for(int x = 0; x < w; ++x) {
+            row[x*3 + 0] = src[x*4 + 0];
+            row[x*3 + 1] = src[x*4 + 1];
+            row[x*3 + 2] = src[x*4 + 2];
+        }
+    }
+    atomic_store_explicit(&p->sequences[i], sequence + 2, memory_order_release);
+    atomic_fetch_add_explicit(&p->header->sequence, 1, memory_order_release);
+}
+
+static void allReceived(void * ctx)
+{
+    LivePublisher * p = ctx;
+    p->busy = false;
+}
+
+void liveUpdate(LivePublisher * p)
+{
+    atomic_fetch_add_explicit(&p->header->heartbeat, 1, memory_order_relaxed);
+    if(p->busy)
+        return;
+    int count = 0;
+    for(int i = 0; i < p->layout.tilesX*p->layout.tilesY; ++i) {
+        if(p->marked[i]) {
+            p->marked[i] = 0;
+            p->pending[count++] = i;
+        }
+    }
+    if(!count)
+        return;
+    p->busy = true;
+    readbackRequest(p->readback, p->pending, count, receiveTile, allReceived, p);
+}
+
+LiveView * liveOpen(const char * name)
+{
+    int fd = shm_open(name, O_RDONLY, 0);
+    if(fd < 0)
+        return NULL;
+    struct stat st;
+    void * map = MAP_FAILED;
+    if(fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(LiveHeader))
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+        return NULL;
+
+    // a painter still setting the object up, or one with another tile size,
+    // is not one to follow
+    LiveHeader * header = map;
+    bool valid = header->magic == LIVE_MAGIC && header->tileSize == TILE_SIZE;
+    atomic_thread_fence(memory_order_acquire);
+    LiveLayout layout = layoutFor(header->width, header->height);
+    if(!valid || layout.bytes != (size_t)st.st_size) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    LiveView * v = calloc(1, sizeof(LiveView));
+    v->map = map;
+    v->layout = layout;
+    v->header = header;
+    v->sequences = (atomic_uint *)((uint8_t *)map + layout.sequencesOffset);
+    v->tiles = (const uint8_t *)map + layout.tilesOffset;
+    v->seen = calloc(layout.tilesX*layout.tilesY, sizeof(unsigned));
+    v->tile = malloc(LIVE_TILE_BYTES);
+    v->beatTime = -1;
+    return v;
+}
+
+void liveClose(LiveView * v)
+{
+    if(!v)
+        return;
+    munmap(v->map, v->layout.bytes);
+    free(v->seen);
+    free(v->tile);
+    free(v);
+}
+
+void liveSize(const LiveView * v, int * width, int * height)
+{
+    *width = v->header->width;
+    *height = v->header->height;
+}
+
+// The painter is gone once it says so, once its process has exited, or
+// once its heartbeat has stood still for LIVE_STALE seconds, which also
+// catches one that hung or whose pid has been reused.
+bool liveAlive(LiveView * v, double now)
+{
+    if(atomic_load(&v->header->closed))
+        return false;
+    if(kill(v->header->pid, 0) != 0 && errno == ESRCH)
+        return false;
+    unsigned heartbeat = atomic_load_explicit(&v->header->heartbeat, memory_order_relaxed);
+    if(heartbeat != v->heartbeat || v->beatTime < 0) {
+        v->heartbeat = heartbeat;
+        v->beatTime = now;
+    }
+    return now - v->beatTime < LIVE_STALE;
+}
+
+int liveCollect(LiveView * v, LiveTileFunc fn, void * ctx)
+{
+    unsigned sequence = atomic_load_explicit(&v->header->sequence, memory_order_acquire);
+    if(sequence == v->sequence)
+        return 0;
+
+    int count = 0;
+    bool torn = false;
+    for(int ty = 0; ty < v->layout.tilesY; ++ty) {
+        for(int tx = 0; tx < v->layout.tilesX; ++tx) {
+            int i = ty*v->layout.tilesX + tx;
+            unsigned before = atomic_load_explicit(&v->sequences[i], memory_order_acquire);
+            if(before == v->seen[i])
+                continue;
+            int h = v->header->height - ty*TILE_SIZE;
+            h = h < TILE_SIZE ? h : TILE_SIZE;
+            if(!(before & 1)) {
+                memcpy(v->tile, &v->tiles[(size_t)i*LIVE_TILE_BYTES], (size_t)h*TILE_SIZE*3);
+                atomic_thread_fence(memory_order_acquire);
+            }
+            unsigned after = atomic_load_explicit(&v->sequences[i], memory_order_relaxed);
+            if((before & 1) || after != before) {
+                torn = true;
+                continue;
+            }
+            v->seen[i] = before;
+            fn(tx, ty, v->tile, ctx);
+            ++count;
+        }
+    }
+    // a torn tile is looked at again next time even if nothing else moves
+    if(!torn)
+        v->sequence = sequence;
+    return count;
+}
@@ -0,0 +1,55 @@
+#ifndef DAPPER_LIVE_H
+#define DAPPER_LIVE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "readback.h"
+
+// The shared memory object used when no name is given.
+#define LIVE_NAME "/dapper-live"
+
+typedef struct LivePublisher LivePublisher;
+typedef struct LiveView LiveView;
+
+// Called for each tile that changed, pixels as 8-bit RGB rows of
+// TILE_SIZE*3 bytes, valid only during the call.
+typedef void (*LiveTileFunc)(int tx, int ty, const uint8_t * rgb, void * ctx);
+
+// Publishes the displayed canvas into POSIX shared memory for viewers in
+// other processes: a header, one sequence number per tile and the tiles as
+// 8-bit RGB read back from the GPU, so GPU strokes show too. Export and
+// autosave read a canvas snapshot instead, which leaves the readback ring
+// to live publishing. Marked tiles go out through it a few per frame; each
+// is copied straight from the mapped buffer into its slot, bracketed by its
+// sequence number, so viewers never wait on the painter. Returns NULL when
+// the object cannot be created. GL thread only.
+LivePublisher * livePublish(Readback * rb, const Canvas * canvas, const char * name);
+
+// Tells viewers the canvas is gone and removes the object.
+void livePublisherDestroy(LivePublisher * p);
+
+// Queues a tile for publishing; usable as a TileFunc with the publisher as
+// the context.
+void liveMarkTile(int tx, int ty, void * ctx);
+void liveMarkAll(LivePublisher * p);
+
+// Starts reading back the marked tiles unless a batch is still in flight.
+// Call once per frame: it is also the heartbeat viewers watch.
+void liveUpdate(LivePublisher * p);
+
+// Maps a published canvas read only; NULL while there is none.
+LiveView * liveOpen(const char * name);
+void liveClose(LiveView * v);
+
+void liveSize(const LiveView * v, int * width, int * height);
+
+// False once the painter has closed the canvas, or has exited or stopped
+// without closing it; reopen to follow the next. now is in seconds on any
+// clock, the same one every call.
+bool liveAlive(LiveView * v, double now);
+
+// Calls fn for every tile published since the previous collect and returns
+// how many. A tile caught mid-write is left for the next call.
+int liveCollect(LiveView * v, LiveTileFunc fn, void * ctx);
+
+#endif
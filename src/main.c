@@ -6,6 +6,30 @@
 #include <math.h>
 #include <string.h>
 #include <stdbool.h>
+#include "batch.h"
+#include "collab.h"
+#include "document.h"
+#include "export.h"
+#include "filter.h"
+#include "geometry.h"
+#include "glformat.h"
+#include "gpupaint.h"
+#include "hud.h"
+#include "journal.h"
+#include "live.h"
+#include "memory.h"
+#include "minimap.h"
+#include "pool.h"
+#include "program.h"
+#include "raster.h"
+#include "readback.h"
+#include "record.h"
+#include "residency.h"
+#include "stats.h"
+#include "trace.h"
+#include "vector.h"
+#include "vectorview.h"
+#include "viewer.h"
 
 #define GLSL(src) "#version 150 core\n" #src
 
@@ -48,118 +72,186 @@ GLuint tex;
 #define G_COMP 1
 #define B_COMP 2
 #define A_COMP 3
-#define COLOR_COMPS 3
-#define CANVAS_DIMS (WIDTH*HEIGHT*COLOR_COMPS)
-
-struct Point {
-    float x, y;
-};
-typedef struct Point Point;
-
-struct Size {
-    float width, height;
-};
-typedef struct Size Size;
-
-struct Rect {
-    Point origin;
-    Size size;
-};
-typedef struct Rect Rect;
-
-struct Color {
-    float r,g,b,a;
-};
-typedef struct Color Color;
 
-static Rect canvasRect = {0, 0, WIDTH, HEIGHT};
+#define HISTORY_LIMIT 32
+#define HISTORY_BUDGET (512u << 20)
+#define CANVAS_BUDGET (1024u << 20)
+#define PREFETCH_TILES 4
+#define RESIDENT_SLOTS 512
+#define VECTOR_SLOTS 256
+#define BRUSH_SIZE 2.0f
+#define BRUSH_SPACING 1.0f
+#define EXPORT_PATH "dapper.png"
+#define JOURNAL_PATH "dapper.journal"
+#define STATS_PATH "dapper-stats.csv"
+#define TRACE_PATH "dapper-trace.json"
+#define RECORD_PATH "dapper.rec"
+#define THUMBNAIL_PATH "dapper-thumb.png"
+#define AUTOSAVE_INTERVAL 30.0
 
-static GLfloat * canvas = NULL;
+static Rect canvasRect = {0, 0, WIDTH, HEIGHT};
+static const Color canvasFill = {0.5f, 0.5f, 0.5f, 1.0f};
+
+static Document * doc = NULL;
+static Raster * raster = NULL;
+static GpuPainter * gpuPainter = NULL;
+static Brush brush = {BRUSH_SIZE, BRUSH_SPACING, {1.0f, 1.0f, 1.0f, 1.0f}};
+static DirtyTracker uploadTracker;
+static Pool * pool = NULL;
+static Filter * filter = NULL;
+static Readback * readback = NULL;
+static Export * exporter = NULL;
+// what exporter is saving, when that is not doc itself
+static Document * exportDoc = NULL;
+static Journal * journal = NULL;
+static Hud * hud = NULL;
+static Residency * residency = NULL;
+static Minimap * minimap = NULL;
+static VectorLayer * vectors = NULL;
+static VectorView * vectorView = NULL;
+static Recorder * recorder = NULL;
+static Player * player = NULL;
+static bool replayFast = false;
+static Point replayCursor;
+static DirtyTracker residencyTracker;
+static DirtyTracker residencyGpuTracker;
+static DirtyTracker minimapTracker;
+static DirtyTracker minimapGpuTracker;
+static DirtyTracker journalTracker;
+static LivePublisher * live = NULL;
+static DirtyTracker liveTracker;
+static DirtyTracker liveGpuTracker;
+static Collab * collab = NULL;
+static CollabRelay * relay = NULL;
+static CollabStroke sharedStroke;
+static bool recovered = false;
+static double lastAutosave = 0;
 static GLFWwindow * window;
 static GLuint projectionLoc, transformLoc;
 static float scaleAmt = 1.0f;
 static GLfloat matrix[16] = {1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1};
+static GLfloat projection[16];
 
 static bool hasDrawingToolSelected = false;
 static bool isDrawing = false;
 static bool hasMoveToolSelected = false;
 static bool isMoving = false;
+static bool isNavigating = false;
+static Tool tool = TOOL_BRUSH;
+static bool isSelecting = false;
+static bool gpuPainting = false;
+static bool strokeOnGpu = false;
+static bool vectorPainting = false;
+static bool strokeOnVector = false;
+// When the input being handled happened: the callback time, or the
+// recorded time during replay.
+static double inputTime = 0;
 
 
-static Rect makeRect(Point p1, Point p2)
+static void scale(GLfloat * matrix, float scale)
 {
-    float x1 = fmin(p1.x, p2.x);
-    float y1 = fmin(p1.y, p2.y);
-    float x2 = fmax(p1.x, p2.x);
-    float y2 = fmax(p1.y, p2.y);
-    float w = fabs(x2-x1);
-    w = fmax(w, 1);
-    float h = fabs(y2-y1);
-    h = fmax(h, 1);
-    return (Rect){x1, y1, w, h};
+    matrix[0] = scale;
+    matrix[5] = scale;
+    matrix[10] = scale;
 }
 
-static inline float nextPow2(float val)
+static void move(GLfloat * matrix, float x, float y)
 {
-    return fmax(2, powf(2, ceilf(log2f(val))));
+    matrix[12] = x;
+    matrix[13] = y;
 }
 
-static Rect makeRegion(Point p1, Point p2)
+static void identity(GLfloat * matrix)
 {
-    Rect r = makeRect(p1, p2);
-    float val = fmax(r.size.width, r.size.height);
-    r.size.height = r.size.width = nextPow2(val);
-    return r;
+    GLfloat I[16] = {1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1};
+    memcpy(matrix, I, sizeof(GLfloat)*16);
 }
 
-static Rect makeRegionBounded(Point p1, Point p2)
+// Over budget, the oldest undo steps go first. The raster thread owns the
+// history while a stroke is open, so that waits for the stroke to end.
+static size_t trimHistory(size_t excess, void * ctx)
 {
-    Rect r = makeRegion(p1, p2);
-
-    float extra_w = (r.size.width + r.origin.x) - canvasRect.size.width;
-    extra_w = fmax(extra_w, 0);
-    float extra_h = (r.size.height + r.origin.y) - canvasRect.size.height;
-    extra_h = fmax(extra_h, 0);
-
-    r.origin.x -= extra_w;
-    r.origin.y -= extra_h;
+    if(isDrawing)
+        return 0;
+    rasterSync(raster);
+    return historyTrim(doc->history, excess);
+}
 
-    return r;
+// DAPPER_CANVAS=half keeps the canvas in 16 bit floats; DAPPER_CANVAS=srgb
+// paints in linear light over sRGB encoded bytes.
+static CanvasFormat canvasFormat()
+{
+    const char * format = getenv("DAPPER_CANVAS");
+    if(format && strcmp(format, "half") == 0)
+        return CANVAS_HALF;
+    if(format && strcmp(format, "srgb") == 0)
+        return CANVAS_SRGB8;
+    return CANVAS_FLOAT;
 }
 
-static inline int canvasIndex(float x, float y)
+// DAPPER_LIVE=1 publishes the canvas for "dapper --view" under LIVE_NAME;
+// a value starting with / names the shared memory object instead.
+static const char * liveName()
 {
-    int i = (int)(COLOR_COMPS)*(int)(WIDTH*y + x);
-    //printf("(canvas index) x: %f y: %f i: %d\n", x, y, i);
-    return i;
+    const char * name = getenv("DAPPER_LIVE");
+    if(!name || !*name || strcmp(name, "0") == 0)
+        return NULL;
+    return name[0] == '/' ? name : LIVE_NAME;
 }
 
-static void scale(GLfloat * matrix, float scale)
+// DAPPER_COLLAB=1 paints together with other dappers through COLLAB_PATH;
+// a value starting with / is the socket to use instead. The first painter
+// to start hosts the relay.
+static const char * collabPath()
 {
-    matrix[0] = scale;
-    matrix[5] = scale;
-    matrix[10] = scale;
+    const char * path = getenv("DAPPER_COLLAB");
+    if(!path || !*path || strcmp(path, "0") == 0)
+        return NULL;
+    return path[0] == '/' ? path : COLLAB_PATH;
 }
 
-static void move(GLfloat * matrix, float x, float y)
+static void reportStartup(double seconds)
 {
-    matrix[12] = x;
-    matrix[13] = y;
+    int built, cached;
+    programCacheCounts(&built, &cached);
+    statsSetStartup(seconds);
+    printf("first frame after %.1f ms, %d of %d programs from cache\n", 1000*seconds, cached, built);
 }
 
-static void identity(GLfloat * matrix)
+static void setBudgets()
 {
-    GLfloat I[16] = {1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1};
-    memcpy(matrix, I, sizeof(GLfloat)*16);
+    memorySetBudget(SUBSYSTEM_HISTORY, HISTORY_BUDGET, 0);
+    memorySetBudget(SUBSYSTEM_CANVAS, CANVAS_BUDGET, 0);
+    memoryLoadBudgets();
 }
 
 static void init()
 {
-    canvas = malloc(sizeof(GLfloat)*CANVAS_DIMS);
-
-    for(int i = 0; i < CANVAS_DIMS; ++i) {
-        canvas[i] = 0.5f;
+    setBudgets();
+    memorySetReclaimer(SUBSYSTEM_HISTORY, trimHistory, NULL);
+
+    CanvasFormat format = canvasFormat();
+    brush.color = canvasColor(format, brush.color);
+    doc = documentCreate(WIDTH, HEIGHT, canvasColor(format, canvasFill), format, HISTORY_LIMIT);
+    dirtyTrackerInit(&uploadTracker, doc->canvas);
+    dirtyTrackerInit(&journalTracker, doc->canvas);
+    dirtyTrackerInit(&residencyTracker, doc->canvas);
+    dirtyTrackerInit(&residencyGpuTracker, doc->canvas);
+    dirtyTrackerInit(&minimapTracker, doc->canvas);
+    dirtyTrackerInit(&minimapGpuTracker, doc->canvas);
+    dirtyTrackerInit(&liveTracker, doc->canvas);
+    dirtyTrackerInit(&liveGpuTracker, doc->canvas);
+    // a shared canvas starts out as the fill for every painter, so unsaved
+    // work is set aside rather than painted under it
+    if(collabPath()) {
+        if(rename(JOURNAL_PATH, JOURNAL_PATH ".old") == 0)
+            printf("Set unsaved work aside as %s\n", JOURNAL_PATH ".old");
+    } else if((recovered = journalRecover(JOURNAL_PATH, doc->canvas))) {
+        printf("Recovered unsaved work from %s\n", JOURNAL_PATH);
     }
+    raster = rasterCreate(doc, brush);
+    vectors = vectorCreate(WIDTH, HEIGHT);
+    pool = poolCreate(0);
 
     //setup scale amount
     float ratioWidth = WINDOW_WIDTH > WIDTH ? (float)WIDTH/WINDOW_WIDTH : (float)WINDOW_WIDTH/WIDTH;
@@ -168,16 +260,6 @@ static void init()
     scaleAmt = 0.8*ratio;
 }
 
-static void updateCanvas(Rect r)
-{
-    int i = canvasIndex(r.origin.x, r.origin.y);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, tex);
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-    glPixelStorei(GL_UNPACK_ROW_LENGTH, canvasRect.size.width);
-    glTexSubImage2D(GL_TEXTURE_2D, 0, r.origin.x, r.origin.y, r.size.width, r.size.height, GL_RGB, GL_FLOAT, &canvas[i]);
-}
-
 static Point screenToCanvas(Point screenPoint)
 {
     double s = 1.0/scaleAmt;
@@ -186,16 +268,14 @@ static Point screenToCanvas(Point screenPoint)
     return (Point){canvasX, canvasY};
 }
 
-static Point screenToCanvasBounded(Point screenPoint)
+// Keeps the sub-pixel part so strokes can be smoothed and resampled.
+static Point screenToCanvasExact(Point screenPoint)
 {
-    Point p = screenToCanvas(screenPoint);
-
-    float canvasX = p.x < WIDTH ? p.x : WIDTH-1;
-    canvasX = canvasX > 0 ? canvasX : 0;
-    float canvasY = p.y < HEIGHT ? p.y : HEIGHT-1;
-    canvasY = canvasY > 0 ? canvasY : 0;
-
-    return (Point){canvasX, canvasY};
+    double s = 1.0/scaleAmt;
+    return (Point){
+        s*((double)screenPoint.x - (double)canvasRect.origin.x),
+        s*((double)screenPoint.y - (double)canvasRect.origin.y)
+    };
 }
 
 static bool isInCanvas(float xpos, float ypos)
@@ -204,59 +284,431 @@ static bool isInCanvas(float xpos, float ypos)
     return p.x > 0 && p.x < WIDTH && p.y > 0 && p.y < HEIGHT;
 }
 
-static void placePoint(Point p, Color c)
+// Local strokes the relay has not numbered yet may still be rewound, so
+// their undo steps must survive trimming until they come back.
+static void pinShared()
 {
-    int i = canvasIndex(p.x, p.y);
-    canvas[i+R_COMP] = c.r;
-    canvas[i+G_COMP] = c.g;
-    canvas[i+B_COMP] = c.b;
-    //canvas[i+A_COMP] = c.a;
-    //TODO: figure out how to handle Alpha
+    historyPin(doc->history, collab ? collabPending(collab) : 0);
 }
 
-static void placeRect(Rect r, Color c)
+// Painting happens on the raster thread; the callbacks only stamp and queue
+// events. Smoothing and resampling run over there, off the input path.
+static void pushStrokeEvent(InputEventType type, float xpos, float ypos)
 {
-    for(int x = r.origin.x; x < r.origin.x + r.size.width; ++x) {
-        for(int y = r.origin.y; y < r.origin.y + r.size.height; ++y) {
-            placePoint((Point){x, y}, c);
+    Point p = screenToCanvasExact((Point){xpos, ypos});
+    double time = inputTime;
+
+    if(strokeOnVector) {
+        Rect changed;
+        switch(type) {
+        case INPUT_STROKE_BEGIN:
+            changed = vectorBegin(vectors, &brush, p, time);
+            break;
+        case INPUT_STROKE_MOVE:
+            changed = vectorAdd(vectors, p, time);
+            break;
+        default:
+            changed = vectorEnd(vectors, p, time);
+            // the raster thread may still be recording an earlier stroke
+            rasterSync(raster);
+            historyPushExternal(doc->history);
+            break;
         }
+        vectorViewInvalidate(vectorView, changed);
+        return;
+    }
+
+    if(!strokeOnGpu) {
+        InputEvent e = {type, p, time};
+        if(collab) {
+            if(type == INPUT_STROKE_BEGIN)
+                sharedStroke.brush = brush;
+            e = collabStrokeAdd(&sharedStroke, e);
+        }
+        rasterPush(raster, e);
+        if(collab && type == INPUT_STROKE_END) {
+            collabSend(collab, &sharedStroke);
+            pinShared();
+        }
+        return;
+    }
+
+    switch(type) {
+    case INPUT_STROKE_BEGIN:
+        gpuPainterBeginStroke(gpuPainter, &brush, p, time);
+        break;
+    case INPUT_STROKE_MOVE:
+        gpuPainterAddStroke(gpuPainter, p, time);
+        break;
+    case INPUT_STROKE_END:
+        gpuPainterEndStroke(gpuPainter, p, time);
+        break;
     }
 }
 
-static float firstDrawX = -1.0f;
-static float firstDrawY = -1.0f;
+static void syncGpuCanvas()
+{
+    if(gpuPainter)
+        gpuPainterSyncAll(gpuPainter);
+}
 
-static void draw(float xpos, float ypos)
+// Brings the texture's copy of tiles changed on the CPU up to date.
+static void uploadTiles()
 {
-    Color color = { 1.0f, 1.0f, 1.0f, 1.0f};
+    if(gpuPainter)
+        canvasCollectDirty(doc->canvas, &uploadTracker, gpuPainterUploadTile, gpuPainter);
+}
 
-    Point oldPoint = screenToCanvasBounded((Point){firstDrawX, firstDrawY});
-    Point newPoint = screenToCanvasBounded((Point){xpos, ypos});
+// Paints the vector strokes into the canvas through the brush engine, as
+// if they had been drawn there, and empties the layer. They were drawn
+// without a selection, so a selection made since does not clip them. Their
+// undo steps give way to those of the flattened strokes, which come last.
+static void flattenVectors()
+{
+    rasterSync(raster);
+    historyDropExternal(doc->history);
+    if(!vectors->count) {
+        vectorClear(vectors);
+        return;
+    }
+    syncGpuCanvas();
+    bool selected = doc->selection->active;
+    doc->selection->active = false;
+    for(int i = 0; i < vectors->count; ++i) {
+        const VectorStroke * s = &vectors->strokes[i];
+        rasterSetBrush(raster, s->brush);
+        rasterPush(raster, (InputEvent){INPUT_STROKE_BEGIN, s->samples[0].position, s->samples[0].time});
+        for(int j = 1; j < s->count - 1; ++j)
+            rasterPush(raster, (InputEvent){INPUT_STROKE_MOVE, s->samples[j].position, s->samples[j].time});
+        rasterPush(raster, (InputEvent){INPUT_STROKE_END, s->samples[s->count - 1].position, s->samples[s->count - 1].time});
+    }
+    rasterSync(raster);
+    doc->selection->active = selected;
+    rasterSetBrush(raster, brush);
+    vectorViewInvalidate(vectorView, (Rect){{0, 0}, {WIDTH, HEIGHT}});
+    vectorClear(vectors);
+}
 
-    Rect dirtyRegion = makeRegionBounded(oldPoint, newPoint);
-    //placeRect(dirtyRegion, color);
-    placePoint(newPoint, color);
-    updateCanvas(dirtyRegion);
-    //printf("dirtyRegion: %f %f %f %f\n", dirtyRegion.origin.x, dirtyRegion.origin.y, dirtyRegion.size.width, dirtyRegion.size.height);
-    //updateCanvas((Rect){newPoint.x, newPoint.y, 10, 10});
-    //updateCanvas((Rect){0, 0, WIDTH, HEIGHT});
+// A copy of the canvas with the vector strokes painted over it the way
+// flattening would, for saving. The copy shares the canvas's tiles, so
+// only those the strokes reach cost anything, and the layer keeps its
+// strokes and their undo steps.
+static Document * paintVectorCopy()
+{
+    Document * copy = malloc(sizeof(Document));
+    copy->canvas = canvasCopy(doc->canvas);
+    copy->selection = selectionCreate(WIDTH, HEIGHT);
+    copy->history = historyCreate(copy->canvas, 1);
+    Stroke stroke;
+    memset(&stroke, 0, sizeof(stroke));
+    for(int i = 0; i < vectors->count; ++i) {
+        const VectorStroke * s = &vectors->strokes[i];
+        rasterPaint(copy, &stroke, &s->brush, (InputEvent){INPUT_STROKE_BEGIN, s->samples[0].position, s->samples[0].time});
+        for(int j = 1; j < s->count - 1; ++j)
+            rasterPaint(copy, &stroke, &s->brush, (InputEvent){INPUT_STROKE_MOVE, s->samples[j].position, s->samples[j].time});
+        rasterPaint(copy, &stroke, &s->brush, (InputEvent){INPUT_STROKE_END, s->samples[s->count - 1].position, s->samples[s->count - 1].time});
+    }
+    return copy;
+}
 
-    firstDrawX = xpos;
-    firstDrawY = ypos;
+static void startExport()
+{
+    if(exporter)
+        return;
+    rasterSync(raster);
+    syncGpuCanvas();
+    if(vectors->count)
+        exportDoc = paintVectorCopy();
+    exporter = exportStart(pool, exportDoc ? exportDoc->canvas : doc->canvas, EXPORT_PATH);
+    // the thumbnail is the minimap once it has caught up, over the next
+    // few frames, rather than a pass over the canvas now
+    minimapRequestPng(minimap, THUMBNAIL_PATH);
 }
 
-static void beginDraw(float xpos, float ypos)
+static void pollExport()
 {
-    firstDrawX = xpos;
-    firstDrawY = ypos;
+    if(!exporter)
+        return;
+
+    if(!exportFinished(exporter)) {
+        char title[64];
+        snprintf(title, sizeof(title), "Drawing App - Saving %d%%", (int)(100*exportProgress(exporter)));
+        glfwSetWindowTitle(window, title);
+        return;
+    }
 
-    if((isDrawing = isInCanvas(xpos, ypos)))
-        draw(xpos, ypos);
+    if(exportSucceeded(exporter))
+        printf("Saved %s\n", EXPORT_PATH);
+    else
+        fprintf(stderr, "Could not save %s\n", EXPORT_PATH);
+    exportDestroy(exporter);
+    exporter = NULL;
+    documentDestroy(exportDoc);
+    exportDoc = NULL;
+    glfwSetWindowTitle(window, "Drawing App");
+}
+
+static void pollThumbnail()
+{
+    bool written;
+    if(!minimapPngDone(minimap, &written))
+        return;
+    if(written)
+        printf("Saved %s\n", THUMBNAIL_PATH);
+    else
+        fprintf(stderr, "Could not save %s\n", THUMBNAIL_PATH);
+}
+
+static double lapStage(Stage stage, double since)
+{
+    double now = statsNow();
+    statsRecord(stage, now - since);
+    return now;
+}
+
+// The part of the canvas the window shows, in canvas pixels.
+static Rect viewRect()
+{
+    Point a = screenToCanvas((Point){0, 0});
+    Point b = screenToCanvas((Point){WINDOW_WIDTH, WINDOW_HEIGHT});
+    return (Rect){a, {b.x - a.x, b.y - a.y}};
+}
+
+// Keeps what is on screen, plus a tile of margin for panning, in memory.
+static void prefetchViewport()
+{
+    Rect view = viewRect();
+    view.origin.x -= TILE_SIZE;
+    view.origin.y -= TILE_SIZE;
+    view.size.width += 2*TILE_SIZE;
+    view.size.height += 2*TILE_SIZE;
+    canvasPrefetch(doc->canvas, view, PREFETCH_TILES);
+}
+
+static void streamResidentTiles()
+{
+    canvasCollectDirty(doc->canvas, &residencyTracker, residencyInvalidate, residency);
+    if(gpuPainter)
+        gpuPainterCollectDirty(gpuPainter, &residencyGpuTracker, residencyInvalidateGpu, residency);
+    residencyUpdate(residency, viewRect(), scaleAmt);
+    vectorViewUpdate(vectorView, viewRect(), scaleAmt);
+    canvasCollectDirty(doc->canvas, &minimapTracker, minimapInvalidate, minimap);
+    if(gpuPainter)
+        gpuPainterCollectDirty(gpuPainter, &minimapGpuTracker, minimapInvalidateGpu, minimap);
+    minimapUpdate(minimap);
+}
+
+// Tiles changed since the last autosave go to the journal, which saves them
+// from a snapshot on the pool. GPU strokes are read back into the canvas
+// first, and reading them back marks their tiles changed. A stroke in
+// progress puts the save off to a later frame.
+static void autosave(double now)
+{
+    if(now - lastAutosave < AUTOSAVE_INTERVAL || journalBusy(journal) || isDrawing)
+        return;
+    lastAutosave = now;
+
+    rasterSync(raster);
+    syncGpuCanvas();
+    canvasCollectDirty(doc->canvas, &journalTracker, journalMarkTile, journal);
+    journalSave(journal);
+}
+
+// Viewers get tiles changed on either side, read back from the texture, so
+// GPU strokes need no CPU sync.
+static void publishLive()
+{
+    if(!live)
+        return;
+    canvasCollectDirty(doc->canvas, &liveTracker, liveMarkTile, live);
+    if(gpuPainter)
+        gpuPainterCollectDirty(gpuPainter, &liveGpuTracker, liveMarkTile, live);
+    liveUpdate(live);
+}
+
+static void draw(float xpos, float ypos)
+{
+    pushStrokeEvent(INPUT_STROKE_MOVE, xpos, ypos);
+}
+
+static void beginDraw(float xpos, float ypos)
+{
+    if((isDrawing = isInCanvas(xpos, ypos))) {
+        // the GPU path has no per-pixel selection test, so masked strokes
+        // stay on the CPU
+        // and shared strokes are painted by the same brush engine everywhere
+        strokeOnVector = vectorPainting && !doc->selection->active && !collab;
+        strokeOnGpu = !strokeOnVector && gpuPainter && gpuPainting && !doc->selection->active && !collab;
+        if(strokeOnGpu)
+            rasterSync(raster);
+        else
+            syncGpuCanvas();
+        pushStrokeEvent(INPUT_STROKE_BEGIN, xpos, ypos);
+    }
 }
 
 static void endDraw(float xpos, float ypos)
 {
     isDrawing = false;
+    pushStrokeEvent(INPUT_STROKE_END, xpos, ypos);
+}
+
+static void touchTile(int tx, int ty, void * ctx)
+{
+    canvasTouchTile(doc->canvas, tx, ty);
+}
+
+static void paintShared(const CollabStroke * s, void * ctx)
+{
+    syncGpuCanvas();
+    rasterSetBrush(raster, s->brush);
+    for(int i = 0; i < s->count; ++i)
+        rasterPush(raster, collabStrokeEvent(s, i));
+    rasterSetBrush(raster, brush);
+}
+
+// Each shared stroke is one undo step.
+static void rewindShared(int strokes, void * ctx)
+{
+    rasterSync(raster);
+    for(int i = 0; i < strokes; ++i)
+        historyUndo(doc->history, touchTile, NULL);
+}
+
+// Remote strokes wait while a local one is open; it is sent when it ends,
+// and they are painted under it then.
+static void pollCollab()
+{
+    if(!collab || isDrawing)
+        return;
+    collabPoll(collab, paintShared, rewindShared, NULL);
+    if(!collabConnected(collab)) {
+        printf("Lost the collaboration relay; painting alone\n");
+        collabLeave(collab);
+        collab = NULL;
+        rasterSync(raster);
+        doc->history->everyStep = false;
+    }
+    pinShared();
+}
+
+// Vector strokes take their turn on the same timeline as everything else;
+// their steps hold no tiles, the layer undoes them.
+static void undo(bool redo)
+{
+    rasterSync(raster);
+    Rect changed;
+    if(!historyNextExternal(doc->history, redo))
+        syncGpuCanvas();
+    else if(redo ? vectorRedo(vectors, &changed) : vectorUndo(vectors, &changed))
+        vectorViewInvalidate(vectorView, changed);
+    if(redo)
+        historyRedo(doc->history, touchTile, NULL);
+    else
+        historyUndo(doc->history, touchTile, NULL);
+}
+
+static void startBlur(float sigma)
+{
+    if(filter)
+        return;
+    flattenVectors();
+    rasterSync(raster);
+    syncGpuCanvas();
+    filter = filterBlurStart(pool, doc->canvas, doc->selection, sigma);
+}
+
+// Called once per frame: reports progress in the title bar and applies the
+// blur in one go once every tile is done, so it lands as a single undo step.
+static void pollFilter()
+{
+    if(!filter)
+        return;
+
+    if(!filterFinished(filter)) {
+        char title[64];
+        snprintf(title, sizeof(title), "Drawing App - Blur %d%%", (int)(100*filterProgress(filter)));
+        glfwSetWindowTitle(window, title);
+        return;
+    }
+
+    filterApply(filter, doc->history, touchTile, NULL);
+    filterDestroy(filter);
+    filter = NULL;
+    glfwSetWindowTitle(window, "Drawing App");
+}
+
+static Point * lassoPoints = NULL;
+static int lassoCount = 0;
+static int lassoCapacity = 0;
+static SelectionOp selectOp = SELECTION_REPLACE;
+
+static void addLassoPoint(float xpos, float ypos)
+{
+    if(lassoCount == lassoCapacity) {
+        lassoCapacity = lassoCapacity ? 2*lassoCapacity : 256;
+        lassoPoints = realloc(lassoPoints, sizeof(Point)*lassoCapacity);
+    }
+    lassoPoints[lassoCount++] = screenToCanvasExact((Point){xpos, ypos});
+}
+
+static void beginSelect(float xpos, float ypos, int mods)
+{
+    isSelecting = true;
+    selectOp = SELECTION_REPLACE;
+    if(mods & GLFW_MOD_SHIFT)
+        selectOp = SELECTION_ADD;
+    else if(mods & GLFW_MOD_ALT)
+        selectOp = SELECTION_SUBTRACT;
+
+    lassoCount = 0;
+    addLassoPoint(xpos, ypos);
+}
+
+static void moveSelect(float xpos, float ypos)
+{
+    if(tool == TOOL_LASSO_SELECT)
+        addLassoPoint(xpos, ypos);
+}
+
+static void endSelect(float xpos, float ypos)
+{
+    isSelecting = false;
+    addLassoPoint(xpos, ypos);
+    rasterSync(raster);
+    Selection * selection = doc->selection;
+
+    if(tool == TOOL_RECT_SELECT) {
+        Point a = lassoPoints[0];
+        Point b = lassoPoints[lassoCount-1];
+        Rect r = {{fmin(a.x, b.x), fmin(a.y, b.y)}, {fabs(b.x - a.x), fabs(b.y - a.y)}};
+        selectionRect(selection, r, selectOp);
+    } else {
+        selectionLasso(selection, lassoPoints, lassoCount, selectOp);
+    }
+}
+
+static void clearSelection()
+{
+    rasterSync(raster);
+    selectionClear(doc->selection);
+}
+
+static void toggleGpuPainting()
+{
+    if(!gpuPainter)
+        return;
+    gpuPainting = !gpuPainting;
+    gpuPainterSetEnabled(gpuPainter, gpuPainting);
+    printf("GPU painting %s\n", gpuPainting ? "on" : "off");
+}
+
+static void toggleVectorPainting()
+{
+    vectorPainting = !vectorPainting;
+    if(!vectorPainting)
+        flattenVectors();
+    printf("vector strokes %s\n", vectorPainting ? "on" : "off");
 }
 
 static float firstX = -1.0f;
@@ -272,6 +724,19 @@ static void moveCanvas(float xpos, float ypos)
     glUniformMatrix4fv(transformLoc, 1, false, matrix);
 }
 
+// Centres the view on the canvas point under the cursor on the minimap;
+// only the transform changes.
+static void navigate(float xpos, float ypos)
+{
+    Point p;
+    if(!minimapHit(minimap, (Point){xpos, ypos}, &p))
+        return;
+    canvasRect.origin.x = WINDOW_WIDTH/2 - p.x*scaleAmt;
+    canvasRect.origin.y = WINDOW_HEIGHT/2 - p.y*scaleAmt;
+    move(matrix, canvasRect.origin.x, canvasRect.origin.y);
+    glUniformMatrix4fv(transformLoc, 1, false, matrix);
+}
+
 static void beginMoveCanvas(float xpos, float ypos)
 {
     isMoving = hasMoveToolSelected;
@@ -285,7 +750,28 @@ static void endMoveCanvas(float xpos, float ypos)
 }
 
 static void destroy() {
-    free(canvas);
+    collabLeave(collab);
+    collabRelayStop(relay);
+    collabStrokeFree(&sharedStroke);
+    recorderStop(recorder);
+    playerClose(player);
+    exportDestroy(exporter);
+    documentDestroy(exportDoc);
+    journalDestroy(journal, true);
+    filterDestroy(filter);
+    poolDestroy(pool);
+    rasterDestroy(raster);
+    dirtyTrackerFree(&uploadTracker);
+    dirtyTrackerFree(&journalTracker);
+    dirtyTrackerFree(&residencyTracker);
+    dirtyTrackerFree(&residencyGpuTracker);
+    dirtyTrackerFree(&minimapTracker);
+    dirtyTrackerFree(&minimapGpuTracker);
+    dirtyTrackerFree(&liveTracker);
+    dirtyTrackerFree(&liveGpuTracker);
+    free(lassoPoints);
+    vectorDestroy(vectors);
+    documentDestroy(doc);
 }
 
 static void error_callback(int error, const char* description)
@@ -293,32 +779,80 @@ static void error_callback(int error, const char* description)
     fputs(description, stderr);
 }
 
-static void onKey(GLFWwindow* window, int key, int scancode, int action, int mods)
+static void handleKey(int key, int action, int mods)
 {
-    if(key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
+    if(key == GLFW_KEY_ESCAPE && action == GLFW_PRESS && filter)
+        filterCancel(filter);
+    else if(key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
         glfwSetWindowShouldClose(window, GL_TRUE);
+    else if(key == GLFW_KEY_F1 && action == GLFW_PRESS)
+        hudToggle(hud);
+    else if(key == GLFW_KEY_F2 && action == GLFW_PRESS) {
+        printf(statsDumpCsv(STATS_PATH) ? "stats written to %s\n" : "could not write %s\n", STATS_PATH);
+        memoryDump(stdout);
+        printf("canvas tiles read back %u, spill failures %u\n", canvasFaults(doc->canvas), canvasSpillFailures(doc->canvas));
+    }
+    else if(key == GLFW_KEY_F3 && action == GLFW_PRESS)
+        printf(TRACE_WRITE(TRACE_PATH) ? "trace written to %s\n" : "could not write %s (build with TRACE=1)\n", TRACE_PATH);
     else if(key == GLFW_KEY_SPACE)
         hasMoveToolSelected = (action != GLFW_RELEASE);
+    else if(action != GLFW_PRESS || isDrawing || isSelecting || filter)
+        return;
+    // only strokes are shared, so edits the others would never see, and
+    // undo that would take back their strokes too, wait until painting alone
+    else if(collab && key != GLFW_KEY_B && key != GLFW_KEY_N && !(key == GLFW_KEY_S && (mods & GLFW_MOD_CONTROL)))
+        return;
+    else if(key == GLFW_KEY_B)
+        tool = TOOL_BRUSH;
+    else if(key == GLFW_KEY_M)
+        tool = TOOL_RECT_SELECT;
+    else if(key == GLFW_KEY_L)
+        tool = TOOL_LASSO_SELECT;
+    else if(key == GLFW_KEY_D && (mods & GLFW_MOD_CONTROL))
+        clearSelection();
+    else if(key == GLFW_KEY_Z && (mods & GLFW_MOD_CONTROL) && (mods & GLFW_MOD_SHIFT))
+        undo(true);
+    else if(key == GLFW_KEY_Z && (mods & GLFW_MOD_CONTROL))
+        undo(false);
+    else if(key == GLFW_KEY_F)
+        startBlur(mods & GLFW_MOD_SHIFT ? BLUR_SIGMA_LARGE : BLUR_SIGMA);
+    else if(key == GLFW_KEY_G)
+        toggleGpuPainting();
+    else if(key == GLFW_KEY_V)
+        toggleVectorPainting();
+    else if(key == GLFW_KEY_N)
+        minimapToggle(minimap);
+    else if(key == GLFW_KEY_S && (mods & GLFW_MOD_CONTROL))
+        startExport();
 }
 
-static void onMouseButton(GLFWwindow * window, int button, int action, int mods)
+static void handleMouseButton(int button, int action, int mods, double xpos, double ypos)
 {
-    double xpos, ypos;
-    glfwGetCursorPos(window, &xpos, &ypos);
-
     if(button == GLFW_MOUSE_BUTTON_LEFT)
     {
         hasDrawingToolSelected = !hasMoveToolSelected;
 
+        Point onMinimap;
         if(action == GLFW_PRESS) {
-            if(hasMoveToolSelected) {
+            if(minimapHit(minimap, (Point){xpos, ypos}, &onMinimap)) {
+                isNavigating = true;
+                navigate(xpos, ypos);
+            } else if(hasMoveToolSelected) {
                 beginMoveCanvas(xpos, ypos);
+            } else if(filter) {
+                // the canvas belongs to the running filter until it is applied
+            } else if(tool != TOOL_BRUSH) {
+                beginSelect(xpos, ypos, mods);
             } else if(hasDrawingToolSelected) {
                 beginDraw(xpos, ypos);
             }
         } else if(action == GLFW_RELEASE) {
-            if(isMoving) {
+            if(isNavigating) {
+                isNavigating = false;
+            } else if(isMoving) {
                 endMoveCanvas(xpos, ypos);
+            } else if(isSelecting) {
+                endSelect(xpos, ypos);
             } else if(isDrawing) {
                 endDraw(xpos, ypos);
             }
@@ -343,17 +877,248 @@ static void onMouseButton(GLFWwindow * window, int button, int action, int mods)
     }
 }
 
-static void onMouseMove(GLFWwindow * window, double xpos, double ypos)
+static void handleMouseMove(double xpos, double ypos)
 {
     if(isDrawing)
         draw(xpos, ypos);
+    else if(isNavigating)
+        navigate(xpos, ypos);
     else if(isMoving)
         moveCanvas(xpos, ypos);
+    else if(isSelecting)
+        moveSelect(xpos, ypos);
+}
+
+static RecordState sessionState()
+{
+    return (RecordState){
+        WIDTH, HEIGHT, tool, gpuPainting, vectorPainting, brush, scaleAmt, canvasRect.origin,
+        WINDOW_WIDTH, WINDOW_HEIGHT, minimapVisible(minimap), minimapScreen(minimap)
+    };
 }
 
-int main(void)
+static void restoreState(const RecordState * s)
 {
+    tool = s->tool;
+    if(gpuPainting != s->gpuPainting)
+        toggleGpuPainting();
+    if(vectorPainting != s->vectorPainting)
+        toggleVectorPainting();
+    minimapSetVisible(minimap, s->minimapShown);
+    brush = s->brush;
+    rasterSetBrush(raster, brush);
+    scaleAmt = s->scale;
+    canvasRect.origin = s->origin;
+    scale(matrix, scaleAmt);
+    move(matrix, canvasRect.origin.x, canvasRect.origin.y);
+    glUniformMatrix4fv(transformLoc, 1, false, matrix);
+}
+
+static void toggleRecording()
+{
+    if(recorder) {
+        printf(recorderStop(recorder) ? "recording written to %s\n" : "could not write %s\n", RECORD_PATH);
+        recorder = NULL;
+        return;
+    }
+    RecordState state = sessionState();
+    recorder = recorderStart(RECORD_PATH, &state, pool, glfwGetTime());
+    printf(recorder ? "recording to %s\n" : "could not write %s\n", RECORD_PATH);
+}
+
+static void replayEvent(const RecordEvent * e, void * ctx)
+{
+    inputTime = e->time;
+    replayCursor = (Point){e->x, e->y};
+    switch(e->type) {
+    case RECORD_KEY:
+        handleKey(e->code, e->action, e->mods);
+        break;
+    case RECORD_BUTTON:
+        handleMouseButton(e->code, e->action, e->mods, e->x, e->y);
+        break;
+    case RECORD_MOVE:
+        handleMouseMove(e->x, e->y);
+        break;
+    }
+    // a running blur or save refuses input the recorded session only gave
+    // once it had finished, so the rest waits for it here
+    if(filter || exporter)
+        playerPause(player, glfwGetTime());
+}
+
+static void stopReplay()
+{
+    playerClose(player);
+    player = NULL;
+    // a recording cut off mid stroke would leave the tools stuck
+    if(isDrawing)
+        endDraw(replayCursor.x, replayCursor.y);
+    else if(isSelecting)
+        endSelect(replayCursor.x, replayCursor.y);
+    isMoving = isNavigating = hasMoveToolSelected = false;
+}
+
+// Replays RECORD_PATH over the current document, in real time or with
+// fast as quickly as the frame loop allows.
+static void startReplay(bool fast)
+{
+    if(player || isDrawing || isSelecting || isMoving || filter)
+        return;
+    if(recorder)
+        toggleRecording();
+
+    RecordState state;
+    if(!(player = playerOpen(RECORD_PATH, &state))) {
+        printf("could not read %s\n", RECORD_PATH);
+        return;
+    }
+    if(state.width != WIDTH || state.height != HEIGHT) {
+        printf("%s was recorded on another canvas size\n", RECORD_PATH);
+        playerClose(player);
+        player = NULL;
+        return;
+    }
+    restoreState(&state);
+    replayFast = fast;
+    printf("replaying %s%s\n", RECORD_PATH, fast ? " at full speed" : "");
+}
+
+static void pollReplay()
+{
+    if(!player || filter || exporter)
+        return;
+    playerResume(player, glfwGetTime());
+    if(!playerStep(player, glfwGetTime(), replayFast, replayEvent, NULL)) {
+        stopReplay();
+        printf("replay finished\n");
+    }
+}
+
+// The GLFW callbacks. F4 and F5 drive recording and replay and are never
+// recorded themselves; during replay live input is ignored, except Escape
+// to stop it.
+static void onKey(GLFWwindow * window, int key, int scancode, int action, int mods)
+{
+    if(action == GLFW_PRESS && key == GLFW_KEY_F4 && !player) {
+        toggleRecording();
+    } else if(action == GLFW_PRESS && key == GLFW_KEY_F5) {
+        startReplay(mods & GLFW_MOD_SHIFT);
+    } else if(player) {
+        if(action == GLFW_PRESS && key == GLFW_KEY_ESCAPE) {
+            stopReplay();
+            printf("replay stopped\n");
+        }
+    } else {
+        inputTime = glfwGetTime();
+        if(recorder)
+            recorderAdd(recorder, (RecordEvent){RECORD_KEY, inputTime, key, action, mods, 0, 0});
+        handleKey(key, action, mods);
+    }
+}
+
+static void onMouseButton(GLFWwindow * window, int button, int action, int mods)
+{
+    TRACE_SCOPE("onMouseButton");
+    if(player)
+        return;
+    double xpos, ypos;
+    glfwGetCursorPos(window, &xpos, &ypos);
+    inputTime = glfwGetTime();
+    if(recorder)
+        recorderAdd(recorder, (RecordEvent){RECORD_BUTTON, inputTime, button, action, mods, xpos, ypos});
+    handleMouseButton(button, action, mods, xpos, ypos);
+}
+
+static void onMouseMove(GLFWwindow * window, double xpos, double ypos)
+{
+    TRACE_SCOPE("onMouseMove");
+    if(player)
+        return;
+    inputTime = glfwGetTime();
+    if(recorder)
+        recorderAdd(recorder, (RecordEvent){RECORD_MOVE, inputTime, 0, 0, 0, xpos, ypos});
+    handleMouseMove(xpos, ypos);
+}
+
+// dapper --batch [-j threads] [-o dir] [-t dabs [-s shrink]] input...
+// renders recordings and scripts to PNGs, and with -t to timelapse
+// videos, without opening a window.
+static int runBatch(int argc, char ** argv)
+{
+    BatchOptions options = {NULL, 0, canvasFormat(), canvasFill, brush, HISTORY_LIMIT, 0, 1};
+    int first = 0;
+    for(; first < argc && argv[first][0] == '-'; ++first) {
+        if(strcmp(argv[first], "-j") == 0 && first + 1 < argc)
+            options.threads = atoi(argv[++first]);
+        else if(strcmp(argv[first], "-o") == 0 && first + 1 < argc)
+            options.outDir = argv[++first];
+        else if(strcmp(argv[first], "-t") == 0 && first + 1 < argc)
+            options.timelapseDabs = atoi(argv[++first]);
+        else if(strcmp(argv[first], "-s") == 0 && first + 1 < argc)
+            options.timelapseShrink = atoi(argv[++first]);
+        else
+            break;
+    }
+    int shrink = options.timelapseShrink;
+    bool shrinkValid = shrink >= 1 && shrink <= TILE_SIZE/2 && (shrink & (shrink - 1)) == 0;
+    if(first == argc || argv[first][0] == '-' || !shrinkValid) {
+        fprintf(stderr, "usage: dapper --batch [-j threads] [-o dir] [-t dabs [-s 1|2|4|...|%d]] input...\n", TILE_SIZE/2);
+        return EXIT_FAILURE;
+    }
+    setBudgets();
+    int failed = batchRun((const char * const *)&argv[first], argc - first, &options);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static int runRelay(const char * path)
+{
+    CollabRelay * r = collabRelayStart(path);
+    if(!r) {
+        fprintf(stderr, "Could not relay on %s\n", path);
+        return EXIT_FAILURE;
+    }
+    printf("Relaying strokes on %s\n", path);
+    collabRelayWait(r);
+    collabRelayStop(r);
+    return EXIT_SUCCESS;
+}
+
+// Joins the relay at path, or starts one here for the others to join; they
+// go on alone once this painter quits.
+static void startCollab(const char * path)
+{
+    const Canvas * c = doc->canvas;
+    CollabCanvas canvas = {c->width, c->height, c->format, c->fill};
+    bool refused;
+    if(!(collab = collabJoin(path, &canvas, &refused)) && !refused && (relay = collabRelayStart(path)))
+        collab = collabJoin(path, &canvas, &refused);
+    if(refused) {
+        fprintf(stderr, "The canvas shared through %s differs in size, format or fill; painting alone\n", path);
+        return;
+    }
+    // a rewind undoes one step per pending stroke, so each must be one
+    doc->history->everyStep = collab != NULL;
+    if(collab)
+        printf(relay ? "Hosting collaboration on %s\n" : "Collaborating through %s\n", path);
+    else
+        fprintf(stderr, "Could not collaborate through %s\n", path);
+}
+
+int main(int argc, char ** argv)
+{
+    if(argc > 1 && strcmp(argv[1], "--batch") == 0)
+        return runBatch(argc - 2, argv + 2);
+    // dapper --relay [path] runs a collaboration relay without painting
+    if(argc > 1 && strcmp(argv[1], "--relay") == 0)
+        return runRelay(argc > 2 ? argv[2] : COLLAB_PATH);
+    // dapper --view [name] shows a canvas another dapper publishes
+    if(argc > 1 && strcmp(argv[1], "--view") == 0)
+        return viewerRun(argc > 2 ? argv[2] : LIVE_NAME);
+
+    double launch = statsNow();
     glfwSetErrorCallback(error_callback);
+    TRACE_THREAD("main");
 
     init();
 
@@ -365,6 +1130,8 @@ int main(void)
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
     glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
+    if(doc->canvas->format == CANVAS_SRGB8)
+        glfwWindowHint(GLFW_SRGB_CAPABLE, GL_TRUE);
 
     window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, "Drawing App", NULL, NULL);
     glfwMakeContextCurrent(window);
@@ -404,22 +1171,8 @@ int main(void)
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(elements), elements, GL_STATIC_DRAW);
 
-    // Create and compile the vertex shader
-    GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertexShader, 1, &vertexSource, NULL);
-    glCompileShader(vertexShader);
-
-    // Create and compile the fragment shader
-    GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragmentShader, 1, &fragmentSource, NULL);
-    glCompileShader(fragmentShader);
-
-    // Link the vertex and fragment shader into a shader program
-    GLuint shaderProgram = glCreateProgram();
-    glAttachShader(shaderProgram, vertexShader);
-    glAttachShader(shaderProgram, fragmentShader);
-    glBindFragDataLocation(shaderProgram, 0, "outColor");
-    glLinkProgram(shaderProgram);
+    // Build the shader program, from the binary cache when possible
+    GLuint shaderProgram = programBuild(vertexSource, fragmentSource);
     glUseProgram(shaderProgram);
 
     // Specify the layout of the vertex data
@@ -435,11 +1188,10 @@ int main(void)
     glEnableVertexAttribArray(texAttrib);
     glVertexAttribPointer(texAttrib, 2, GL_FLOAT, GL_FALSE, 7 * sizeof(GLfloat), (void*)(5 * sizeof(GLfloat)));
 
-    // Load texture
+    // The GPU brush's render target; the painter sizes it while that path
+    // is on. The canvas is drawn from the residency's slots.
     glGenTextures(1, &tex);
     glBindTexture(GL_TEXTURE_2D, tex);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, WIDTH, HEIGHT, 0, GL_RGB, GL_FLOAT, canvas);
-
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
@@ -461,6 +1213,7 @@ int main(void)
                             0, 0, -2.0f / (zFar - zNear), 0,
                             -(right+left)/(right-left), -(top+bottom)/(top-bottom), -(zFar+zNear)/(zFar-zNear), 1};
         glUniformMatrix4fv(projectionLoc, 1, false, ortho);
+        memcpy(projection, ortho, sizeof(ortho));
     }
 
     transformLoc = glGetUniformLocation(shaderProgram, "transform");
@@ -469,28 +1222,110 @@ int main(void)
 
     glBindTexture(GL_TEXTURE_2D, 0);
 
+    gpuPainter = gpuPainterCreate(tex, doc, &uploadTracker);
+    residency = residencyCreate(doc->canvas, tex, RESIDENT_SLOTS);
+    minimap = minimapCreate(doc->canvas, tex, WINDOW_WIDTH, WINDOW_HEIGHT);
+    vectorView = vectorViewCreate(vectors, doc->canvas->format, VECTOR_SLOTS);
+    readback = readbackCreate(tex, gpuPainter, doc->canvas);
+    journal = journalCreate(pool, doc->canvas, JOURNAL_PATH);
+    if(recovered)
+        journalMarkAll(journal);
+    if(liveName() && (live = livePublish(readback, doc->canvas, liveName())))
+        printf("Publishing the canvas as %s\n", liveName());
+    if(collabPath())
+        startCollab(collabPath());
+    lastAutosave = glfwGetTime();
+    hud = hudCreate(shaderProgram);
+
     glfwSetKeyCallback(window, onKey);
     glfwSetMouseButtonCallback(window, onMouseButton);
     glfwSetCursorPosCallback(window, onMouseMove);
 
     while(!glfwWindowShouldClose(window))
     {
+        double frameStart = statsNow();
+        double t = frameStart;
+
         glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT);
 
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, tex);
-
-        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+        // uploads first: a GPU stroke may be painting over tiles the CPU
+        // changed earlier in this frame
+        {
+            TRACE_SCOPE("upload");
+            hudGpuBegin(hud, STAGE_GPU_UPLOAD);
+            uploadTiles();
+            hudGpuEnd(hud);
+        }
+        t = lapStage(STAGE_UPLOAD, t);
+        if(gpuPainter) {
+            TRACE_SCOPE("gpuPaint");
+            gpuPainterFlush(gpuPainter);
+        }
+        t = lapStage(STAGE_GPU_PAINT, t);
+        {
+            TRACE_SCOPE("residency");
+            hudGpuBegin(hud, STAGE_GPU_UPLOAD);
+            streamResidentTiles();
+            hudGpuEnd(hud);
+        }
+        t = lapStage(STAGE_UPLOAD, t);
+        {
+            TRACE_SCOPE("readback");
+            readbackPump(readback);
+        }
+        t = lapStage(STAGE_READBACK, t);
+
+        {
+            TRACE_SCOPE("composite");
+            hudGpuBegin(hud, STAGE_GPU_RENDER);
+            residencyDraw(residency, projection, matrix);
+            vectorViewDraw(vectorView, projection, matrix);
+            minimapDraw(minimap, projection, viewRect());
+            hudGpuEnd(hud);
+            hudDraw(hud, glfwGetTime(), matrix);
+        }
+        t = lapStage(STAGE_RENDER, t);
 
-        glfwSwapBuffers(window);
+        {
+            TRACE_SCOPE("swap");
+            glfwSwapBuffers(window);
+        }
+        t = lapStage(STAGE_SWAP, t);
+        if(!statsStartup())
+            reportStartup(t - launch);
         glfwPollEvents();
+        pollReplay();
+        t = lapStage(STAGE_POLL, t);
+        {
+            TRACE_SCOPE("jobs");
+            pollFilter();
+            pollExport();
+            pollThumbnail();
+            autosave(glfwGetTime());
+            publishLive();
+            pollCollab();
+            recorderFlush(recorder);
+            memoryEnforce();
+            prefetchViewport();
+            statsSetSpill(canvasFaults(doc->canvas), canvasSpillFailures(doc->canvas));
+        }
+        t = lapStage(STAGE_JOBS, t);
+
+        hudEndFrame(hud);
+        statsRecord(STAGE_FRAME, t - frameStart);
+        statsEndFrame();
     }
 
+    hudDestroy(hud);
+    vectorViewDestroy(vectorView);
+    residencyDestroy(residency);
+    minimapDestroy(minimap);
     glDeleteProgram(shaderProgram);
-    glDeleteShader(fragmentShader);
-    glDeleteShader(vertexShader);
 
+    readbackDestroy(readback);
+    livePublisherDestroy(live);
+    gpuPainterDestroy(gpuPainter);
     glDeleteTextures(1, &tex);
 
     glDeleteBuffers(1, &ebo);
@@ -0,0 +1,127 @@
+#include <stdlib.h>
+#include <stdatomic.h>
+#include "memory.h"
+
+#define MB (1024.0*1024.0)
+
+struct Account {
+    atomic_llong cpu, gpu;
+    atomic_int tiles;
+    size_t cpuBudget, gpuBudget;
+    ReclaimFunc reclaim;
+    void * ctx;
+};
+typedef struct Account Account;
+
+static Account accounts[SUBSYSTEM_COUNT];
+
+static const char * names[SUBSYSTEM_COUNT] = {
+    "CANVAS", "HISTORY", "SELECTION", "FILTER", "EXPORT", "TEXTURES", "READBACK", "VECTOR"
+};
+
+void memoryCharge(Subsystem s, long long cpuBytes, long long gpuBytes, int tiles)
+{
+    Account * a = &accounts[s];
+    if(cpuBytes)
+        atomic_fetch_add_explicit(&a->cpu, cpuBytes, memory_order_relaxed);
+    if(gpuBytes)
+        atomic_fetch_add_explicit(&a->gpu, gpuBytes, memory_order_relaxed);
+    if(tiles)
+        atomic_fetch_add_explicit(&a->tiles, tiles, memory_order_relaxed);
+}
+
+size_t memoryCpu(Subsystem s)
+{
+    long long v = atomic_load_explicit(&accounts[s].cpu, memory_order_relaxed);
+    return v > 0 ? v : 0;
+}
+
+size_t memoryGpu(Subsystem s)
+{
+    long long v = atomic_load_explicit(&accounts[s].gpu, memory_order_relaxed);
+    return v > 0 ? v : 0;
+}
+
+int memoryTiles(Subsystem s)
+{
+    return atomic_load_explicit(&accounts[s].tiles, memory_order_relaxed);
+}
+
+const char * memorySubsystemName(Subsystem s)
+{
+    return names[s];
+}
+
+void memorySetBudget(Subsystem s, size_t cpuBytes, size_t gpuBytes)
+{
+    accounts[s].cpuBudget = cpuBytes;
+    accounts[s].gpuBudget = gpuBytes;
+}
+
+size_t memoryCpuBudget(Subsystem s)
+{
+    return accounts[s].cpuBudget;
+}
+
+size_t memoryGpuBudget(Subsystem s)
+{
+    return accounts[s].gpuBudget;
+}
+
+static size_t envMegabytes(const char * prefix, const char * name, size_t fallback)
+{
+    char key[64];
+    snprintf(key, sizeof(key), "%s%s", prefix, name);
+    const char * value = getenv(key);
+    if(!value || !*value)
+        return fallback;
+    return (size_t)(strtod(value, NULL)*MB);
+}
+
+void memoryLoadBudgets()
+{
+    for(int s = 0; s < SUBSYSTEM_COUNT; ++s) {
+        accounts[s].cpuBudget = envMegabytes("DAPPER_BUDGET_", names[s], accounts[s].cpuBudget);
+        accounts[s].gpuBudget = envMegabytes("DAPPER_GPU_BUDGET_", names[s], accounts[s].gpuBudget);
+    }
+}
+
+void memorySetReclaimer(Subsystem s, ReclaimFunc fn, void * ctx)
+{
+    accounts[s].reclaim = fn;
+    accounts[s].ctx = ctx;
+}
+
+static size_t excess(size_t used, size_t budget)
+{
+    return budget && used > budget ? used - budget : 0;
+}
+
+void memoryEnforce()
+{
+    for(int s = 0; s < SUBSYSTEM_COUNT; ++s) {
+        Account * a = &accounts[s];
+        if(!a->reclaim)
+            continue;
+        size_t over = excess(memoryCpu(s), a->cpuBudget);
+        size_t overGpu = excess(memoryGpu(s), a->gpuBudget);
+        if(overGpu > over)
+            over = overGpu;
+        if(over)
+            a->reclaim(over, a->ctx);
+    }
+}
+
+void memoryDump(FILE * file)
+{
+    size_t cpu = 0, gpu = 0;
+    fprintf(file, "%-10s %10s %10s %10s %10s %8s\n", "subsystem", "cpu MB", "budget", "gpu MB", "budget", "tiles");
+    for(int s = 0; s < SUBSYSTEM_COUNT; ++s) {
+        Account * a = &accounts[s];
+        fprintf(file, "%-10s %10.1f %10.1f %10.1f %10.1f %8d\n", names[s],
+            memoryCpu(s)/MB, a->cpuBudget/MB, memoryGpu(s)/MB, a->gpuBudget/MB, memoryTiles(s));
+        cpu += memoryCpu(s);
+        gpu += memoryGpu(s);
+    }
+    fprintf(file, "%-10s %10.1f %10s %10.1f\n", "total", cpu/MB, "", gpu/MB);
+}
@@ -0,0 +1,49 @@
+#ifndef DAPPER_MEMORY_H
+#define DAPPER_MEMORY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+enum Subsystem {
+    SUBSYSTEM_CANVAS,
+    SUBSYSTEM_HISTORY,
+    SUBSYSTEM_SELECTION,
+    SUBSYSTEM_FILTER,
+    SUBSYSTEM_EXPORT,
+    SUBSYSTEM_TEXTURES,
+    SUBSYSTEM_READBACK,
+    SUBSYSTEM_VECTOR,
+    SUBSYSTEM_COUNT
+};
+typedef enum Subsystem Subsystem;
+
+// Releases at least excess bytes if it can; returns how much it freed.
+typedef size_t (*ReclaimFunc)(size_t excess, void * ctx);
+
+// Central accounting of what each subsystem holds in RAM and VRAM. Owners
+// charge their allocations (negative amounts release them) from any
+// thread. A subsystem with a budget and a reclaimer is asked to give
+// memory back by memoryEnforce, which the main loop calls once a frame.
+void memoryCharge(Subsystem s, long long cpuBytes, long long gpuBytes, int tiles);
+
+size_t memoryCpu(Subsystem s);
+size_t memoryGpu(Subsystem s);
+int memoryTiles(Subsystem s);
+const char * memorySubsystemName(Subsystem s);
+
+// 0 means unlimited.
+void memorySetBudget(Subsystem s, size_t cpuBytes, size_t gpuBytes);
+size_t memoryCpuBudget(Subsystem s);
+size_t memoryGpuBudget(Subsystem s);
+
+// Reads DAPPER_BUDGET_<NAME>=<MB> and DAPPER_GPU_BUDGET_<NAME>=<MB>
+// from the environment, e.g. DAPPER_BUDGET_HISTORY=256.
+void memoryLoadBudgets();
+
+void memorySetReclaimer(Subsystem s, ReclaimFunc fn, void * ctx);
+void memoryEnforce();
+
+void memoryDump(FILE * file);
+
+#endif
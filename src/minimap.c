@@ -0,0 +1,376 @@
+#include <stdlib.h>
+#include <string.h>
+#include "glformat.h"
+#include "memory.h"
+#include "minimap.h"
+#include "png.h"
+#include "program.h"
+#include "reduce.h"
+
+#define GLSL(src) "#version 150 core\n" #src
+
+// Longest side of the minimap in window pixels, one texel each.
+#define MINIMAP_SIZE 192
+#define MINIMAP_MARGIN 8
+// Past this a tile would shrink to less than one texel.
+#define MAX_LEVEL 7
+// Tiles refreshed per frame, enough for a fast stroke.
+#define REFRESH_BUDGET 64
+#define VERTEX_FLOATS 4
+
+static const GLchar * minimapVertexSource = GLSL(
+    uniform mat4 projection;
+    in vec2 position;
+    in vec2 texcoord;
+    out vec2 Texcoord;
+
+    void main() {
+        Texcoord = texcoord;
+        gl_Position = projection*vec4(position, 0.0, 1.0);
+    }
+);
+
+static const GLchar * minimapFragmentSource = GLSL(
+    in vec2 Texcoord;
+    out vec4 outColor;
+    uniform sampler2D tex;
+    uniform bool textured;
+    uniform vec4 color;
+
+    void main() {
+        outColor = textured ? texture(tex, Texcoord) : color;
+    }
+);
+
+struct Minimap {
+    Canvas * canvas;
+    GLuint mirrorTex;
+    GLuint texture, program, vao, vbo, fbo;
+    GLint projectionLoc, texturedLoc, colorLoc;
+    Reducer * reducer;
+
+    int level, perTile;
+    int textureWidth, textureHeight;
+    int width, height;
+    Rect screen;
+    bool visible;
+
+    uint8_t * queued;
+    uint8_t * gpuOnly;
+    int * queue;
+    int queueCount;
+    float * block;
+    void * encoded;
+
+    // a thumbnail waiting for the queue to drain, and the outcome of the
+    // last one written
+    const char * pngPath;
+    bool pngDone, pngWritten;
+};
+
+static long long textureBytes(const Minimap * m)
+{
+    return (long long)m->textureWidth*m->textureHeight*canvasTexelBytes(canvasTextureFormat(m->canvas->format));
+}
+
+Minimap * minimapCreate(Canvas * canvas, GLuint mirrorTex, int windowWidth, int windowHeight)
+{
+    Minimap * m = calloc(1, sizeof(Minimap));
+    m->canvas = canvas;
+    m->mirrorTex = mirrorTex;
+    m->visible = true;
+
+    int longest = canvas->width > canvas->height ? canvas->width : canvas->height;
+    while(m->level < MAX_LEVEL && (longest + (1 << m->level) - 1) >> m->level > MINIMAP_SIZE)
+        ++m->level;
+    m->perTile = TILE_SIZE >> m->level;
+    m->textureWidth = canvas->tilesX*m->perTile;
+    m->textureHeight = canvas->tilesY*m->perTile;
+    m->width = (canvas->width + (1 << m->level) - 1) >> m->level;
+    m->height = (canvas->height + (1 << m->level) - 1) >> m->level;
+    m->screen = (Rect){
+        {windowWidth - MINIMAP_MARGIN - m->width, windowHeight - MINIMAP_MARGIN - m->height},
+        {m->width, m->height}
+    };
+
+    int tiles = canvas->tilesX*canvas->tilesY;
+    m->queued = calloc(tiles, 1);
+    m->gpuOnly = calloc(tiles, 1);
+    m->queue = malloc(sizeof(int)*tiles);
+    m->block = malloc(sizeof(float)*m->perTile*m->perTile*COLOR_COMPS);
+    m->encoded = malloc(canvas->storedBytes);
+    for(int i = 0; i < tiles; ++i)
+        minimapInvalidate(i % canvas->tilesX, i / canvas->tilesX, m);
+
+    glGenTextures(1, &m->texture);
+    glBindTexture(GL_TEXTURE_2D, m->texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, canvasTextureFormat(canvas->format), m->textureWidth, m->textureHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    memoryCharge(SUBSYSTEM_TEXTURES, 0, textureBytes(m), 0);
+
+    // fbo is the render target for GPU-only tiles and the source for
+    // thumbnails
+    GLint previousRead;
+    glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &previousRead);
+    glGenFramebuffers(1, &m->fbo);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, m->fbo);
+    glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m->texture, 0);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, previousRead);
+
+    if(mirrorTex)
+        m->reducer = reducerCreate(canvas->format);
+
+    m->program = programBuild(minimapVertexSource, minimapFragmentSource);
+    m->projectionLoc = glGetUniformLocation(m->program, "projection");
+    m->texturedLoc = glGetUniformLocation(m->program, "textured");
+    m->colorLoc = glGetUniformLocation(m->program, "color");
+
+    GLint previousVao;
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previousVao);
+    glGenVertexArrays(1, &m->vao);
+    glBindVertexArray(m->vao);
+    glGenBuffers(1, &m->vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, m->vbo);
+    GLint posAttrib = glGetAttribLocation(m->program, "position");
+    glEnableVertexAttribArray(posAttrib);
+    glVertexAttribPointer(posAttrib, 2, GL_FLOAT, GL_FALSE, VERTEX_FLOATS * sizeof(GLfloat), 0);
+    GLint texAttrib = glGetAttribLocation(m->program, "texcoord");
+    glEnableVertexAttribArray(texAttrib);
+    glVertexAttribPointer(texAttrib, 2, GL_FLOAT, GL_FALSE, VERTEX_FLOATS * sizeof(GLfloat), (void*)(2 * sizeof(GLfloat)));
+    glBindVertexArray(previousVao);
+
+    return m;
+}
+
+void minimapDestroy(Minimap * m)
+{
+    if(!m)
+        return;
+    glDeleteBuffers(1, &m->vbo);
+    glDeleteVertexArrays(1, &m->vao);
+    glDeleteProgram(m->program);
+    glDeleteFramebuffers(1, &m->fbo);
+    reducerDestroy(m->reducer);
+    glDeleteTextures(1, &m->texture);
+    memoryCharge(SUBSYSTEM_TEXTURES, 0, -textureBytes(m), 0);
+    free(m->queued);
+    free(m->gpuOnly);
+    free(m->queue);
+    free(m->block);
+    free(m->encoded);
+    free(m);
+}
+
+static void enqueue(Minimap * m, int i)
+{
+    if(m->queued[i])
+        return;
+    m->queued[i] = 1;
+    m->queue[m->queueCount++] = i;
+}
+
+void minimapInvalidate(int tx, int ty, void * ctx)
+{
+    Minimap * m = ctx;
+    int i = ty*m->canvas->tilesX + tx;
+    m->gpuOnly[i] = 0;
+    enqueue(m, i);
+}
+
+void minimapInvalidateGpu(int tx, int ty, void * ctx)
+{
+    Minimap * m = ctx;
+    if(!m->mirrorTex)
+        return;
+    int i = ty*m->canvas->tilesX + tx;
+    m->gpuOnly[i] = 1;
+    enqueue(m, i);
+}
+
+static void refreshTile(Minimap * m, int i)
+{
+    Canvas * c = m->canvas;
+    int tx = i % c->tilesX, ty = i / c->tilesX;
+    int step = 1 << m->level;
+    Rect t = canvasTileRect(c, tx, ty);
+    int w = ((int)t.size.width + step - 1)/step;
+    int h = ((int)t.size.height + step - 1)/step;
+    int x = tx*m->perTile, y = ty*m->perTile;
+
+    if(m->gpuOnly[i]) {
+        GLint previousFbo;
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previousFbo);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m->fbo);
+        reducerDraw(m->reducer, m->mirrorTex, t, m->level, x, y);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, previousFbo);
+    } else {
+        canvasDownsampleTile(c, tx, ty, m->level, m->block, m->perTile*COLOR_COMPS);
+        canvasEncodePixels(c, m->encoded, m->block, m->perTile*m->perTile);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, w, h, GL_RGB, canvasPixelType(c->format), m->encoded);
+    }
+    m->queued[i] = 0;
+}
+
+static void refresh(Minimap * m, int budget)
+{
+    int count = m->queueCount < budget ? m->queueCount : budget;
+    if(!count)
+        return;
+    glBindTexture(GL_TEXTURE_2D, m->texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, m->perTile);
+    for(int i = 0; i < count; ++i)
+        refreshTile(m, m->queue[i]);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    m->queueCount -= count;
+    memmove(m->queue, &m->queue[count], sizeof(int)*m->queueCount);
+}
+
+static bool writePng(Minimap * m, const char * path);
+
+void minimapUpdate(Minimap * m)
+{
+    refresh(m, REFRESH_BUDGET);
+    if(m->pngPath && !m->queueCount) {
+        m->pngWritten = writePng(m, m->pngPath);
+        m->pngDone = true;
+        m->pngPath = NULL;
+    }
+}
+
+void minimapToggle(Minimap * m)
+{
+    m->visible = !m->visible;
+}
+
+void minimapSetVisible(Minimap * m, bool visible)
+{
+    m->visible = visible;
+}
+
+bool minimapVisible(const Minimap * m)
+{
+    return m->visible;
+}
+
+Rect minimapScreen(const Minimap * m)
+{
+    return m->screen;
+}
+
+static void putVertex(GLfloat ** v, float x, float y, float u, float t)
+{
+    GLfloat vertex[VERTEX_FLOATS] = {x, y, u, t};
+    memcpy(*v, vertex, sizeof(vertex));
+    *v += VERTEX_FLOATS;
+}
+
+// Lines run through pixel centres, just inside r.
+static void putOutline(GLfloat ** v, Rect r)
+{
+    float x0 = r.origin.x + 0.5f, y0 = r.origin.y + 0.5f;
+    float x1 = r.origin.x + r.size.width - 0.5f, y1 = r.origin.y + r.size.height - 0.5f;
+    putVertex(v, x0, y0, 0, 0);
+    putVertex(v, x1, y0, 0, 0);
+    putVertex(v, x1, y1, 0, 0);
+    putVertex(v, x0, y1, 0, 0);
+}
+
+void minimapDraw(Minimap * m, const GLfloat * projection, Rect view)
+{
+    if(!m->visible)
+        return;
+
+    // the view clipped to the canvas, in window pixels
+    Rect s = m->screen;
+    float kx = s.size.width/m->canvas->width, ky = s.size.height/m->canvas->height;
+    float x0 = view.origin.x > 0 ? view.origin.x : 0;
+    float y0 = view.origin.y > 0 ? view.origin.y : 0;
+    float x1 = view.origin.x + view.size.width < m->canvas->width ? view.origin.x + view.size.width : m->canvas->width;
+    float y1 = view.origin.y + view.size.height < m->canvas->height ? view.origin.y + view.size.height : m->canvas->height;
+    Rect inView = {{s.origin.x + x0*kx, s.origin.y + y0*ky}, {(x1 - x0)*kx, (y1 - y0)*ky}};
+
+    GLfloat vertices[12*VERTEX_FLOATS], * v = vertices;
+    float u = (float)m->width/m->textureWidth, t = (float)m->height/m->textureHeight;
+    putVertex(&v, s.origin.x, s.origin.y, 0, 0);
+    putVertex(&v, s.origin.x + s.size.width, s.origin.y, u, 0);
+    putVertex(&v, s.origin.x + s.size.width, s.origin.y + s.size.height, u, t);
+    putVertex(&v, s.origin.x, s.origin.y + s.size.height, 0, t);
+    putOutline(&v, (Rect){{s.origin.x - 1, s.origin.y - 1}, {s.size.width + 2, s.size.height + 2}});
+    putOutline(&v, inView);
+
+    GLint previousProgram, previousVao;
+    glGetIntegerv(GL_CURRENT_PROGRAM, &previousProgram);
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previousVao);
+
+    glUseProgram(m->program);
+    glUniformMatrix4fv(m->projectionLoc, 1, false, projection);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, m->texture);
+    glBindVertexArray(m->vao);
+    glBindBuffer(GL_ARRAY_BUFFER, m->vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STREAM_DRAW);
+
+    glUniform1i(m->texturedLoc, 1);
+    canvasLinearBegin(m->canvas->format);
+    glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+    canvasLinearEnd(m->canvas->format);
+    glUniform1i(m->texturedLoc, 0);
+    glUniform4f(m->colorLoc, 0.2f, 0.2f, 0.2f, 1.0f);
+    glDrawArrays(GL_LINE_LOOP, 4, 4);
+    if(inView.size.width > 0 && inView.size.height > 0) {
+        glUniform4f(m->colorLoc, 1.0f, 0.3f, 0.2f, 1.0f);
+        glDrawArrays(GL_LINE_LOOP, 8, 4);
+    }
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindVertexArray(previousVao);
+    glUseProgram(previousProgram);
+}
+
+bool minimapHit(const Minimap * m, Point window, Point * canvas)
+{
+    Rect s = m->screen;
+    if(!m->visible || window.x < s.origin.x || window.y < s.origin.y ||
+       window.x >= s.origin.x + s.size.width || window.y >= s.origin.y + s.size.height)
+        return false;
+    canvas->x = (window.x - s.origin.x)/s.size.width*m->canvas->width;
+    canvas->y = (window.y - s.origin.y)/s.size.height*m->canvas->height;
+    return true;
+}
+
+// The minimap level as it is on the GPU, read back as 8 bit RGB the way
+// the readback ring reads the canvas texture.
+static bool writePng(Minimap * m, const char * path)
+{
+    size_t bytes = (size_t)m->width*m->height*3;
+    uint8_t * rgb = malloc(bytes);
+    memoryCharge(SUBSYSTEM_EXPORT, bytes, 0, 0);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, m->fbo);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, m->width, m->height, GL_RGB, GL_UNSIGNED_BYTE, rgb);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    bool written = pngWrite(path, m->width, m->height, rgb, m->width*3);
+    memoryCharge(SUBSYSTEM_EXPORT, -(long long)bytes, 0, 0);
+    free(rgb);
+    return written;
+}
+
+void minimapRequestPng(Minimap * m, const char * path)
+{
+    m->pngPath = path;
+}
+
+bool minimapPngDone(Minimap * m, bool * written)
+{
+    if(!m->pngDone)
+        return false;
+    m->pngDone = false;
+    *written = m->pngWritten;
+    return true;
+}
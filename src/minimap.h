@@ -0,0 +1,54 @@
+#ifndef DAPPER_MINIMAP_H
+#define DAPPER_MINIMAP_H
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+#include <stdbool.h>
+#include "canvas.h"
+
+typedef struct Minimap Minimap;
+
+// Navigator overlay in the bottom right corner of the window: the whole
+// canvas at the coarsest mip level that still spans MINIMAP_SIZE pixels,
+// with the part in view outlined. The level lives in a small texture of
+// its own and is kept up to date a tile at a time: a changed tile is
+// shrunk on the CPU with canvasDownsampleTile and only its block is
+// uploaded, or, when its pixels only exist in mirrorTex, averaged down from
+// there by a shader applying the same box filter. Starts with every tile
+// queued, so the first few frames fill it in. GL thread only.
+Minimap * minimapCreate(Canvas * canvas, GLuint mirrorTex, int windowWidth, int windowHeight);
+void minimapDestroy(Minimap * m);
+
+// TileFuncs with the minimap as context, as for the residency.
+void minimapInvalidate(int tx, int ty, void * ctx);
+void minimapInvalidateGpu(int tx, int ty, void * ctx);
+
+// Refreshes up to a frame's budget of queued tiles.
+void minimapUpdate(Minimap * m);
+
+void minimapToggle(Minimap * m);
+void minimapSetVisible(Minimap * m, bool visible);
+bool minimapVisible(const Minimap * m);
+
+// Where the minimap sits in the window, shown or not.
+Rect minimapScreen(const Minimap * m);
+
+// view is the visible part of the canvas in canvas pixels.
+void minimapDraw(Minimap * m, const GLfloat * projection, Rect view);
+
+// True when the window point lands on the visible minimap; canvas is then
+// the canvas point under it.
+bool minimapHit(const Minimap * m, Point window, Point * canvas);
+
+// Asks for the minimap to be written to path, which must outlive the
+// request, as a PNG thumbnail of the canvas. minimapUpdate writes it once
+// it has refreshed everything queued, a frame's budget at a time, so
+// asking never costs a pass over the canvas. A second request before then
+// replaces the first.
+void minimapRequestPng(Minimap * m, const char * path);
+
+// True once for each thumbnail written, with *written false when it could
+// not be saved.
+bool minimapPngDone(Minimap * m, bool * written);
+
+#endif
@@ -0,0 +1,72 @@
+#include <math.h>
+#include "paint.h"
+
+static inline void placePointUnmasked(float * tile, int x, int y, Color c)
+{
+    float * px = tilePixel(tile, x, y);
+    px[0] = c.r;
+    px[1] = c.g;
+    px[2] = c.b;
+    //TODO: figure out how to handle Alpha
+}
+
+void placePoint(Document * doc, Point p, Color c)
+{
+    int x = p.x;
+    int y = p.y;
+    if(!selectionContains(doc->selection, x, y))
+        return;
+
+    int tx = x/TILE_SIZE, ty = y/TILE_SIZE;
+    historySaveTile(doc->history, tx, ty);
+    float * tile = canvasLockTile(doc->canvas, tx, ty, TILE_WRITE);
+    placePointUnmasked(tile, x - tx*TILE_SIZE, y - ty*TILE_SIZE, c);
+    canvasUnlockTile(doc->canvas, tx, ty, tile);
+    canvasTouchTile(doc->canvas, tx, ty);
+}
+
+// Walks the rect tile by tile so the selection is only consulted per pixel on
+// tiles that straddle the selection boundary.
+void placeRect(Document * doc, Rect r, Color c)
+{
+    Canvas * canvas = doc->canvas;
+    int x0 = fmax(r.origin.x, 0);
+    int y0 = fmax(r.origin.y, 0);
+    int x1 = fmin(r.origin.x + r.size.width, canvas->width);
+    int y1 = fmin(r.origin.y + r.size.height, canvas->height);
+    if(x0 >= x1 || y0 >= y1)
+        return;
+
+    for(int ty = y0/TILE_SIZE; ty*TILE_SIZE < y1; ++ty) {
+        int ys = fmax(y0, ty*TILE_SIZE);
+        int ye = fmin(y1, (ty+1)*TILE_SIZE);
+        for(int tx = x0/TILE_SIZE; tx*TILE_SIZE < x1; ++tx) {
+            int xs = fmax(x0, tx*TILE_SIZE);
+            int xe = fmin(x1, (tx+1)*TILE_SIZE);
+
+            TileCoverage cov = selectionTile(doc->selection, tx, ty);
+            if(cov == TILE_OUT)
+                continue;
+
+            historySaveTile(doc->history, tx, ty);
+            float * tile = canvasLockTile(canvas, tx, ty, TILE_WRITE);
+            int ox = tx*TILE_SIZE, oy = ty*TILE_SIZE;
+            if(cov == TILE_IN) {
+                for(int y = ys; y < ye; ++y)
+                    for(int x = xs; x < xe; ++x)
+                        placePointUnmasked(tile, x - ox, y - oy, c);
+            } else {
+                const uint8_t * mask = selectionMask(doc->selection, tx, ty);
+                for(int y = ys; y < ye; ++y) {
+                    const uint8_t * row = &mask[(y - oy)*TILE_SIZE];
+                    for(int x = xs; x < xe; ++x) {
+                        if(row[x - ox])
+                            placePointUnmasked(tile, x - ox, y - oy, c);
+                    }
+                }
+            }
+            canvasUnlockTile(canvas, tx, ty, tile);
+            canvasTouchTile(canvas, tx, ty);
+        }
+    }
+}
@@ -0,0 +1,11 @@
+#ifndef DAPPER_PAINT_H
+#define DAPPER_PAINT_H
+
+#include "document.h"
+
+// Both respect the selection, record touched tiles in the open history step
+// and stamp the tiles they wrote as dirty.
+void placePoint(Document * doc, Point p, Color c);
+void placeRect(Document * doc, Rect r, Color c);
+
+#endif
@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "png.h"
+
+#define STORED_BLOCK_MAX 65535
+
+static uint32_t crcTable[256];
+// batch mode writes from several threads at once
+static pthread_once_t crcOnce = PTHREAD_ONCE_INIT;
+
+static void buildCrcTable()
+{
+    for(uint32_t n = 0; n < 256; ++n) {
+        uint32_t c = n;
+        for(int k = 0; k < 8; ++k)
+            c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        crcTable[n] = c;
+    }
+}
+
+static uint32_t crcUpdate(uint32_t crc, const uint8_t * data, size_t len)
+{
+    for(size_t i = 0; i < len; ++i)
+        crc = crcTable[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+static void put32(uint8_t * p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+// Chunk data is streamed, so the chunk writer keeps a running CRC.
+struct ChunkWriter {
+    FILE * file;
+    uint32_t crc;
+};
+typedef struct ChunkWriter ChunkWriter;
+
+static void chunkBegin(ChunkWriter * w, const char * type, uint32_t length)
+{
+    uint8_t header[8];
+    put32(header, length);
+    memcpy(&header[4], type, 4);
+    fwrite(header, 1, 8, w->file);
+    w->crc = crcUpdate(0xffffffffu, &header[4], 4);
+}
+
+static void chunkWrite(ChunkWriter * w, const uint8_t * data, size_t len)
+{
+    fwrite(data, 1, len, w->file);
+    w->crc = crcUpdate(w->crc, data, len);
+}
+
+static void chunkEnd(ChunkWriter * w)
+{
+    uint8_t crc[4];
+    put32(crc, w->crc ^ 0xffffffffu);
+    fwrite(crc, 1, 4, w->file);
+}
+
+bool pngWrite(const char * path, int width, int height, const uint8_t * rgb, int stride)
+{
+    FILE * file = fopen(path, "wb");
+    if(!file)
+        return false;
+
+    pthread_once(&crcOnce, buildCrcTable);
+
+    static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    fwrite(signature, 1, 8, file);
+
+    ChunkWriter w = {file, 0};
+    uint8_t ihdr[13];
+    put32(ihdr, width);
+    put32(&ihdr[4], height);
+    ihdr[8] = 8;    // bit depth
+    ihdr[9] = 2;    // truecolour
+    ihdr[10] = ihdr[11] = ihdr[12] = 0;
+    chunkBegin(&w, "IHDR", 13);
+    chunkWrite(&w, ihdr, 13);
+    chunkEnd(&w);
+
+    // zlib stream: header, stored blocks over (filter byte + row) * height,
+    // adler32 trailer
+    size_t rowBytes = (size_t)width*3 + 1;
+    size_t raw = rowBytes*height;
+    size_t blocks = (raw + STORED_BLOCK_MAX - 1)/STORED_BLOCK_MAX;
+    chunkBegin(&w, "IDAT", 2 + blocks*5 + raw + 4);
+
+    static const uint8_t zlibHeader[2] = {0x78, 0x01};
+    chunkWrite(&w, zlibHeader, 2);
+
+    uint32_t s1 = 1, s2 = 0;
+    size_t row = 0, offset = 0, left = raw;
+    while(left) {
+        size_t len = left < STORED_BLOCK_MAX ? left : STORED_BLOCK_MAX;
+        left -= len;
+        uint8_t header[5] = {left == 0, len & 0xff, len >> 8, ~len & 0xff, (~len >> 8) & 0xff};
+        chunkWrite(&w, header, 5);
+
+        while(len) {
+            const uint8_t filter = 0;
+            const uint8_t * src = offset == 0 ? &filter : &rgb[(size_t)row*stride + offset - 1];
+            size_t n = offset == 0 ? 1 : rowBytes - offset;
+            if(n > len)
+                n = len;
+            chunkWrite(&w, src, n);
+            for(size_t i = 0; i < n; ++i) {
+                s1 = (s1 + src[i]) % 65521;
+                s2 = (s2 + s1) % 65521;
+            }
+            len -= n;
+            offset += n;
+            if(offset == rowBytes) {
+                offset = 0;
+                ++row;
+            }
+        }
+    }
+
+    uint8_t adler[4];
+    put32(adler, (s2 << 16) | s1);
+    chunkWrite(&w, adler, 4);
+    chunkEnd(&w);
+
+    chunkBegin(&w, "IEND", 0);
+    chunkEnd(&w);
+
+    bool ok = !ferror(file);
+    return fclose(file) == 0 && ok;
+}
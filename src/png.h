@@ -0,0 +1,11 @@
+#ifndef DAPPER_PNG_H
+#define DAPPER_PNG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Writes 8-bit RGB rows as an uncompressed PNG (stored deflate blocks), so
+// there is no dependency on zlib and writing is bound by disk speed.
+bool pngWrite(const char * path, int width, int height, const uint8_t * rgb, int stride);
+
+#endif
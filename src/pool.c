@@ -0,0 +1,270 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "pool.h"
+#include "trace.h"
+
+struct Task {
+    JobFunc fn;
+    void * arg;
+    PoolGroup * group;
+};
+typedef struct Task Task;
+
+// Growable ring buffer. The owner works at the tail, thieves at the head.
+struct Deque {
+    pthread_mutex_t lock;
+    Task * tasks;
+    int head, count, capacity;
+};
+typedef struct Deque Deque;
+
+struct Worker {
+    Pool * pool;
+    int index;
+    pthread_t thread;
+    Deque deque;
+};
+typedef struct Worker Worker;
+
+struct Pool {
+    Worker * workers;
+    int threadCount;
+    atomic_uint nextWorker;
+    atomic_int queued;
+    pthread_mutex_t sleepLock;
+    pthread_cond_t wake;
+    bool stopping;
+};
+
+struct PoolGroup {
+    atomic_int submitted;
+    atomic_int completed;
+    atomic_bool cancelled;
+    pthread_mutex_t lock;
+    pthread_cond_t idle;
+};
+
+static __thread Worker * currentWorker = NULL;
+
+static void pushTail(Deque * d, Task t)
+{
+    pthread_mutex_lock(&d->lock);
+    if(d->count == d->capacity) {
+        int capacity = d->capacity ? 2*d->capacity : 64;
+        Task * tasks = malloc(sizeof(Task)*capacity);
+        for(int i = 0; i < d->count; ++i)
+            tasks[i] = d->tasks[(d->head + i) % d->capacity];
+        free(d->tasks);
+        d->tasks = tasks;
+        d->head = 0;
+        d->capacity = capacity;
+    }
+    d->tasks[(d->head + d->count++) % d->capacity] = t;
+    pthread_mutex_unlock(&d->lock);
+}
+
+static bool popTail(Deque * d, Task * t)
+{
+    bool found = false;
+    pthread_mutex_lock(&d->lock);
+    if(d->count) {
+        *t = d->tasks[(d->head + --d->count) % d->capacity];
+        found = true;
+    }
+    pthread_mutex_unlock(&d->lock);
+    return found;
+}
+
+static bool popHead(Deque * d, Task * t)
+{
+    bool found = false;
+    pthread_mutex_lock(&d->lock);
+    if(d->count) {
+        *t = d->tasks[d->head];
+        d->head = (d->head + 1) % d->capacity;
+        --d->count;
+        found = true;
+    }
+    pthread_mutex_unlock(&d->lock);
+    return found;
+}
+
+static bool findTask(Pool * pool, Worker * self, Task * t)
+{
+    if(popTail(&self->deque, t))
+        return true;
+    for(int i = 1; i < pool->threadCount; ++i) {
+        Worker * victim = &pool->workers[(self->index + i) % pool->threadCount];
+        if(popHead(&victim->deque, t))
+            return true;
+    }
+    return false;
+}
+
+static void runTask(Task t)
+{
+    PoolGroup * g = t.group;
+    if(!g || !atomic_load(&g->cancelled)) {
+        TRACE_SCOPE("job");
+        t.fn(t.arg);
+    }
+    if(!g)
+        return;
+
+    // lock so a waiter cannot miss the wakeup between its check and its wait
+    pthread_mutex_lock(&g->lock);
+    if(atomic_fetch_add(&g->completed, 1) + 1 == atomic_load(&g->submitted))
+        pthread_cond_broadcast(&g->idle);
+    pthread_mutex_unlock(&g->lock);
+}
+
+static void * workerMain(void * arg)
+{
+    Worker * self = arg;
+    Pool * pool = self->pool;
+    currentWorker = self;
+    TRACE_THREAD("worker");
+
+    for(;;) {
+        Task t;
+        if(findTask(pool, self, &t)) {
+            atomic_fetch_sub(&pool->queued, 1);
+            runTask(t);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->sleepLock);
+        while(atomic_load(&pool->queued) <= 0 && !pool->stopping)
+            pthread_cond_wait(&pool->wake, &pool->sleepLock);
+        bool done = pool->stopping && atomic_load(&pool->queued) <= 0;
+        pthread_mutex_unlock(&pool->sleepLock);
+        if(done)
+            return NULL;
+    }
+}
+
+Pool * poolCreate(int threads)
+{
+    if(threads <= 0)
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if(threads <= 0)
+        threads = 1;
+
+    Pool * pool = calloc(1, sizeof(Pool));
+    pool->threadCount = threads;
+    pool->workers = calloc(threads, sizeof(Worker));
+    atomic_init(&pool->nextWorker, 0);
+    atomic_init(&pool->queued, 0);
+    pthread_mutex_init(&pool->sleepLock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+
+    for(int i = 0; i < threads; ++i) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+        pthread_mutex_init(&pool->workers[i].deque.lock, NULL);
+    }
+    for(int i = 0; i < threads; ++i)
+        pthread_create(&pool->workers[i].thread, NULL, workerMain, &pool->workers[i]);
+    return pool;
+}
+
+void poolDestroy(Pool * pool)
+{
+    if(!pool)
+        return;
+
+    pthread_mutex_lock(&pool->sleepLock);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->sleepLock);
+
+    for(int i = 0; i < pool->threadCount; ++i)
+        pthread_join(pool->workers[i].thread, NULL);
+
+    for(int i = 0; i < pool->threadCount; ++i) {
+        pthread_mutex_destroy(&pool->workers[i].deque.lock);
+        free(pool->workers[i].deque.tasks);
+    }
+    pthread_cond_destroy(&pool->wake);
+    pthread_mutex_destroy(&pool->sleepLock);
+    free(pool->workers);
+    free(pool);
+}
+
+int poolThreadCount(const Pool * pool)
+{
+    return pool->threadCount;
+}
+
+void poolSubmitGroup(Pool * pool, PoolGroup * group, JobFunc fn, void * arg)
+{
+    if(group)
+        atomic_fetch_add(&group->submitted, 1);
+
+    Worker * w = currentWorker;
+    if(!w || w->pool != pool)
+        w = &pool->workers[atomic_fetch_add(&pool->nextWorker, 1) % pool->threadCount];
+    pushTail(&w->deque, (Task){fn, arg, group});
+    atomic_fetch_add(&pool->queued, 1);
+
+    pthread_mutex_lock(&pool->sleepLock);
+    pthread_cond_signal(&pool->wake);
+    pthread_mutex_unlock(&pool->sleepLock);
+}
+
+void poolSubmit(Pool * pool, JobFunc fn, void * arg)
+{
+    poolSubmitGroup(pool, NULL, fn, arg);
+}
+
+PoolGroup * poolGroupCreate()
+{
+    PoolGroup * g = calloc(1, sizeof(PoolGroup));
+    atomic_init(&g->submitted, 0);
+    atomic_init(&g->completed, 0);
+    atomic_init(&g->cancelled, false);
+    pthread_mutex_init(&g->lock, NULL);
+    pthread_cond_init(&g->idle, NULL);
+    return g;
+}
+
+void poolGroupDestroy(PoolGroup * g)
+{
+    if(!g)
+        return;
+    pthread_cond_destroy(&g->idle);
+    pthread_mutex_destroy(&g->lock);
+    free(g);
+}
+
+void poolGroupCancel(PoolGroup * g)
+{
+    atomic_store(&g->cancelled, true);
+}
+
+bool poolGroupCancelled(const PoolGroup * g)
+{
+    return atomic_load(&g->cancelled);
+}
+
+bool poolGroupIdle(const PoolGroup * g)
+{
+    return atomic_load(&g->completed) == atomic_load(&g->submitted);
+}
+
+float poolGroupProgress(const PoolGroup * g)
+{
+    int submitted = atomic_load(&g->submitted);
+    return submitted ? (float)atomic_load(&g->completed)/submitted : 1.0f;
+}
+
+void poolGroupWait(PoolGroup * g)
+{
+    pthread_mutex_lock(&g->lock);
+    while(!poolGroupIdle(g))
+        pthread_cond_wait(&g->idle, &g->lock);
+    pthread_mutex_unlock(&g->lock);
+}
@@ -0,0 +1,38 @@
+#ifndef DAPPER_POOL_H
+#define DAPPER_POOL_H
+
+#include <stdbool.h>
+
+typedef void (*JobFunc)(void * arg);
+
+typedef struct Pool Pool;
+typedef struct PoolGroup PoolGroup;
+
+// The one task pool every CPU-heavy subsystem shares. Each worker owns a
+// deque: it pushes and pops its own jobs LIFO and, when it runs dry, steals
+// the oldest job from another worker. threads <= 0 sizes the pool to the
+// number of online cores.
+Pool * poolCreate(int threads);
+void poolDestroy(Pool * pool);
+
+int poolThreadCount(const Pool * pool);
+
+// Jobs submitted from a worker land on that worker's own deque; jobs from
+// any other thread are spread round robin.
+void poolSubmit(Pool * pool, JobFunc fn, void * arg);
+void poolSubmitGroup(Pool * pool, PoolGroup * group, JobFunc fn, void * arg);
+
+// A group tracks a batch of jobs so the submitter can poll progress, cancel
+// the batch or wait for it. Cancelled jobs that have not started are
+// dropped; running ones may poll poolGroupCancelled to stop early. Never
+// wait on a group from inside one of the pool's own jobs.
+PoolGroup * poolGroupCreate();
+void poolGroupDestroy(PoolGroup * group);
+
+void poolGroupCancel(PoolGroup * group);
+bool poolGroupCancelled(const PoolGroup * group);
+bool poolGroupIdle(const PoolGroup * group);
+float poolGroupProgress(const PoolGroup * group);
+void poolGroupWait(PoolGroup * group);
+
+#endif
@@ -0,0 +1,176 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "program.h"
+
+#define CACHE_MAGIC "DPB1"
+#define HEADER_BYTES 12
+
+static int programsBuilt = 0;
+static int programsCached = 0;
+
+static uint64_t hashString(uint64_t h, const char * s)
+{
+    // FNV-1a, with the terminator included so fields cannot run together
+    do {
+        h ^= (uint8_t)*s;
+        h *= 0x100000001b3ull;
+    } while(*s++);
+    return h;
+}
+
+static const char * glString(GLenum name)
+{
+    const char * s = (const char *)glGetString(name);
+    return s ? s : "";
+}
+
+// Fills path with the cache file for this driver and source, creating the
+// directory as needed. False when there is nowhere to cache.
+static bool cachePath(char * path, size_t size, const GLchar * vertexSource, const GLchar * fragmentSource)
+{
+    const char * xdg = getenv("XDG_CACHE_HOME");
+    const char * home = getenv("HOME");
+    char dir[960];
+    if(xdg && *xdg) {
+        snprintf(dir, sizeof(dir), "%s/dapper", xdg);
+    } else if(home && *home) {
+        snprintf(dir, sizeof(dir), "%s/.cache", home);
+        mkdir(dir, 0755);
+        snprintf(dir, sizeof(dir), "%s/.cache/dapper", home);
+    } else {
+        return false;
+    }
+    if(mkdir(dir, 0755) != 0 && errno != EEXIST)
+        return false;
+
+    uint64_t h = 0xcbf29ce484222325ull;
+    h = hashString(h, glString(GL_VENDOR));
+    h = hashString(h, glString(GL_RENDERER));
+    h = hashString(h, glString(GL_VERSION));
+    h = hashString(h, vertexSource);
+    h = hashString(h, fragmentSource);
+    snprintf(path, size, "%s/%016llx.bin", dir, (unsigned long long)h);
+    return true;
+}
+
+static GLuint loadBinary(const char * path)
+{
+    FILE * file = fopen(path, "rb");
+    if(!file)
+        return 0;
+
+    uint8_t header[HEADER_BYTES];
+    GLuint program = 0;
+    if(fread(header, 1, HEADER_BYTES, file) == HEADER_BYTES && memcmp(header, CACHE_MAGIC, 4) == 0) {
+        uint32_t format, length;
+        memcpy(&format, &header[4], 4);
+        memcpy(&length, &header[8], 4);
+        void * binary = malloc(length);
+        if(binary && fread(binary, 1, length, file) == length) {
+            program = glCreateProgram();
+            glProgramBinary(program, format, binary, length);
+            GLint linked = GL_FALSE;
+            glGetProgramiv(program, GL_LINK_STATUS, &linked);
+            // a driver update can reject an old binary
+            if(!linked) {
+                glDeleteProgram(program);
+                program = 0;
+            }
+        }
+        free(binary);
+    }
+    fclose(file);
+    return program;
+}
+
+static void saveBinary(const char * path, GLuint program)
+{
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if(length <= 0)
+        return;
+
+    uint8_t * data = malloc(HEADER_BYTES + length);
+    GLenum format;
+    GLsizei written = 0;
+    glGetProgramBinary(program, length, &written, &format, &data[HEADER_BYTES]);
+    if(written <= 0) {
+        free(data);
+        return;
+    }
+    uint32_t header[2] = {format, (uint32_t)written};
+    memcpy(data, CACHE_MAGIC, 4);
+    memcpy(&data[4], header, sizeof(header));
+
+    // written aside and renamed so a concurrent launch never reads half a file
+    char tmpPath[1100];
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path);
+    FILE * file = fopen(tmpPath, "wb");
+    if(!file) {
+        free(data);
+        return;
+    }
+    bool ok = fwrite(data, 1, HEADER_BYTES + written, file) == (size_t)(HEADER_BYTES + written);
+    if(fclose(file) == 0 && ok)
+        rename(tmpPath, path);
+    else
+        remove(tmpPath);
+    free(data);
+}
+
+static GLuint compileProgram(const GLchar * vertexSource, const GLchar * fragmentSource, bool retrievable)
+{
+    GLuint vs = glCreateShader(GL_VERTEX_SHADER);
+    glShaderSource(vs, 1, &vertexSource, NULL);
+    glCompileShader(vs);
+
+    GLuint fs = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(fs, 1, &fragmentSource, NULL);
+    glCompileShader(fs);
+
+    GLuint program = glCreateProgram();
+    glAttachShader(program, vs);
+    glAttachShader(program, fs);
+    glBindFragDataLocation(program, 0, "outColor");
+    if(retrievable)
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glLinkProgram(program);
+    glDeleteShader(vs);
+    glDeleteShader(fs);
+    return program;
+}
+
+GLuint programBuild(const GLchar * vertexSource, const GLchar * fragmentSource)
+{
+    ++programsBuilt;
+    GLint formats = 0;
+    if(GLEW_ARB_get_program_binary)
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    char path[1024];
+    if(formats <= 0 || !cachePath(path, sizeof(path), vertexSource, fragmentSource))
+        return compileProgram(vertexSource, fragmentSource, false);
+
+    GLuint program = loadBinary(path);
+    if(program) {
+        ++programsCached;
+        return program;
+    }
+    program = compileProgram(vertexSource, fragmentSource, true);
+    GLint linked = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if(linked)
+        saveBinary(path, program);
+    return program;
+}
+
+void programCacheCounts(int * built, int * cached)
+{
+    *built = programsBuilt;
+    *cached = programsCached;
+}
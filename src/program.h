@@ -0,0 +1,17 @@
+#ifndef DAPPER_PROGRAM_H
+#define DAPPER_PROGRAM_H
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+// Links a program from vertex and fragment source with outColor bound to
+// draw buffer 0. Where the driver supports program binaries the linked
+// result is kept in a cache directory ($XDG_CACHE_HOME/dapper, or
+// ~/.cache/dapper), keyed by driver and source, and loaded from there on
+// later runs. Anything unusable in the cache falls back to compiling.
+GLuint programBuild(const GLchar * vertexSource, const GLchar * fragmentSource);
+
+// Programs built so far, and how many of them came from the cache.
+void programCacheCounts(int * built, int * cached);
+
+#endif
@@ -0,0 +1,174 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <math.h>
+#include "paint.h"
+#include "raster.h"
+#include "stats.h"
+#include "trace.h"
+
+#define QUEUE_SIZE 4096
+// seconds of stroke travel to prefetch for
+#define PREFETCH_AHEAD 0.1f
+#define PREFETCH_TILES 4
+
+struct Raster {
+    Document * doc;
+    Brush brush;
+    Stroke stroke;
+    pthread_t thread;
+
+    InputEvent events[QUEUE_SIZE];
+    atomic_uint head;
+    atomic_uint tail;
+
+    atomic_bool sleeping;
+    atomic_bool stopping;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+};
+
+struct DabTarget {
+    Document * doc;
+    int dabs;
+};
+typedef struct DabTarget DabTarget;
+
+static void placeDab(Point p, const Brush * brush, void * ctx)
+{
+    DabTarget * target = ctx;
+    placeRect(target->doc, strokeDabRect(p, brush), brush->color);
+    ++target->dabs;
+}
+
+// Reads spilled tiles the stroke is heading for before it gets there.
+static void prefetchAhead(Raster * r)
+{
+    Point p = r->stroke.filtered;
+    Point v = r->stroke.speed;
+    float reach = 0.5f*r->brush.size + TILE_SIZE/2;
+    Point ahead = {p.x + PREFETCH_AHEAD*v.x, p.y + PREFETCH_AHEAD*v.y};
+    Rect span = {
+        {fminf(p.x, ahead.x) - reach, fminf(p.y, ahead.y) - reach},
+        {fabsf(ahead.x - p.x) + 2*reach, fabsf(ahead.y - p.y) + 2*reach}
+    };
+    canvasPrefetch(r->doc->canvas, span, PREFETCH_TILES);
+}
+
+int rasterPaint(Document * doc, Stroke * stroke, const Brush * brush, InputEvent e)
+{
+    DabTarget target = {doc, 0};
+    switch(e.type) {
+    case INPUT_STROKE_BEGIN:
+        historyBegin(doc->history);
+        strokeBegin(stroke, brush, e.position, e.time, placeDab, &target);
+        break;
+    case INPUT_STROKE_MOVE:
+        strokeAdd(stroke, e.position, e.time, placeDab, &target);
+        break;
+    case INPUT_STROKE_END:
+        strokeEnd(stroke, e.position, e.time, placeDab, &target);
+        historyEnd(doc->history);
+        break;
+    }
+    return target.dabs;
+}
+
+static void paintEvent(Raster * r, InputEvent e)
+{
+    TRACE_SCOPE("rasterise");
+    rasterPaint(r->doc, &r->stroke, &r->brush, e);
+    if(e.type == INPUT_STROKE_MOVE)
+        prefetchAhead(r);
+}
+
+static void * rasterMain(void * arg)
+{
+    Raster * r = arg;
+    TRACE_THREAD("raster");
+    for(;;) {
+        unsigned head = atomic_load_explicit(&r->head, memory_order_relaxed);
+        if(head != atomic_load_explicit(&r->tail, memory_order_acquire)) {
+            double start = statsNow();
+            paintEvent(r, r->events[head % QUEUE_SIZE]);
+            statsRecord(STAGE_RASTER, statsNow() - start);
+            atomic_store_explicit(&r->head, head + 1, memory_order_release);
+            continue;
+        }
+
+        pthread_mutex_lock(&r->lock);
+        atomic_store(&r->sleeping, true);
+        while(atomic_load(&r->head) == atomic_load(&r->tail) && !atomic_load(&r->stopping))
+            pthread_cond_wait(&r->wake, &r->lock);
+        atomic_store(&r->sleeping, false);
+        bool done = atomic_load(&r->stopping) && atomic_load(&r->head) == atomic_load(&r->tail);
+        pthread_mutex_unlock(&r->lock);
+        if(done)
+            return NULL;
+    }
+}
+
+Raster * rasterCreate(Document * doc, Brush brush)
+{
+    Raster * r = calloc(1, sizeof(Raster));
+    r->doc = doc;
+    r->brush = brush;
+    atomic_init(&r->head, 0);
+    atomic_init(&r->tail, 0);
+    atomic_init(&r->sleeping, false);
+    atomic_init(&r->stopping, false);
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->wake, NULL);
+    pthread_create(&r->thread, NULL, rasterMain, r);
+    return r;
+}
+
+static void wakeRaster(Raster * r)
+{
+    pthread_mutex_lock(&r->lock);
+    pthread_cond_signal(&r->wake);
+    pthread_mutex_unlock(&r->lock);
+}
+
+void rasterDestroy(Raster * r)
+{
+    if(!r)
+        return;
+    atomic_store(&r->stopping, true);
+    wakeRaster(r);
+    pthread_join(r->thread, NULL);
+    pthread_cond_destroy(&r->wake);
+    pthread_mutex_destroy(&r->lock);
+    free(r);
+}
+
+void rasterPush(Raster * r, InputEvent e)
+{
+    unsigned tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+
+    // a full queue means the brush is far behind; wait rather than drop
+    struct timespec nap = {0, 100000};
+    while(tail - atomic_load_explicit(&r->head, memory_order_acquire) == QUEUE_SIZE)
+        nanosleep(&nap, NULL);
+
+    r->events[tail % QUEUE_SIZE] = e;
+    atomic_store(&r->tail, tail + 1);
+    if(atomic_load(&r->sleeping))
+        wakeRaster(r);
+}
+
+void rasterSync(Raster * r)
+{
+    struct timespec nap = {0, 100000};
+    while(atomic_load(&r->head) != atomic_load(&r->tail))
+        nanosleep(&nap, NULL);
+}
+
+void rasterSetBrush(Raster * r, Brush brush)
+{
+    rasterSync(r);
+    r->brush = brush;
+}
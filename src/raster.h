@@ -0,0 +1,48 @@
+#ifndef DAPPER_RASTER_H
+#define DAPPER_RASTER_H
+
+#include "document.h"
+#include "stroke.h"
+
+enum InputEventType {
+    INPUT_STROKE_BEGIN,
+    INPUT_STROKE_MOVE,
+    INPUT_STROKE_END
+};
+typedef enum InputEventType InputEventType;
+
+// Positions are unrounded canvas coordinates, times come from glfwGetTime
+// at the moment the callback ran.
+struct InputEvent {
+    InputEventType type;
+    Point position;
+    double time;
+};
+typedef struct InputEvent InputEvent;
+
+typedef struct Raster Raster;
+
+// Owns a thread that turns stroke events into pixels. The GLFW callbacks
+// push events into a lock-free single producer/single consumer queue and
+// return at once; the render thread picks up the result through the
+// canvas dirty versions. While strokes are queued the raster thread is the
+// only writer to the document.
+Raster * rasterCreate(Document * doc, Brush brush);
+void rasterDestroy(Raster * r);
+
+// Producer side; call from one thread only.
+void rasterPush(Raster * r, InputEvent e);
+
+// Blocks until every pushed event has been painted. Anything else that
+// writes to the document (undo, filters, selection edits) syncs first.
+void rasterSync(Raster * r);
+
+// Changes the brush for strokes pushed from now on.
+void rasterSetBrush(Raster * r, Brush brush);
+
+// Paints one event on the calling thread, for callers that own the
+// document outright and want no raster thread. stroke carries the open
+// stroke from one event to the next. Returns the number of dabs placed.
+int rasterPaint(Document * doc, Stroke * stroke, const Brush * brush, InputEvent e);
+
+#endif
@@ -0,0 +1,243 @@
+#include <stdlib.h>
+#include <string.h>
+#include "export.h"
+#include "memory.h"
+#include "readback.h"
+
+#define SLOT_COUNT 8
+#define READS_PER_FRAME 8
+
+struct Request {
+    int * tiles;
+    int count, next, remaining;
+    ReadbackFunc fn;
+    ReadbackDoneFunc done;
+    void * ctx;
+    struct Request * nextRequest;
+};
+typedef struct Request Request;
+
+struct Slot {
+    GLuint pbo;
+    GLsync fence;
+    int tx, ty;
+    Request * request;
+};
+typedef struct Slot Slot;
+
+struct Readback {
+    Canvas * canvas;
+    GpuPainter * painter;
+    uint8_t * packed;
+    GLuint fbo;
+    Slot slots[SLOT_COUNT];
+    int slotHead, slotsInFlight;
+    Request * requests;
+    Request * lastRequest;
+};
+
+Readback * readbackCreate(GLuint canvasTex, GpuPainter * painter, Canvas * canvas)
+{
+    Readback * rb = calloc(1, sizeof(Readback));
+    rb->canvas = canvas;
+    rb->painter = painter;
+    rb->packed = malloc(TILE_PIXELS*4);
+
+    GLint previousFbo;
+    glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &previousFbo);
+    glGenFramebuffers(1, &rb->fbo);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, rb->fbo);
+    glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, canvasTex, 0);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, previousFbo);
+
+    for(int i = 0; i < SLOT_COUNT; ++i) {
+        glGenBuffers(1, &rb->slots[i].pbo);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, rb->slots[i].pbo);
+        glBufferData(GL_PIXEL_PACK_BUFFER, TILE_PIXELS*4, NULL, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    memoryCharge(SUBSYSTEM_READBACK, 0, SLOT_COUNT*TILE_PIXELS*4, 0);
+    return rb;
+}
+
+static void freeRequest(Request * r)
+{
+    free(r->tiles);
+    free(r);
+}
+
+void readbackDestroy(Readback * rb)
+{
+    if(!rb)
+        return;
+    for(int i = 0; i < SLOT_COUNT; ++i) {
+        if(rb->slots[i].fence)
+            glDeleteSync(rb->slots[i].fence);
+        glDeleteBuffers(1, &rb->slots[i].pbo);
+    }
+    while(rb->requests) {
+        Request * r = rb->requests;
+        rb->requests = r->nextRequest;
+        freeRequest(r);
+    }
+    glDeleteFramebuffers(1, &rb->fbo);
+    memoryCharge(SUBSYSTEM_READBACK, 0, -SLOT_COUNT*TILE_PIXELS*4, 0);
+    free(rb->packed);
+    free(rb);
+}
+
+void readbackRequest(Readback * rb, const int * tiles, int count, ReadbackFunc fn, ReadbackDoneFunc done, void * ctx)
+{
+    const Canvas * c = rb->canvas;
+    Request * r = calloc(1, sizeof(Request));
+    if(!tiles)
+        count = c->tilesX*c->tilesY;
+    r->tiles = malloc(sizeof(int)*(count ? count : 1));
+    for(int i = 0; i < count; ++i)
+        r->tiles[i] = tiles ? tiles[i] : i;
+    r->count = r->remaining = count;
+    r->fn = fn;
+    r->done = done;
+    r->ctx = ctx;
+
+    if(count == 0) {
+        if(done)
+            done(ctx);
+        freeRequest(r);
+        return;
+    }
+
+    if(rb->lastRequest)
+        rb->lastRequest->nextRequest = r;
+    else
+        rb->requests = r;
+    rb->lastRequest = r;
+}
+
+static void finishRequest(Readback * rb, Request * r)
+{
+    Request ** link = &rb->requests;
+    Request * previous = NULL;
+    while(*link != r) {
+        previous = *link;
+        link = &(*link)->nextRequest;
+    }
+    *link = r->nextRequest;
+    if(rb->lastRequest == r)
+        rb->lastRequest = previous;
+
+    if(r->done)
+        r->done(r->ctx);
+    freeRequest(r);
+}
+
+// Slots complete in the order they were issued, so only the oldest needs
+// polling.
+static void deliver(Readback * rb)
+{
+    while(rb->slotsInFlight) {
+        Slot * s = &rb->slots[rb->slotHead];
+        GLenum state = glClientWaitSync(s->fence, 0, 0);
+        if(state != GL_ALREADY_SIGNALED && state != GL_CONDITION_SATISFIED)
+            return;
+
+        glDeleteSync(s->fence);
+        s->fence = NULL;
+
+        int w = canvasTileWidth(rb->canvas, s->tx);
+        int h = canvasTileHeight(rb->canvas, s->ty);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, s->pbo);
+        const uint8_t * pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, w*h*4, GL_MAP_READ_BIT);
+        if(pixels)
+            s->request->fn(s->tx, s->ty, pixels, w*4, s->request->ctx);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        rb->slotHead = (rb->slotHead + 1) % SLOT_COUNT;
+        --rb->slotsInFlight;
+        if(--s->request->remaining == 0)
+            finishRequest(rb, s->request);
+    }
+}
+
+// A tile only the CPU canvas has is packed there and then, as 8-bit RGB
+// widened in place to the RGBA a mapped buffer would hold.
+static void packTile(Readback * rb, Request * r, int tx, int ty)
+{
+    const Canvas * c = rb->canvas;
+    int w = canvasTileWidth(c, tx);
+    int h = canvasTileHeight(c, ty);
+    uint8_t * p = rb->packed;
+    exportPackTile(rb->canvas, tx, ty, p, w*4);
+    for(int y = 0; y < h; ++y) {
+        uint8_t * row = &p[y*w*4];
+        for(int x = w - 1; x >= 0; --x) {
+            row[x*4 + 3] = 255;
+            row[x*4 + 2] = row[x*3 + 2];
+            row[x*4 + 1] = row[x*3 + 1];
+            row[x*4 + 0] = row[x*3 + 0];
+        }
+    }
+    r->fn(tx, ty, p, w*4, r->ctx);
+    if(--r->remaining == 0)
+        finishRequest(rb, r);
+}
+
+static Request * nextPending(Readback * rb)
+{
+    for(Request * r = rb->requests; r; r = r->nextRequest)
+        if(r->next < r->count)
+            return r;
+    return NULL;
+}
+
+static void issue(Readback * rb)
+{
+    const Canvas * c = rb->canvas;
+    Request * r = nextPending(rb);
+    if(!r)
+        return;
+
+    GLint previousFbo;
+    glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &previousFbo);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, rb->fbo);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+
+    for(int started = 0; r && started < READS_PER_FRAME && rb->slotsInFlight < SLOT_COUNT; ++started) {
+        Request * current = r;
+        int i = r->tiles[r->next++];
+        int tx = i % c->tilesX, ty = i / c->tilesX;
+        if(r->next == r->count)
+            r = nextPending(rb);
+
+        if(!rb->painter || !gpuPainterHolds(rb->painter, tx, ty)) {
+            packTile(rb, current, tx, ty);
+            continue;
+        }
+
+        Slot * s = &rb->slots[(rb->slotHead + rb->slotsInFlight) % SLOT_COUNT];
+        s->tx = tx;
+        s->ty = ty;
+        s->request = current;
+        Rect t = canvasTileRect(c, tx, ty);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, s->pbo);
+        glReadPixels(t.origin.x, t.origin.y, t.size.width, t.size.height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+        s->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        ++rb->slotsInFlight;
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, previousFbo);
+}
+
+void readbackPump(Readback * rb)
+{
+    deliver(rb);
+    issue(rb);
+}
+
+bool readbackBusy(const Readback * rb)
+{
+    return rb->requests != NULL;
+}
@@ -0,0 +1,38 @@
+#ifndef DAPPER_READBACK_H
+#define DAPPER_READBACK_H
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "canvas.h"
+#include "gpupaint.h"
+
+// rgba points at the tile's pixels, stride bytes apart, valid only during
+// the call.
+typedef void (*ReadbackFunc)(int tx, int ty, const uint8_t * rgba, int stride, void * ctx);
+typedef void (*ReadbackDoneFunc)(void * ctx);
+
+typedef struct Readback Readback;
+
+// Reads the displayed canvas back to the CPU without stalling the frame.
+// Tiles the painter's texture holds are read into one of a small ring of
+// pixel buffer objects and fenced; a later frame maps each once its fence
+// has signalled. That way this sees GPU brush strokes the CPU canvas has
+// not caught up with. Every other tile is packed from the CPU canvas into
+// the same 8-bit RGBA when its turn comes. Only a few tiles are started
+// per frame, so a full-canvas read spreads over many frames while drawing
+// carries on. painter may be NULL. GL thread only.
+Readback * readbackCreate(GLuint canvasTex, GpuPainter * painter, Canvas * canvas);
+void readbackDestroy(Readback * rb);
+
+// tiles lists tile indices (ty*tilesX + tx); NULL with count < 0 means all.
+void readbackRequest(Readback * rb, const int * tiles, int count, ReadbackFunc fn, ReadbackDoneFunc done, void * ctx);
+
+// Delivers finished tiles and starts new reads. Call once per frame after
+// the frame's uploads and GPU painting have been issued.
+void readbackPump(Readback * rb);
+
+bool readbackBusy(const Readback * rb);
+
+#endif
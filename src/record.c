@@ -0,0 +1,368 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <stdatomic.h>
+#include "record.h"
+#include "stats.h"
+
+#define RECORD_MAGIC "DPR3"
+#define HEADER_BYTES 72
+#define POSITION_SCALE 16.0
+#define TIME_SCALE 1e6
+#define FLUSH_BYTES 65536
+// Time a fast replay spends delivering events before letting a frame draw.
+#define FAST_SLICE 0.010
+
+struct Recorder {
+    FILE * file;
+    Pool * pool;
+    PoolGroup * group;
+    uint8_t * buffer;
+    size_t length, capacity;
+    // the buffer the pool is writing out
+    uint8_t * writing;
+    size_t writingLength, writingCapacity;
+    atomic_bool busy;
+    double start;
+    long long lastTime;
+    long lastX, lastY;
+    atomic_bool failed;
+};
+
+struct Player {
+    uint8_t * data;
+    size_t length, offset;
+    double start, pausedAt;
+    bool started, paused;
+    long long time;
+    long x, y;
+};
+
+static void put32(uint8_t * p, uint32_t v)
+{
+    for(int i = 0; i < 4; ++i)
+        p[i] = v >> 8*i;
+}
+
+static uint32_t get32(const uint8_t * p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void putFloat(uint8_t * p, float f)
+{
+    uint32_t v;
+    memcpy(&v, &f, sizeof(v));
+    put32(p, v);
+}
+
+static float getFloat(const uint8_t * p)
+{
+    uint32_t v = get32(p);
+    float f;
+    memcpy(&f, &v, sizeof(f));
+    return f;
+}
+
+static void encodeState(uint8_t * p, const RecordState * s)
+{
+    memcpy(p, RECORD_MAGIC, 4);
+    put32(&p[4], s->width);
+    put32(&p[8], s->height);
+    put32(&p[12], s->tool | (s->gpuPainting ? 0x100 : 0) | (s->minimapShown ? 0x200 : 0)
+        | (s->vectorPainting ? 0x400 : 0));
+    putFloat(&p[16], s->scale);
+    putFloat(&p[20], s->origin.x);
+    putFloat(&p[24], s->origin.y);
+    putFloat(&p[28], s->brush.size);
+    putFloat(&p[32], s->brush.spacing);
+    putFloat(&p[36], s->brush.color.r);
+    putFloat(&p[40], s->brush.color.g);
+    putFloat(&p[44], s->brush.color.b);
+    putFloat(&p[48], s->minimap.origin.x);
+    putFloat(&p[52], s->minimap.origin.y);
+    putFloat(&p[56], s->minimap.size.width);
+    putFloat(&p[60], s->minimap.size.height);
+    put32(&p[64], s->windowWidth);
+    put32(&p[68], s->windowHeight);
+}
+
+static void decodeState(const uint8_t * p, RecordState * s)
+{
+    s->width = get32(&p[4]);
+    s->height = get32(&p[8]);
+    uint32_t tool = get32(&p[12]);
+    s->tool = tool & 0xff;
+    s->gpuPainting = tool & 0x100;
+    s->minimapShown = tool & 0x200;
+    s->vectorPainting = tool & 0x400;
+    s->scale = getFloat(&p[16]);
+    s->origin = (Point){getFloat(&p[20]), getFloat(&p[24])};
+    s->brush.size = getFloat(&p[28]);
+    s->brush.spacing = getFloat(&p[32]);
+    s->brush.color = (Color){getFloat(&p[36]), getFloat(&p[40]), getFloat(&p[44]), 1.0f};
+    s->minimap = (Rect){{getFloat(&p[48]), getFloat(&p[52])}, {getFloat(&p[56]), getFloat(&p[60])}};
+    s->windowWidth = get32(&p[64]);
+    s->windowHeight = get32(&p[68]);
+}
+
+Recorder * recorderStart(const char * path, const RecordState * state, Pool * pool, double now)
+{
+    FILE * file = fopen(path, "wb");
+    if(!file)
+        return NULL;
+    uint8_t header[HEADER_BYTES];
+    encodeState(header, state);
+    if(fwrite(header, 1, HEADER_BYTES, file) != HEADER_BYTES) {
+        fclose(file);
+        return NULL;
+    }
+
+    Recorder * r = calloc(1, sizeof(Recorder));
+    r->file = file;
+    r->pool = pool;
+    r->group = poolGroupCreate();
+    r->capacity = r->writingCapacity = FLUSH_BYTES;
+    r->buffer = malloc(r->capacity);
+    r->writing = malloc(r->writingCapacity);
+    atomic_init(&r->busy, false);
+    atomic_init(&r->failed, false);
+    r->start = now;
+    return r;
+}
+
+static void putVarint(Recorder * r, unsigned long long v)
+{
+    do {
+        uint8_t b = v & 0x7f;
+        v >>= 7;
+        r->buffer[r->length++] = b | (v ? 0x80 : 0);
+    } while(v);
+}
+
+// Zigzag, so small negative deltas stay small.
+static void putSigned(Recorder * r, long v)
+{
+    putVarint(r, v < 0 ? ((unsigned long long)-(v + 1) << 1) | 1 : (unsigned long long)v << 1);
+}
+
+void recorderAdd(Recorder * r, RecordEvent e)
+{
+    // an event is at most a tag, three varints of ten bytes and a mods byte
+    if(r->capacity - r->length < 32) {
+        r->capacity *= 2;
+        r->buffer = realloc(r->buffer, r->capacity);
+    }
+
+    long long time = llround((e.time - r->start)*TIME_SCALE);
+    long long dt = time > r->lastTime ? time - r->lastTime : 0;
+    r->lastTime += dt;
+
+    switch(e.type) {
+    case RECORD_KEY:
+        r->buffer[r->length++] = RECORD_KEY | (e.action & 3) << 2;
+        putVarint(r, dt);
+        putVarint(r, e.code < 0 ? 0 : e.code);
+        r->buffer[r->length++] = e.mods;
+        return;
+    case RECORD_BUTTON:
+        r->buffer[r->length++] = RECORD_BUTTON | (e.action & 3) << 2 | (e.code & 7) << 4;
+        putVarint(r, dt);
+        r->buffer[r->length++] = e.mods;
+        break;
+    case RECORD_MOVE:
+        r->buffer[r->length++] = RECORD_MOVE;
+        putVarint(r, dt);
+        break;
+    }
+    long x = lround(e.x*POSITION_SCALE), y = lround(e.y*POSITION_SCALE);
+    putSigned(r, x - r->lastX);
+    putSigned(r, y - r->lastY);
+    r->lastX = x;
+    r->lastY = y;
+}
+
+static void writeJob(void * arg)
+{
+    Recorder * r = arg;
+    if(fwrite(r->writing, 1, r->writingLength, r->file) != r->writingLength)
+        atomic_store(&r->failed, true);
+    atomic_store(&r->busy, false);
+}
+
+static void swapBuffers(Recorder * r)
+{
+    uint8_t * buffer = r->writing;
+    size_t capacity = r->writingCapacity;
+    r->writing = r->buffer;
+    r->writingLength = r->length;
+    r->writingCapacity = r->capacity;
+    r->buffer = buffer;
+    r->capacity = capacity;
+    r->length = 0;
+}
+
+void recorderFlush(Recorder * r)
+{
+    if(!r || !r->length || atomic_load(&r->busy))
+        return;
+    swapBuffers(r);
+    atomic_store(&r->busy, true);
+    poolSubmitGroup(r->pool, r->group, writeJob, r);
+}
+
+bool recorderStop(Recorder * r)
+{
+    if(!r)
+        return false;
+    poolGroupWait(r->group);
+    poolGroupDestroy(r->group);
+    if(r->length) {
+        swapBuffers(r);
+        writeJob(r);
+    }
+    bool ok = !atomic_load(&r->failed) && fclose(r->file) == 0;
+    free(r->buffer);
+    free(r->writing);
+    free(r);
+    return ok;
+}
+
+Player * playerOpen(const char * path, RecordState * state)
+{
+    FILE * file = fopen(path, "rb");
+    if(!file)
+        return NULL;
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    uint8_t * data = length >= HEADER_BYTES ? malloc(length) : NULL;
+    bool valid = data && fread(data, 1, length, file) == (size_t)length && memcmp(data, RECORD_MAGIC, 4) == 0;
+    fclose(file);
+    if(!valid) {
+        free(data);
+        return NULL;
+    }
+
+    decodeState(data, state);
+    Player * p = calloc(1, sizeof(Player));
+    p->data = data;
+    p->length = length;
+    p->offset = HEADER_BYTES;
+    return p;
+}
+
+void playerClose(Player * p)
+{
+    if(!p)
+        return;
+    free(p->data);
+    free(p);
+}
+
+// False when the recording ends partway through the value, which is how
+// a recording cut short by a crash ends.
+static bool getVarint(Player * p, unsigned long long * v)
+{
+    *v = 0;
+    for(int shift = 0; p->offset < p->length && shift < 64; shift += 7) {
+        uint8_t b = p->data[p->offset++];
+        *v |= (unsigned long long)(b & 0x7f) << shift;
+        if(!(b & 0x80))
+            return true;
+    }
+    return false;
+}
+
+static bool getSigned(Player * p, long * v)
+{
+    unsigned long long u;
+    if(!getVarint(p, &u))
+        return false;
+    *v = u & 1 ? -(long)(u >> 1) - 1 : (long)(u >> 1);
+    return true;
+}
+
+static bool getByte(Player * p, int * v)
+{
+    if(p->offset >= p->length)
+        return false;
+    *v = p->data[p->offset++];
+    return true;
+}
+
+// Decodes the next event without consuming it.
+static bool peek(Player * p, RecordEvent * e, size_t * next)
+{
+    size_t offset = p->offset;
+    int tag = 0, mods = 0;
+    unsigned long long dt, code = 0;
+    long dx = 0, dy = 0;
+    bool ok = getByte(p, &tag) && getVarint(p, &dt);
+
+    RecordType type = tag & 3;
+    if(ok && type == RECORD_KEY)
+        ok = getVarint(p, &code) && getByte(p, &mods);
+    else if(ok && type == RECORD_BUTTON)
+        ok = getByte(p, &mods);
+    if(ok && type != RECORD_KEY)
+        ok = getSigned(p, &dx) && getSigned(p, &dy);
+
+    *next = p->offset;
+    p->offset = offset;
+    if(!ok || type > RECORD_MOVE)
+        return false;
+
+    *e = (RecordEvent){
+        type, (p->time + (long long)dt)/TIME_SCALE,
+        type == RECORD_BUTTON ? (tag >> 4) & 7 : (int)code, (tag >> 2) & 3, mods,
+        (p->x + dx)/POSITION_SCALE, (p->y + dy)/POSITION_SCALE
+    };
+    return true;
+}
+
+bool playerStep(Player * p, double now, bool fast, RecordFunc fn, void * ctx)
+{
+    if(!p->started) {
+        p->start = now;
+        p->started = true;
+    }
+
+    double sliceEnd = statsNow() + FAST_SLICE;
+    RecordEvent e;
+    size_t next;
+    while(peek(p, &e, &next)) {
+        if(p->paused)
+            return true;
+        if(fast ? statsNow() > sliceEnd : p->start + e.time > now)
+            return true;
+        p->offset = next;
+        p->time = llround(e.time*TIME_SCALE);
+        if(e.type != RECORD_KEY) {
+            p->x = lround(e.x*POSITION_SCALE);
+            p->y = lround(e.y*POSITION_SCALE);
+        }
+        e.time += p->start;
+        fn(&e, ctx);
+    }
+    return false;
+}
+
+void playerPause(Player * p, double now)
+{
+    if(p->paused)
+        return;
+    p->paused = true;
+    p->pausedAt = now;
+}
+
+void playerResume(Player * p, double now)
+{
+    if(!p->paused)
+        return;
+    p->paused = false;
+    p->start += now - p->pausedAt;
+}
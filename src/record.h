@@ -0,0 +1,89 @@
+#ifndef DAPPER_RECORD_H
+#define DAPPER_RECORD_H
+
+#include <stdbool.h>
+#include "geometry.h"
+#include "pool.h"
+#include "stroke.h"
+
+enum RecordType {
+    RECORD_KEY,
+    RECORD_BUTTON,
+    RECORD_MOVE
+};
+typedef enum RecordType RecordType;
+
+// One input callback. code is the key or mouse button; x and y are the
+// cursor position in window coordinates, kept to 1/16 pixel.
+struct RecordEvent {
+    RecordType type;
+    double time;
+    int code, action, mods;
+    double x, y;
+};
+typedef struct RecordEvent RecordEvent;
+
+// The tools a session can switch between.
+enum Tool {
+    TOOL_BRUSH,
+    TOOL_RECT_SELECT,
+    TOOL_LASSO_SELECT
+};
+typedef enum Tool Tool;
+
+// The session state a recording starts from, so replay can begin where the
+// recorded session did.
+struct RecordState {
+    int width, height;
+    int tool;
+    bool gpuPainting;
+    // strokes made with no selection go to the vector layer
+    bool vectorPainting;
+    Brush brush;
+    float scale;
+    Point origin;
+    // a press on the minimap navigates instead of painting, so replay has
+    // to know where it was
+    int windowWidth, windowHeight;
+    bool minimapShown;
+    Rect minimap;
+};
+typedef struct RecordState RecordState;
+
+typedef void (*RecordFunc)(const RecordEvent * e, void * ctx);
+
+typedef struct Recorder Recorder;
+typedef struct Player Player;
+
+// Input recording. Each event is appended to a memory buffer as a tag byte,
+// a varint time delta in microseconds and a varint payload, with positions
+// stored as deltas from the previous one: a pointer move is usually three
+// or four bytes, and nothing on the input path touches the file.
+// recorderFlush hands what has built up to a pool job that writes it, and
+// recording goes on into a second buffer meanwhile; while a write is still
+// running it leaves the buffer to grow until the next call.
+Recorder * recorderStart(const char * path, const RecordState * state, Pool * pool, double now);
+void recorderAdd(Recorder * r, RecordEvent e);
+void recorderFlush(Recorder * r);
+// Waits for the write in flight, flushes and closes; false if anything
+// failed to write.
+bool recorderStop(Recorder * r);
+
+// Reads a recording and the state it starts from. Returns NULL when the
+// file is missing or not a recording.
+Player * playerOpen(const char * path, RecordState * state);
+void playerClose(Player * p);
+
+// Calls fn for the events that are due, with their times shifted so the
+// first call to playerStep is the start of the recording. In real time
+// that is every event up to now; fast ignores the recorded pacing and
+// delivers events until a frame's worth of time has been spent. Returns
+// false once every event has been delivered.
+bool playerStep(Player * p, double now, bool fast, RecordFunc fn, void * ctx);
+// Holds back the events after the one being delivered until playerResume,
+// which moves the rest of the recording later by the time spent held. For
+// input that has to wait on work the event before it started.
+void playerPause(Player * p, double now);
+void playerResume(Player * p, double now);
+
+#endif
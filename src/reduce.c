@@ -0,0 +1,94 @@
+#include <stdlib.h>
+#include "glformat.h"
+#include "program.h"
+#include "reduce.h"
+
+#define GLSL(src) "#version 150 core\n" #src
+
+// One quad over the viewport, which covers the target texels.
+static const GLchar * reduceVertexSource = GLSL(
+    void main() {
+        vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+        gl_Position = vec4(2.0*corner - 1.0, 0.0, 1.0);
+    }
+);
+
+static const GLchar * reduceFragmentSource = GLSL(
+    out vec4 outColor;
+    uniform sampler2D source;
+    uniform ivec2 origin;
+    uniform ivec2 size;
+    uniform ivec2 target;
+    uniform int step;
+
+    void main() {
+        ivec2 from = origin + (ivec2(gl_FragCoord.xy) - target)*step;
+        ivec2 to = min(from + step, origin + size);
+        vec4 sum = vec4(0.0);
+        for(int y = from.y; y < to.y; ++y) {
+            for(int x = from.x; x < to.x; ++x)
+                sum += texelFetch(source, ivec2(x, y), 0);
+        }
+        outColor = sum/float((to.x - from.x)*(to.y - from.y));
+    }
+);
+
+struct Reducer {
+    CanvasFormat format;
+    GLuint program, vao;
+    GLint originLoc, sizeLoc, targetLoc, stepLoc;
+};
+
+Reducer * reducerCreate(CanvasFormat format)
+{
+    Reducer * r = calloc(1, sizeof(Reducer));
+    r->format = format;
+    r->program = programBuild(reduceVertexSource, reduceFragmentSource);
+    r->originLoc = glGetUniformLocation(r->program, "origin");
+    r->sizeLoc = glGetUniformLocation(r->program, "size");
+    r->targetLoc = glGetUniformLocation(r->program, "target");
+    r->stepLoc = glGetUniformLocation(r->program, "step");
+    // the quad comes from gl_VertexID, but a core context still wants a
+    // vertex array bound to draw
+    glGenVertexArrays(1, &r->vao);
+    return r;
+}
+
+void reducerDestroy(Reducer * r)
+{
+    if(!r)
+        return;
+    glDeleteVertexArrays(1, &r->vao);
+    glDeleteProgram(r->program);
+    free(r);
+}
+
+void reducerDraw(Reducer * r, GLuint source, Rect t, int level, int x, int y)
+{
+    int step = 1 << level;
+    int w = ((int)t.size.width + step - 1)/step;
+    int h = ((int)t.size.height + step - 1)/step;
+
+    GLint previousProgram, previousVao, previousTexture, viewport[4];
+    glGetIntegerv(GL_CURRENT_PROGRAM, &previousProgram);
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previousVao);
+    glGetIntegerv(GL_TEXTURE_BINDING_2D, &previousTexture);
+    glGetIntegerv(GL_VIEWPORT, viewport);
+
+    glViewport(x, y, w, h);
+    glUseProgram(r->program);
+    glUniform2i(r->originLoc, t.origin.x, t.origin.y);
+    glUniform2i(r->sizeLoc, t.size.width, t.size.height);
+    glUniform2i(r->targetLoc, x, y);
+    glUniform1i(r->stepLoc, step);
+    glBindTexture(GL_TEXTURE_2D, source);
+    glBindVertexArray(r->vao);
+    canvasLinearBegin(r->format);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    canvasLinearEnd(r->format);
+
+    glBindTexture(GL_TEXTURE_2D, previousTexture);
+    glBindVertexArray(previousVao);
+    glUseProgram(previousProgram);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+}
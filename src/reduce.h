@@ -0,0 +1,22 @@
+#ifndef DAPPER_REDUCE_H
+#define DAPPER_REDUCE_H
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+#include "canvas.h"
+
+typedef struct Reducer Reducer;
+
+// Shrinks canvas tiles whose pixels only exist in a texture with the box
+// filter canvasDownsampleTile applies on the CPU: a shader averages every
+// source texel of a 2^level block into one target texel, edge blocks only
+// over the texels they have. Levels built from either side then look the
+// same. GL thread only.
+Reducer * reducerCreate(CanvasFormat format);
+void reducerDestroy(Reducer * r);
+
+// Draws canvas rect t of source, shrunk by 2^level, with its corner at
+// (x, y) of the bound draw framebuffer.
+void reducerDraw(Reducer * r, GLuint source, Rect t, int level, int x, int y);
+
+#endif
@@ -0,0 +1,409 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "glformat.h"
+#include "memory.h"
+#include "program.h"
+#include "reduce.h"
+#include "residency.h"
+
+#define GLSL(src) "#version 150 core\n" #src
+
+// Past this a slot would cover more than one canvas tile per texel.
+#define MAX_LEVELS 8
+// Canvas tiles read per frame to fill slots; at least one slot is always
+// filled so coarse levels still make progress.
+#define FILL_BUDGET 256
+#define VERTEX_FLOATS 5
+
+static const GLchar * slotVertexSource = GLSL(
+    uniform mat4 projection;
+    uniform mat4 transform;
+    in vec2 position;
+    in vec3 texcoord;
+    out vec3 Texcoord;
+
+    void main() {
+        Texcoord = texcoord;
+        gl_Position = projection*transform*vec4(position, 0.0, 1.0);
+    }
+);
+
+static const GLchar * slotFragmentSource = GLSL(
+    in vec3 Texcoord;
+    out vec4 outColor;
+    uniform sampler2DArray slots;
+
+    void main() {
+        outColor = texture(slots, Texcoord);
+    }
+);
+
+struct Slot {
+    int level, kx, ky;
+    unsigned lastUsed;
+    bool stale;
+};
+typedef struct Slot Slot;
+
+struct Residency {
+    Canvas * canvas;
+    GLuint mirrorTex;
+    GLuint texture, program, vao, vbo, drawFbo;
+    Reducer * reducer;
+    GLint projectionLoc, transformLoc;
+
+    Slot * slots;
+    int slotCount, slotsUsed;
+    int levels;
+    int levelWidth[MAX_LEVELS], levelHeight[MAX_LEVELS];
+    int * slotOf[MAX_LEVELS];
+    uint8_t * gpuOnly;
+
+    int level;
+    Rect view;
+    unsigned frame;
+    float * scratch;
+    void * encoded;
+    GLfloat * vertices;
+    int vertexCapacity;
+};
+
+static long long textureBytes(const Residency * r)
+{
+    return (long long)TILE_PIXELS*canvasTexelBytes(canvasTextureFormat(r->canvas->format))*r->slotCount;
+}
+
+Residency * residencyCreate(Canvas * canvas, GLuint mirrorTex, int slots)
+{
+    Residency * r = calloc(1, sizeof(Residency));
+    r->canvas = canvas;
+    r->mirrorTex = mirrorTex;
+
+    GLint maxLayers;
+    glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+    r->slotCount = slots < maxLayers ? slots : maxLayers;
+    r->slots = calloc(r->slotCount, sizeof(Slot));
+
+    int tiles = canvas->tilesX > canvas->tilesY ? canvas->tilesX : canvas->tilesY;
+    r->levels = 1;
+    while(r->levels < MAX_LEVELS && (1 << (r->levels - 1)) < tiles)
+        ++r->levels;
+    for(int l = 0; l < r->levels; ++l) {
+        r->levelWidth[l] = (canvas->tilesX + (1 << l) - 1) >> l;
+        r->levelHeight[l] = (canvas->tilesY + (1 << l) - 1) >> l;
+        r->slotOf[l] = malloc(sizeof(int)*r->levelWidth[l]*r->levelHeight[l]);
+        for(int i = 0; i < r->levelWidth[l]*r->levelHeight[l]; ++i)
+            r->slotOf[l][i] = -1;
+    }
+    r->gpuOnly = calloc(canvas->tilesX*canvas->tilesY, 1);
+    r->scratch = malloc(TILE_BYTES);
+    r->encoded = malloc(canvas->storedBytes);
+
+    glGenTextures(1, &r->texture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, r->texture);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, canvasTextureFormat(canvas->format), TILE_SIZE, TILE_SIZE, r->slotCount, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    memoryCharge(SUBSYSTEM_TEXTURES, 0, textureBytes(r), 0);
+
+    glGenFramebuffers(1, &r->drawFbo);
+    if(mirrorTex)
+        r->reducer = reducerCreate(canvas->format);
+
+    r->program = programBuild(slotVertexSource, slotFragmentSource);
+    r->projectionLoc = glGetUniformLocation(r->program, "projection");
+    r->transformLoc = glGetUniformLocation(r->program, "transform");
+
+    GLint previousVao;
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previousVao);
+    glGenVertexArrays(1, &r->vao);
+    glBindVertexArray(r->vao);
+    glGenBuffers(1, &r->vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, r->vbo);
+    GLint posAttrib = glGetAttribLocation(r->program, "position");
+    glEnableVertexAttribArray(posAttrib);
+    glVertexAttribPointer(posAttrib, 2, GL_FLOAT, GL_FALSE, VERTEX_FLOATS * sizeof(GLfloat), 0);
+    GLint texAttrib = glGetAttribLocation(r->program, "texcoord");
+    glEnableVertexAttribArray(texAttrib);
+    glVertexAttribPointer(texAttrib, 3, GL_FLOAT, GL_FALSE, VERTEX_FLOATS * sizeof(GLfloat), (void*)(2 * sizeof(GLfloat)));
+    glBindVertexArray(previousVao);
+
+    return r;
+}
+
+void residencyDestroy(Residency * r)
+{
+    if(!r)
+        return;
+    glDeleteBuffers(1, &r->vbo);
+    glDeleteVertexArrays(1, &r->vao);
+    glDeleteProgram(r->program);
+    glDeleteFramebuffers(1, &r->drawFbo);
+    reducerDestroy(r->reducer);
+    glDeleteTextures(1, &r->texture);
+    memoryCharge(SUBSYSTEM_TEXTURES, 0, -textureBytes(r), 0);
+
+    for(int l = 0; l < r->levels; ++l)
+        free(r->slotOf[l]);
+    free(r->vertices);
+    free(r->scratch);
+    free(r->encoded);
+    free(r->gpuOnly);
+    free(r->slots);
+    free(r);
+}
+
+static void markStale(Residency * r, int tx, int ty)
+{
+    for(int l = 0; l < r->levels; ++l) {
+        int s = r->slotOf[l][(ty >> l)*r->levelWidth[l] + (tx >> l)];
+        if(s >= 0)
+            r->slots[s].stale = true;
+    }
+}
+
+void residencyInvalidate(int tx, int ty, void * ctx)
+{
+    Residency * r = ctx;
+    r->gpuOnly[ty*r->canvas->tilesX + tx] = 0;
+    markStale(r, tx, ty);
+}
+
+void residencyInvalidateGpu(int tx, int ty, void * ctx)
+{
+    Residency * r = ctx;
+    if(!r->mirrorTex)
+        return;
+    r->gpuOnly[ty*r->canvas->tilesX + tx] = 1;
+    markStale(r, tx, ty);
+}
+
+// Canvas pixels covered by a slot, clipped to the canvas.
+static Rect keyRect(const Residency * r, int level, int kx, int ky)
+{
+    int span = TILE_SIZE << level;
+    int x0 = kx*span, y0 = ky*span;
+    int x1 = x0 + span < r->canvas->width ? x0 + span : r->canvas->width;
+    int y1 = y0 + span < r->canvas->height ? y0 + span : r->canvas->height;
+    return (Rect){{x0, y0}, {x1 - x0, y1 - y0}};
+}
+
+// For L <= 7 a block never straddles a canvas tile, so every tile is
+// locked once.
+static void downsample(Residency * r, int level, int kx, int ky)
+{
+    Canvas * c = r->canvas;
+    int step = 1 << level;
+    int perTile = TILE_SIZE >> level;
+    for(int cy = ky*step; cy < (ky + 1)*step && cy < c->tilesY; ++cy) {
+        for(int cx = kx*step; cx < (kx + 1)*step && cx < c->tilesX; ++cx) {
+            int ox = (cx - kx*step)*perTile, oy = (cy - ky*step)*perTile;
+            canvasDownsampleTile(c, cx, cy, level, &r->scratch[oy*TILE_STRIDE + ox*COLOR_COMPS], TILE_STRIDE);
+        }
+    }
+}
+
+// Copies the tiles whose pixels only exist in the mirror texture over the
+// CPU version, scaled down to the slot's level by the same box filter
+// downsample applies.
+static void copyGpuTiles(Residency * r, int s, int level, int kx, int ky)
+{
+    Canvas * c = r->canvas;
+    int step = 1 << level;
+    bool bound = false;
+    for(int cy = ky*step; cy < (ky + 1)*step && cy < c->tilesY; ++cy) {
+        for(int cx = kx*step; cx < (kx + 1)*step && cx < c->tilesX; ++cx) {
+            if(!r->gpuOnly[cy*c->tilesX + cx])
+                continue;
+            if(!bound) {
+                glBindFramebuffer(GL_DRAW_FRAMEBUFFER, r->drawFbo);
+                glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, r->texture, 0, s);
+                bound = true;
+            }
+            Rect t = canvasTileRect(c, cx, cy);
+            int dx = (cx - kx*step)*TILE_SIZE/step;
+            int dy = (cy - ky*step)*TILE_SIZE/step;
+            reducerDraw(r->reducer, r->mirrorTex, t, level, dx, dy);
+        }
+    }
+    if(bound)
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+}
+
+static int fillSlot(Residency * r, int s)
+{
+    Slot * slot = &r->slots[s];
+    Canvas * c = r->canvas;
+    Rect k = keyRect(r, slot->level, slot->kx, slot->ky);
+    int step = 1 << slot->level;
+    int w = (k.size.width + step - 1)/step;
+    int h = (k.size.height + step - 1)/step;
+
+    glBindTexture(GL_TEXTURE_2D_ARRAY, r->texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, TILE_SIZE);
+    if(slot->level == 0) {
+        const void * tile = canvasLockStored(c, slot->kx, slot->ky);
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, s, w, h, 1, GL_RGB, canvasPixelType(c->format), tile);
+        canvasUnlockTile(c, slot->kx, slot->ky, tile);
+    } else {
+        downsample(r, slot->level, slot->kx, slot->ky);
+        // an sRGB slot stores encoded bytes, so the average is encoded here
+        canvasEncodeTile(c, r->encoded, r->scratch);
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, s, w, h, 1, GL_RGB, canvasPixelType(c->format), r->encoded);
+    }
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    if(r->mirrorTex)
+        copyGpuTiles(r, s, slot->level, slot->kx, slot->ky);
+    slot->stale = false;
+    return step*step;
+}
+
+// A free slot, or else the one viewed least recently before this frame.
+static int claimSlot(Residency * r)
+{
+    if(r->slotsUsed < r->slotCount)
+        return r->slotsUsed++;
+
+    int best = -1;
+    for(int s = 0; s < r->slotCount; ++s) {
+        if(r->slots[s].lastUsed == r->frame)
+            continue;
+        if(best < 0 || r->slots[s].lastUsed < r->slots[best].lastUsed)
+            best = s;
+    }
+    if(best >= 0) {
+        Slot * old = &r->slots[best];
+        r->slotOf[old->level][old->ky*r->levelWidth[old->level] + old->kx] = -1;
+    }
+    return best;
+}
+
+struct KeyRange {
+    int kx0, ky0, kx1, ky1;
+};
+typedef struct KeyRange KeyRange;
+
+static KeyRange keysFor(const Residency * r, int level, Rect view, int margin)
+{
+    int span = TILE_SIZE << level;
+    KeyRange k = {
+        floorf(view.origin.x/span) - margin,
+        floorf(view.origin.y/span) - margin,
+        floorf((view.origin.x + view.size.width)/span) + margin,
+        floorf((view.origin.y + view.size.height)/span) + margin
+    };
+    k.kx0 = k.kx0 < 0 ? 0 : k.kx0;
+    k.ky0 = k.ky0 < 0 ? 0 : k.ky0;
+    k.kx1 = k.kx1 < r->levelWidth[level] ? k.kx1 : r->levelWidth[level] - 1;
+    k.ky1 = k.ky1 < r->levelHeight[level] ? k.ky1 : r->levelHeight[level] - 1;
+    return k;
+}
+
+// Visible keys first, then the one-slot margin around them.
+static void streamKeys(Residency * r, KeyRange k, int * budget)
+{
+    int level = r->level;
+    for(int ky = k.ky0; ky <= k.ky1; ++ky) {
+        for(int kx = k.kx0; kx <= k.kx1; ++kx) {
+            int * entry = &r->slotOf[level][ky*r->levelWidth[level] + kx];
+            if(*entry >= 0) {
+                r->slots[*entry].lastUsed = r->frame;
+                if(r->slots[*entry].stale && *budget > 0)
+                    *budget -= fillSlot(r, *entry);
+                continue;
+            }
+            if(*budget <= 0)
+                continue;
+            int s = claimSlot(r);
+            if(s < 0)
+                return;
+            r->slots[s] = (Slot){level, kx, ky, r->frame, true};
+            *entry = s;
+            *budget -= fillSlot(r, s);
+        }
+    }
+}
+
+void residencyUpdate(Residency * r, Rect view, float scale)
+{
+    int level = scale < 1.0f ? (int)floorf(log2f(1.0f/scale)) : 0;
+    r->level = level < r->levels - 1 ? level : r->levels - 1;
+    r->view = view;
+    ++r->frame;
+
+    int budget = FILL_BUDGET;
+    int step = 1 << r->level;
+    if(step*step > budget)
+        budget = step*step;
+    streamKeys(r, keysFor(r, r->level, view, 0), &budget);
+    streamKeys(r, keysFor(r, r->level, view, 1), &budget);
+}
+
+static void pushQuad(Residency * r, int * count, Rect q, Rect source, int layer)
+{
+    if(*count + 6 > r->vertexCapacity) {
+        r->vertexCapacity = r->vertexCapacity ? 2*r->vertexCapacity : 6*64;
+        r->vertices = realloc(r->vertices, sizeof(GLfloat)*VERTEX_FLOATS*r->vertexCapacity);
+    }
+
+    // source is the slot's full span in canvas pixels
+    float x0 = q.origin.x, y0 = q.origin.y;
+    float x1 = x0 + q.size.width, y1 = y0 + q.size.height;
+    float u0 = (x0 - source.origin.x)/source.size.width, v0 = (y0 - source.origin.y)/source.size.height;
+    float u1 = (x1 - source.origin.x)/source.size.width, v1 = (y1 - source.origin.y)/source.size.height;
+    GLfloat quad[6][VERTEX_FLOATS] = {
+        {x0, y0, u0, v0, layer}, {x1, y0, u1, v0, layer}, {x1, y1, u1, v1, layer},
+        {x0, y0, u0, v0, layer}, {x1, y1, u1, v1, layer}, {x0, y1, u0, v1, layer}
+    };
+    memcpy(&r->vertices[*count*VERTEX_FLOATS], quad, sizeof(quad));
+    *count += 6;
+}
+
+void residencyDraw(Residency * r, const GLfloat * projection, const GLfloat * transform)
+{
+    int count = 0;
+    KeyRange k = keysFor(r, r->level, r->view, 0);
+    for(int ky = k.ky0; ky <= k.ky1; ++ky) {
+        for(int kx = k.kx0; kx <= k.kx1; ++kx) {
+            for(int l = r->level; l < r->levels; ++l) {
+                int ax = kx >> (l - r->level), ay = ky >> (l - r->level);
+                int s = r->slotOf[l][ay*r->levelWidth[l] + ax];
+                if(s < 0)
+                    continue;
+                int span = TILE_SIZE << l;
+                r->slots[s].lastUsed = r->frame;
+                pushQuad(r, &count, keyRect(r, r->level, kx, ky), (Rect){{ax*span, ay*span}, {span, span}}, s);
+                break;
+            }
+        }
+    }
+    if(!count)
+        return;
+
+    GLint previousProgram, previousVao;
+    glGetIntegerv(GL_CURRENT_PROGRAM, &previousProgram);
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previousVao);
+
+    glUseProgram(r->program);
+    glUniformMatrix4fv(r->projectionLoc, 1, false, projection);
+    glUniformMatrix4fv(r->transformLoc, 1, false, transform);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, r->texture);
+    glBindVertexArray(r->vao);
+    glBindBuffer(GL_ARRAY_BUFFER, r->vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*VERTEX_FLOATS*count, r->vertices, GL_STREAM_DRAW);
+    canvasLinearBegin(r->canvas->format);
+    glDrawArrays(GL_TRIANGLES, 0, count);
+    canvasLinearEnd(r->canvas->format);
+
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    glBindVertexArray(previousVao);
+    glUseProgram(previousProgram);
+}
@@ -0,0 +1,34 @@
+#ifndef DAPPER_RESIDENCY_H
+#define DAPPER_RESIDENCY_H
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+#include "canvas.h"
+
+typedef struct Residency Residency;
+
+// Streams the canvas to the screen through a fixed pool of TILE_SIZE
+// texture slots in one texture array. Slots hold tiles at the mip level
+// that suits the current zoom: a level L slot covers 2^L x 2^L canvas
+// tiles, downsampled on the CPU. Only tiles in and around the view are
+// kept; the least recently viewed slots are reused first, and a few are
+// filled each frame so panning never stalls. Until a tile arrives the
+// nearest coarser resident level stands in for it.
+//
+// mirrorTex is the full-size canvas texture the GPU brush draws into;
+// tiles reported through residencyInvalidateGpu are copied from it
+// instead of from the CPU canvas. It may be 0.
+Residency * residencyCreate(Canvas * canvas, GLuint mirrorTex, int slots);
+void residencyDestroy(Residency * r);
+
+// TileFuncs with the residency as context: the tile changed on the CPU,
+// or only in the mirror texture.
+void residencyInvalidate(int tx, int ty, void * ctx);
+void residencyInvalidateGpu(int tx, int ty, void * ctx);
+
+// view is the visible part of the canvas in canvas pixels; scale is the
+// on-screen size of one canvas pixel.
+void residencyUpdate(Residency * r, Rect view, float scale);
+void residencyDraw(Residency * r, const GLfloat * projection, const GLfloat * transform);
+
+#endif
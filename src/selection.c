@@ -0,0 +1,254 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "memory.h"
+#include "selection.h"
+
+Selection * selectionCreate(int width, int height)
+{
+    Selection * s = calloc(1, sizeof(Selection));
+    s->width = width;
+    s->height = height;
+    s->tilesX = tilesFor(width);
+    s->tilesY = tilesFor(height);
+    s->coverage = calloc(s->tilesX*s->tilesY, sizeof(uint8_t));
+    s->masks = calloc(s->tilesX*s->tilesY, sizeof(uint8_t *));
+    return s;
+}
+
+static uint8_t * newMask()
+{
+    memoryCharge(SUBSYSTEM_SELECTION, TILE_PIXELS, 0, 1);
+    return malloc(TILE_PIXELS);
+}
+
+static void freeMask(uint8_t * mask)
+{
+    if(!mask)
+        return;
+    memoryCharge(SUBSYSTEM_SELECTION, -TILE_PIXELS, 0, -1);
+    free(mask);
+}
+
+static void resetTiles(Selection * s, TileCoverage cov)
+{
+    for(int i = 0; i < s->tilesX*s->tilesY; ++i) {
+        freeMask(s->masks[i]);
+        s->masks[i] = NULL;
+        s->coverage[i] = cov;
+    }
+}
+
+void selectionDestroy(Selection * s)
+{
+    if(!s)
+        return;
+    resetTiles(s, TILE_OUT);
+    free(s->masks);
+    free(s->coverage);
+    free(s);
+}
+
+void selectionClear(Selection * s)
+{
+    resetTiles(s, TILE_OUT);
+    s->active = false;
+}
+
+// Collapses a partial tile back to IN/OUT when its mask turned uniform, so
+// that the brush keeps hitting the fast path after repeated edits.
+static void normalizeTile(Selection * s, int tx, int ty)
+{
+    int i = ty*s->tilesX + tx;
+    uint8_t * mask = s->masks[i];
+    if(!mask)
+        return;
+
+    int w = fmin(TILE_SIZE, s->width - tx*TILE_SIZE);
+    int h = fmin(TILE_SIZE, s->height - ty*TILE_SIZE);
+    bool allIn = true, allOut = true;
+    for(int y = 0; y < h && (allIn || allOut); ++y) {
+        for(int x = 0; x < w; ++x) {
+            if(mask[y*TILE_SIZE + x])
+                allOut = false;
+            else
+                allIn = false;
+        }
+    }
+
+    if(allIn || allOut) {
+        freeMask(mask);
+        s->masks[i] = NULL;
+        s->coverage[i] = allIn ? TILE_IN : TILE_OUT;
+    }
+}
+
+static void combineTile(Selection * s, int tx, int ty, TileCoverage shape, const uint8_t * shapeMask, SelectionOp op)
+{
+    int i = ty*s->tilesX + tx;
+    TileCoverage cur = s->coverage[i];
+
+    if(shape == TILE_OUT)
+        return;
+
+    if(shape == TILE_IN) {
+        freeMask(s->masks[i]);
+        s->masks[i] = NULL;
+        s->coverage[i] = op == SELECTION_SUBTRACT ? TILE_OUT : TILE_IN;
+        return;
+    }
+
+    if(op == SELECTION_SUBTRACT) {
+        if(cur == TILE_OUT)
+            return;
+        if(cur == TILE_IN) {
+            s->masks[i] = newMask();
+            memset(s->masks[i], 255, TILE_PIXELS);
+            s->coverage[i] = TILE_PARTIAL;
+        }
+        uint8_t * mask = s->masks[i];
+        for(int p = 0; p < TILE_PIXELS; ++p)
+            mask[p] &= ~shapeMask[p];
+    } else {
+        if(cur == TILE_IN)
+            return;
+        if(cur == TILE_OUT) {
+            s->masks[i] = newMask();
+            memcpy(s->masks[i], shapeMask, TILE_PIXELS);
+            s->coverage[i] = TILE_PARTIAL;
+        } else {
+            uint8_t * mask = s->masks[i];
+            for(int p = 0; p < TILE_PIXELS; ++p)
+                mask[p] |= shapeMask[p];
+        }
+    }
+
+    normalizeTile(s, tx, ty);
+}
+
+static int compareFloat(const void * a, const void * b)
+{
+    float fa = *(const float *)a;
+    float fb = *(const float *)b;
+    return (fa > fb) - (fa < fb);
+}
+
+// Sorted x positions where the polygon outline crosses the horizontal line y.
+static int rowCrossings(const Point * points, int count, float y, float * xs)
+{
+    int n = 0;
+    for(int i = 0; i < count; ++i) {
+        Point a = points[i];
+        Point b = points[(i+1) % count];
+        if((a.y <= y) != (b.y <= y))
+            xs[n++] = a.x + (y - a.y)*(b.x - a.x)/(b.y - a.y);
+    }
+    qsort(xs, n, sizeof(float), compareFloat);
+    return n;
+}
+
+// Shoelace formula; zero when every point lies on one line.
+static double polygonArea(const Point * points, int count)
+{
+    double twice = 0.0;
+    for(int i = 0; i < count; ++i) {
+        Point a = points[i];
+        Point b = points[(i+1) % count];
+        twice += (double)a.x*b.y - (double)b.x*a.y;
+    }
+    return fabs(twice)/2.0;
+}
+
+static bool crossingsContain(const float * xs, int n, float x)
+{
+    int before = 0;
+    while(before < n && xs[before] <= x)
+        ++before;
+    return before & 1;
+}
+
+// Rasterises a closed polygon (even-odd rule, pixel centres) tile row by tile
+// row. Tiles that no edge touches are classified from a single crossing test
+// and never get a mask; only the tiles an edge passes through are scanned.
+void selectionLasso(Selection * s, const Point * points, int count, SelectionOp op)
+{
+    // a click or a drag along a line encloses nothing: replacing with it
+    // deselects, adding or subtracting it changes nothing
+    if(count < 3 || polygonArea(points, count) == 0.0) {
+        if(op == SELECTION_REPLACE)
+            selectionClear(s);
+        return;
+    }
+
+    if(op == SELECTION_REPLACE || (!s->active && op == SELECTION_ADD))
+        resetTiles(s, TILE_OUT);
+    else if(!s->active && op == SELECTION_SUBTRACT)
+        resetTiles(s, TILE_IN);
+    s->active = true;
+
+    int tileCount = s->tilesX*s->tilesY;
+    uint8_t * touched = calloc(tileCount, 1);
+    for(int i = 0; i < count; ++i) {
+        Point a = points[i];
+        Point b = points[(i+1) % count];
+        int tx0 = fmax(0, floorf(fmin(a.x, b.x)/TILE_SIZE));
+        int tx1 = fmin(s->tilesX-1, floorf(fmax(a.x, b.x)/TILE_SIZE));
+        int ty0 = fmax(0, floorf(fmin(a.y, b.y)/TILE_SIZE));
+        int ty1 = fmin(s->tilesY-1, floorf(fmax(a.y, b.y)/TILE_SIZE));
+        for(int ty = ty0; ty <= ty1; ++ty)
+            for(int tx = tx0; tx <= tx1; ++tx)
+                touched[ty*s->tilesX + tx] = 1;
+    }
+
+    float * xs = malloc(sizeof(float)*count);
+    uint8_t * rowMasks = malloc((size_t)s->tilesX*TILE_PIXELS);
+
+    for(int ty = 0; ty < s->tilesY; ++ty) {
+        bool anyTouched = false;
+        int n = rowCrossings(points, count, ty*TILE_SIZE + TILE_SIZE/2 + 0.5f, xs);
+        for(int tx = 0; tx < s->tilesX; ++tx) {
+            if(touched[ty*s->tilesX + tx]) {
+                anyTouched = true;
+                continue;
+            }
+            float cx = tx*TILE_SIZE + TILE_SIZE/2 + 0.5f;
+            combineTile(s, tx, ty, crossingsContain(xs, n, cx) ? TILE_IN : TILE_OUT, NULL, op);
+        }
+
+        if(!anyTouched)
+            continue;
+
+        memset(rowMasks, 0, (size_t)s->tilesX*TILE_PIXELS);
+        for(int py = 0; py < TILE_SIZE; ++py) {
+            n = rowCrossings(points, count, ty*TILE_SIZE + py + 0.5f, xs);
+            for(int k = 0; k + 1 < n; k += 2) {
+                int start = fmax(0, ceilf(xs[k] - 0.5f));
+                int end = fmin(s->tilesX*TILE_SIZE, ceilf(xs[k+1] - 0.5f));
+                for(int x = start; x < end; ++x) {
+                    int tx = x/TILE_SIZE;
+                    if(touched[ty*s->tilesX + tx])
+                        rowMasks[(size_t)tx*TILE_PIXELS + py*TILE_SIZE + x%TILE_SIZE] = 255;
+                }
+            }
+        }
+
+        for(int tx = 0; tx < s->tilesX; ++tx) {
+            if(touched[ty*s->tilesX + tx])
+                combineTile(s, tx, ty, TILE_PARTIAL, &rowMasks[(size_t)tx*TILE_PIXELS], op);
+        }
+    }
+
+    free(rowMasks);
+    free(xs);
+    free(touched);
+}
+
+void selectionRect(Selection * s, Rect r, SelectionOp op)
+{
+    float x0 = roundf(r.origin.x);
+    float y0 = roundf(r.origin.y);
+    float x1 = roundf(r.origin.x + r.size.width);
+    float y1 = roundf(r.origin.y + r.size.height);
+    Point corners[4] = {{x0, y0}, {x1, y0}, {x1, y1}, {x0, y1}};
+    selectionLasso(s, corners, 4, op);
+}
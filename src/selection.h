@@ -0,0 +1,66 @@
+#ifndef DAPPER_SELECTION_H
+#define DAPPER_SELECTION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "geometry.h"
+#include "tile.h"
+
+enum TileCoverage {
+    TILE_OUT = 0,
+    TILE_IN,
+    TILE_PARTIAL
+};
+typedef enum TileCoverage TileCoverage;
+
+enum SelectionOp {
+    SELECTION_REPLACE,
+    SELECTION_ADD,
+    SELECTION_SUBTRACT
+};
+typedef enum SelectionOp SelectionOp;
+
+// A selection mask stored sparsely per tile. Tiles that are entirely inside
+// or outside the selection carry no pixels; only tiles on the boundary own a
+// TILE_PIXELS byte mask (0 = out, 255 = in).
+struct Selection {
+    int width, height;
+    int tilesX, tilesY;
+    bool active;
+    uint8_t * coverage;
+    uint8_t ** masks;
+};
+typedef struct Selection Selection;
+
+Selection * selectionCreate(int width, int height);
+void selectionDestroy(Selection * s);
+
+// Drops the selection so that the whole canvas is writable again.
+void selectionClear(Selection * s);
+
+void selectionRect(Selection * s, Rect r, SelectionOp op);
+void selectionLasso(Selection * s, const Point * points, int count, SelectionOp op);
+
+static inline TileCoverage selectionTile(const Selection * s, int tx, int ty)
+{
+    if(!s || !s->active)
+        return TILE_IN;
+    return (TileCoverage)s->coverage[ty*s->tilesX + tx];
+}
+
+static inline const uint8_t * selectionMask(const Selection * s, int tx, int ty)
+{
+    return s->masks[ty*s->tilesX + tx];
+}
+
+static inline bool selectionContains(const Selection * s, int x, int y)
+{
+    int tx = x/TILE_SIZE;
+    int ty = y/TILE_SIZE;
+    TileCoverage cov = selectionTile(s, tx, ty);
+    if(cov != TILE_PARTIAL)
+        return cov == TILE_IN;
+    return selectionMask(s, tx, ty)[(y%TILE_SIZE)*TILE_SIZE + x%TILE_SIZE] != 0;
+}
+
+#endif
@@ -0,0 +1,163 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "spatial.h"
+
+SpatialIndex * spatialCreate(int width, int height, int cellSize, Subsystem subsystem)
+{
+    SpatialIndex * s = calloc(1, sizeof(SpatialIndex));
+    s->cellSize = cellSize;
+    s->cellsX = (width + cellSize - 1)/cellSize;
+    s->cellsY = (height + cellSize - 1)/cellSize;
+    s->cells = calloc(s->cellsX*s->cellsY, sizeof(SpatialCell));
+    s->subsystem = subsystem;
+    memoryCharge(subsystem, sizeof(SpatialCell)*(long long)s->cellsX*s->cellsY, 0, 0);
+    return s;
+}
+
+void spatialDestroy(SpatialIndex * s)
+{
+    if(!s)
+        return;
+    long long held = sizeof(SpatialCell)*(long long)s->cellsX*s->cellsY;
+    for(int i = 0; i < s->cellsX*s->cellsY; ++i) {
+        held += sizeof(SpatialEntry)*(long long)s->cells[i].capacity;
+        free(s->cells[i].entries);
+    }
+    held += sizeof(unsigned)*(long long)s->seenCapacity + sizeof(int)*(long long)s->foundCapacity;
+    memoryCharge(s->subsystem, -held, 0, 0);
+    free(s->cells);
+    free(s->seen);
+    free(s->found);
+    free(s);
+}
+
+static int clampCell(float v, int cellSize, int cells)
+{
+    int c = floorf(v/cellSize);
+    return c < 0 ? 0 : (c < cells ? c : cells - 1);
+}
+
+// The cells r reaches; anything beyond the canvas belongs to the edge cells.
+static void cellRange(const SpatialIndex * s, Rect r, int * cx0, int * cy0, int * cx1, int * cy1)
+{
+    *cx0 = clampCell(r.origin.x, s->cellSize, s->cellsX);
+    *cy0 = clampCell(r.origin.y, s->cellSize, s->cellsY);
+    *cx1 = clampCell(r.origin.x + r.size.width, s->cellSize, s->cellsX);
+    *cy1 = clampCell(r.origin.y + r.size.height, s->cellSize, s->cellsY);
+}
+
+void spatialInsert(SpatialIndex * s, int id, Rect r)
+{
+    if(id >= s->seenCapacity) {
+        int capacity = s->seenCapacity ? 2*s->seenCapacity : 256;
+        while(capacity <= id)
+            capacity *= 2;
+        memoryCharge(s->subsystem, sizeof(unsigned)*(long long)(capacity - s->seenCapacity), 0, 0);
+        s->seen = realloc(s->seen, sizeof(unsigned)*capacity);
+        memset(&s->seen[s->seenCapacity], 0, sizeof(unsigned)*(capacity - s->seenCapacity));
+        s->seenCapacity = capacity;
+    }
+
+    int cx0, cy0, cx1, cy1;
+    cellRange(s, r, &cx0, &cy0, &cx1, &cy1);
+    float rx1 = r.origin.x + r.size.width, ry1 = r.origin.y + r.size.height;
+    for(int cy = cy0; cy <= cy1; ++cy) {
+        for(int cx = cx0; cx <= cx1; ++cx) {
+            SpatialCell * c = &s->cells[cy*s->cellsX + cx];
+            // Only the part of r inside the cell, so queries nearby but
+            // outside r's reach skip the entry without looking further.
+            float x0 = cx > 0 ? fmaxf(r.origin.x, cx*s->cellSize) : r.origin.x;
+            float y0 = cy > 0 ? fmaxf(r.origin.y, cy*s->cellSize) : r.origin.y;
+            float x1 = cx < s->cellsX - 1 ? fminf(rx1, (cx + 1)*s->cellSize) : rx1;
+            float y1 = cy < s->cellsY - 1 ? fminf(ry1, (cy + 1)*s->cellSize) : ry1;
+            if(c->count && c->entries[c->count - 1].id == id) {
+                SpatialEntry * e = &c->entries[c->count - 1];
+                e->x0 = fminf(e->x0, x0);
+                e->y0 = fminf(e->y0, y0);
+                e->x1 = fmaxf(e->x1, x1);
+                e->y1 = fmaxf(e->y1, y1);
+                continue;
+            }
+            if(c->count == c->capacity) {
+                int capacity = c->capacity ? 2*c->capacity : 8;
+                memoryCharge(s->subsystem, sizeof(SpatialEntry)*(long long)(capacity - c->capacity), 0, 0);
+                c->capacity = capacity;
+                c->entries = realloc(c->entries, sizeof(SpatialEntry)*capacity);
+            }
+            c->entries[c->count++] = (SpatialEntry){id, x0, y0, x1, y1};
+        }
+    }
+}
+
+// Drops the entries of items numbered id or above.
+static void dropEntries(SpatialCell * c, int id)
+{
+    int kept = 0;
+    for(int i = 0; i < c->count; ++i) {
+        if(c->entries[i].id < id)
+            c->entries[kept++] = c->entries[i];
+    }
+    c->count = kept;
+}
+
+void spatialTruncate(SpatialIndex * s, int id)
+{
+    for(int i = 0; i < s->cellsX*s->cellsY; ++i) {
+        SpatialCell * c = &s->cells[i];
+        // Items usually arrive in order, so the dropped ones are last.
+        while(c->count && c->entries[c->count - 1].id >= id)
+            --c->count;
+        dropEntries(c, id);
+    }
+}
+
+void spatialClear(SpatialIndex * s)
+{
+    for(int i = 0; i < s->cellsX*s->cellsY; ++i)
+        s->cells[i].count = 0;
+}
+
+static int compareIds(const void * a, const void * b)
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+int spatialQuery(SpatialIndex * s, Rect r, int limit, const int ** ids)
+{
+    int cx0, cy0, cx1, cy1;
+    cellRange(s, r, &cx0, &cy0, &cx1, &cy1);
+    float rx0 = r.origin.x, ry0 = r.origin.y;
+    float rx1 = rx0 + r.size.width, ry1 = ry0 + r.size.height;
+
+    if(++s->stamp == 0) {
+        memset(s->seen, 0, sizeof(unsigned)*s->seenCapacity);
+        s->stamp = 1;
+    }
+    int n = 0;
+    bool sorted = true;
+    for(int cy = cy0; cy <= cy1; ++cy) {
+        for(int cx = cx0; cx <= cx1; ++cx) {
+            const SpatialCell * c = &s->cells[cy*s->cellsX + cx];
+            for(int i = 0; i < c->count; ++i) {
+                const SpatialEntry * e = &c->entries[i];
+                if(e->id >= limit || s->seen[e->id] == s->stamp
+                    || !(e->x0 < rx1 && rx0 < e->x1 && e->y0 < ry1 && ry0 < e->y1))
+                    continue;
+                s->seen[e->id] = s->stamp;
+                if(n == s->foundCapacity) {
+                    int capacity = s->foundCapacity ? 2*s->foundCapacity : 64;
+                    memoryCharge(s->subsystem, sizeof(int)*(long long)(capacity - s->foundCapacity), 0, 0);
+                    s->foundCapacity = capacity;
+                    s->found = realloc(s->found, sizeof(int)*capacity);
+                }
+                sorted = sorted && (n == 0 || s->found[n - 1] < e->id);
+                s->found[n++] = e->id;
+            }
+        }
+    }
+    if(!sorted)
+        qsort(s->found, n, sizeof(int), compareIds);
+    *ids = s->found;
+    return n;
+}
@@ -0,0 +1,57 @@
+#ifndef DAPPER_SPATIAL_H
+#define DAPPER_SPATIAL_H
+
+#include "geometry.h"
+#include "memory.h"
+
+// What one item covers inside one cell.
+struct SpatialEntry {
+    int id;
+    float x0, y0, x1, y1;
+};
+typedef struct SpatialEntry SpatialEntry;
+
+struct SpatialCell {
+    SpatialEntry * entries;
+    int count, capacity;
+};
+typedef struct SpatialCell SpatialCell;
+
+// Finds items by canvas region. Items are small integer ids, each covering
+// any number of rects: an item is listed in every cell it reaches, with the
+// bounds of just the part inside that cell, so a long thin stroke is only
+// found near its path rather than anywhere in its bounding box.
+//
+// Items can be extended while they are being built. Adding to the item
+// that was last added to a cell grows its entry there instead of adding
+// another, so a stroke costs one entry per cell it crosses however many
+// segments it has.
+struct SpatialIndex {
+    int cellSize;
+    int cellsX, cellsY;
+    SpatialCell * cells;
+    Subsystem subsystem;
+
+    unsigned stamp;
+    unsigned * seen;
+    int seenCapacity;
+    int * found;
+    int foundCapacity;
+};
+typedef struct SpatialIndex SpatialIndex;
+
+// Memory is charged to subsystem.
+SpatialIndex * spatialCreate(int width, int height, int cellSize, Subsystem subsystem);
+void spatialDestroy(SpatialIndex * s);
+
+void spatialInsert(SpatialIndex * s, int id, Rect r);
+
+// Removes every item numbered id or above.
+void spatialTruncate(SpatialIndex * s, int id);
+void spatialClear(SpatialIndex * s);
+
+// The items below limit that meet r, each once, in increasing order. The
+// array belongs to the index and is valid until the next query.
+int spatialQuery(SpatialIndex * s, Rect r, int limit, const int ** ids);
+
+#endif
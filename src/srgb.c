@@ -0,0 +1,74 @@
+#include <math.h>
+#include <string.h>
+#include <pthread.h>
+#include "srgb.h"
+
+// Below 2^-13 everything encodes to 0; from there to 1.0 the encode table
+// is indexed by the float's exponent and top 8 mantissa bits.
+#define MIN_EXPONENT (127 - 13)
+#define ENCODE_ENTRIES ((127 - MIN_EXPONENT) << 8)
+
+static float decodeTable[256];
+// threshold[k] is the smallest linear value that encodes to k or above.
+static float threshold[257];
+static uint8_t encodeTable[ENCODE_ENTRIES];
+static pthread_once_t tablesOnce = PTHREAD_ONCE_INIT;
+
+float srgbDecode(float v)
+{
+    return v <= 0.04045f ? v/12.92f : powf((v + 0.055f)/1.055f, 2.4f);
+}
+
+float srgbEncode(float v)
+{
+    return v <= 0.0031308f ? v*12.92f : 1.055f*powf(v, 1.0f/2.4f) - 0.055f;
+}
+
+static void buildTables()
+{
+    for(int i = 0; i < 256; ++i)
+        decodeTable[i] = srgbDecode(i/255.0f);
+    threshold[0] = 0.0f;
+    for(int k = 1; k < 256; ++k)
+        threshold[k] = srgbDecode((k - 0.5f)/255.0f);
+    threshold[256] = INFINITY;
+
+    for(int i = 0; i < ENCODE_ENTRIES; ++i) {
+        // the middle of the bucket, so the guess is never more than a code off
+        uint32_t bits = ((uint32_t)(i + (MIN_EXPONENT << 8)) << 15) | (1u << 14);
+        float x;
+        memcpy(&x, &bits, sizeof(x));
+        encodeTable[i] = (uint8_t)lrintf(srgbEncode(x)*255.0f);
+    }
+}
+
+static inline uint8_t encode(float x)
+{
+    if(!(x >= threshold[1]))
+        return 0;
+    if(x >= 1.0f)
+        return 255;
+    uint32_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    int i = (int)(bits >> 15) - (MIN_EXPONENT << 8);
+    int c = i < 0 ? 0 : encodeTable[i];
+    if(x >= threshold[c + 1])
+        ++c;
+    else if(x < threshold[c])
+        --c;
+    return (uint8_t)c;
+}
+
+void srgbFromLinear(uint8_t * dst, const float * src, size_t n)
+{
+    pthread_once(&tablesOnce, buildTables);
+    for(size_t i = 0; i < n; ++i)
+        dst[i] = encode(src[i]);
+}
+
+void srgbToLinear(float * dst, const uint8_t * src, size_t n)
+{
+    pthread_once(&tablesOnce, buildTables);
+    for(size_t i = 0; i < n; ++i)
+        dst[i] = decodeTable[src[i]];
+}
@@ -0,0 +1,16 @@
+#ifndef DAPPER_SRGB_H
+#define DAPPER_SRGB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The sRGB transfer function for 8 bit storage of linear-light floats.
+// Both directions are table driven and round exactly like the formula.
+void srgbFromLinear(uint8_t * dst, const float * src, size_t n);
+void srgbToLinear(float * dst, const uint8_t * src, size_t n);
+
+// The formula itself, for one-off colours.
+float srgbDecode(float v);
+float srgbEncode(float v);
+
+#endif
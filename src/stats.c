@@ -0,0 +1,137 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "stats.h"
+
+#define FIRST_BUCKET_LIMIT 0.00025
+
+static const char * stageNames[STAGE_COUNT] = {
+    "POLL", "UPLD", "GPNT", "RDBK", "DRAW", "SWAP", "JOBS", "FRAM", "RAST", "GUPL", "GDRW", "FALT"
+};
+
+static atomic_ullong current[STAGE_COUNT];
+static float samples[STATS_FRAMES][STAGE_COUNT];
+static int frameCount = 0;
+static double startup = 0;
+static unsigned spillFaults = 0;
+static unsigned spillFailures = 0;
+
+double statsNow()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+void statsRecord(Stage stage, double seconds)
+{
+    atomic_fetch_add_explicit(&current[stage], (unsigned long long)(seconds*1e9), memory_order_relaxed);
+}
+
+void statsEndFrame()
+{
+    float * row = samples[frameCount % STATS_FRAMES];
+    for(int s = 0; s < STAGE_COUNT; ++s)
+        row[s] = atomic_exchange_explicit(&current[s], 0, memory_order_relaxed)*1e-9;
+    ++frameCount;
+}
+
+const char * statsStageName(Stage stage)
+{
+    return stageNames[stage];
+}
+
+static int framesKept()
+{
+    return frameCount < STATS_FRAMES ? frameCount : STATS_FRAMES;
+}
+
+double statsAverage(Stage stage)
+{
+    int n = framesKept();
+    double sum = 0;
+    for(int i = 0; i < n; ++i)
+        sum += samples[i][stage];
+    return n ? sum/n : 0;
+}
+
+double statsMax(Stage stage)
+{
+    int n = framesKept();
+    double max = 0;
+    for(int i = 0; i < n; ++i)
+        if(samples[i][stage] > max)
+            max = samples[i][stage];
+    return max;
+}
+
+double statsBucketLimit(int bucket)
+{
+    return FIRST_BUCKET_LIMIT*(1 << bucket);
+}
+
+void statsHistogram(Stage stage, int * buckets)
+{
+    for(int b = 0; b < STATS_BUCKETS; ++b)
+        buckets[b] = 0;
+
+    int n = framesKept();
+    for(int i = 0; i < n; ++i) {
+        int b = 0;
+        while(b < STATS_BUCKETS-1 && samples[i][stage] > statsBucketLimit(b))
+            ++b;
+        ++buckets[b];
+    }
+}
+
+void statsSetStartup(double seconds)
+{
+    startup = seconds;
+}
+
+double statsStartup()
+{
+    return startup;
+}
+
+void statsSetSpill(unsigned faults, unsigned failures)
+{
+    spillFaults = faults;
+    spillFailures = failures;
+}
+
+unsigned statsSpillFaults()
+{
+    return spillFaults;
+}
+
+unsigned statsSpillFailures()
+{
+    return spillFailures;
+}
+
+bool statsDumpCsv(const char * path)
+{
+    FILE * file = fopen(path, "w");
+    if(!file)
+        return false;
+
+    fputs("frame", file);
+    for(int s = 0; s < STAGE_COUNT; ++s)
+        fprintf(file, ",%s_ms", stageNames[s]);
+    fputc('\n', file);
+
+    int n = framesKept();
+    for(int i = 0; i < n; ++i) {
+        int frame = frameCount - n + i;
+        fprintf(file, "%d", frame);
+        for(int s = 0; s < STAGE_COUNT; ++s)
+            fprintf(file, ",%.4f", 1000*samples[frame % STATS_FRAMES][s]);
+        fputc('\n', file);
+    }
+
+    bool ok = !ferror(file);
+    return fclose(file) == 0 && ok;
+}
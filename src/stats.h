@@ -0,0 +1,55 @@
+#ifndef DAPPER_STATS_H
+#define DAPPER_STATS_H
+
+#include <stdbool.h>
+
+enum Stage {
+    STAGE_POLL,
+    STAGE_UPLOAD,
+    STAGE_GPU_PAINT,
+    STAGE_READBACK,
+    STAGE_RENDER,
+    STAGE_SWAP,
+    STAGE_JOBS,
+    STAGE_FRAME,
+    STAGE_RASTER,
+    STAGE_GPU_UPLOAD,
+    STAGE_GPU_RENDER,
+    STAGE_FAULT,
+    STAGE_COUNT
+};
+typedef enum Stage Stage;
+
+#define STATS_FRAMES 240
+#define STATS_BUCKETS 16
+
+// Per-frame timings for each stage, kept for the last STATS_FRAMES frames.
+// Recording is an atomic add, so any thread may report time against the
+// frame that is currently open; statsEndFrame closes it. Costs two clock
+// reads per timed stage, cheap enough to leave on.
+double statsNow();
+void statsRecord(Stage stage, double seconds);
+void statsEndFrame();
+
+const char * statsStageName(Stage stage);
+double statsAverage(Stage stage);
+double statsMax(Stage stage);
+
+// Frame counts over log-spaced buckets, bucket i ending at
+// statsBucketLimit(i) seconds.
+void statsHistogram(Stage stage, int * buckets);
+double statsBucketLimit(int bucket);
+
+// Time from launch until the first frame was on screen; 0 until then.
+void statsSetStartup(double seconds);
+double statsStartup();
+
+// Canvas tiles read back from the scratch file and scratch file writes or
+// reads that failed, as last reported by the canvas on screen.
+void statsSetSpill(unsigned faults, unsigned failures);
+unsigned statsSpillFaults();
+unsigned statsSpillFailures();
+
+bool statsDumpCsv(const char * path);
+
+#endif
@@ -0,0 +1,71 @@
+#include <math.h>
+#include "stroke.h"
+
+// One euro filter tuning, in canvas pixels and seconds.
+#define MIN_CUTOFF 1.5f
+#define SPEED_COEFF 0.02f
+#define SPEED_CUTOFF 1.0f
+// Coalesced events can share a timestamp; never treat them as simultaneous.
+#define MIN_DT (1.0/1000.0)
+
+#define PI 3.14159265f
+
+static float smoothing(float cutoff, float dt)
+{
+    float tau = 1.0f/(2*PI*cutoff);
+    return 1.0f/(1.0f + tau/dt);
+}
+
+static void walk(Stroke * s, Point from, Point to, DabFunc dab, void * ctx)
+{
+    float dx = to.x - from.x;
+    float dy = to.y - from.y;
+    float len = sqrtf(dx*dx + dy*dy);
+    float spacing = fmax(s->brush.spacing, 0.5f);
+
+    float t = spacing - s->travelled;
+    for(; t <= len; t += spacing)
+        dab((Point){from.x + dx*t/len, from.y + dy*t/len}, &s->brush, ctx);
+    s->travelled = len - (t - spacing);
+}
+
+void strokeBegin(Stroke * s, const Brush * brush, Point p, double time, DabFunc dab, void * ctx)
+{
+    s->brush = *brush;
+    s->raw = p;
+    s->filtered = p;
+    s->speed = (Point){0, 0};
+    s->time = time;
+    s->travelled = 0;
+    dab(p, &s->brush, ctx);
+}
+
+void strokeAdd(Stroke * s, Point p, double time, DabFunc dab, void * ctx)
+{
+    float dt = fmax(time - s->time, MIN_DT);
+    s->time = time;
+
+    float as = smoothing(SPEED_CUTOFF, dt);
+    s->speed.x += as*((p.x - s->raw.x)/dt - s->speed.x);
+    s->speed.y += as*((p.y - s->raw.y)/dt - s->speed.y);
+    s->raw = p;
+
+    float speed = sqrtf(s->speed.x*s->speed.x + s->speed.y*s->speed.y);
+    float a = smoothing(MIN_CUTOFF + SPEED_COEFF*speed, dt);
+    Point next = {
+        s->filtered.x + a*(p.x - s->filtered.x),
+        s->filtered.y + a*(p.y - s->filtered.y)
+    };
+
+    walk(s, s->filtered, next, dab, ctx);
+    s->filtered = next;
+}
+
+// The filter trails the cursor; finish the stroke where the pointer was
+// released.
+void strokeEnd(Stroke * s, Point p, double time, DabFunc dab, void * ctx)
+{
+    walk(s, s->filtered, p, dab, ctx);
+    s->filtered = p;
+    s->time = time;
+}
@@ -0,0 +1,44 @@
+#ifndef DAPPER_STROKE_H
+#define DAPPER_STROKE_H
+
+#include <stdbool.h>
+#include <math.h>
+#include "geometry.h"
+
+struct Brush {
+    float size;
+    float spacing;
+    Color color;
+};
+typedef struct Brush Brush;
+
+typedef void (*DabFunc)(Point p, const Brush * brush, void * ctx);
+
+// Turns raw timestamped cursor samples into evenly spaced dabs. Samples are
+// smoothed with a one euro filter (a low pass whose cutoff rises with
+// speed, so slow strokes lose jitter and fast ones do not lag), then the
+// smoothed path is walked and a dab is emitted every brush->spacing pixels
+// regardless of how many events the window system delivered.
+struct Stroke {
+    Brush brush;
+    Point raw;
+    Point filtered;
+    Point speed;
+    double time;
+    float travelled;
+};
+typedef struct Stroke Stroke;
+
+void strokeBegin(Stroke * s, const Brush * brush, Point p, double time, DabFunc dab, void * ctx);
+void strokeAdd(Stroke * s, Point p, double time, DabFunc dab, void * ctx);
+void strokeEnd(Stroke * s, Point p, double time, DabFunc dab, void * ctx);
+
+// What a dab centred on p paints: a brush sized square snapped to the
+// pixel grid.
+static inline Rect strokeDabRect(Point p, const Brush * brush)
+{
+    float half = 0.5f*brush->size;
+    return (Rect){{floorf(p.x - half + 0.5f), floorf(p.y - half + 0.5f)}, {brush->size, brush->size}};
+}
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef DAPPER_TILE_H
+#define DAPPER_TILE_H
+
+// The canvas is split into square tiles so that per-region state (selection
+// coverage, dirty flags, ...) can be tracked without touching every pixel.
+#define TILE_SIZE 128
+#define TILE_PIXELS (TILE_SIZE*TILE_SIZE)
+
+typedef void (*TileFunc)(int tx, int ty, void * ctx);
+
+static inline int tilesFor(int pixels)
+{
+    return (pixels + TILE_SIZE - 1)/TILE_SIZE;
+}
+
+#endif
@@ -0,0 +1,189 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "export.h"
+#include "memory.h"
+#include "timelapse.h"
+
+struct TimelapseTile {
+    Timelapse * timelapse;
+    int tx, ty;
+};
+typedef struct TimelapseTile TimelapseTile;
+
+struct Timelapse {
+    Canvas * canvas;
+    Pool * pool;
+    PoolGroup * group;
+    FILE * file;
+    int shrink;
+    int width, height;
+    int chromaWidth, chromaHeight;
+    uint8_t * frame;
+    size_t frameBytes;
+    DirtyTracker tracker;
+    CanvasSnapshot * snapshot;
+    TimelapseTile * tiles;
+    int pending;
+    atomic_int remaining;
+    int frames;
+    atomic_bool failed;
+};
+
+Timelapse * timelapseStart(Canvas * canvas, Pool * pool, const char * path, int shrink)
+{
+    FILE * file = fopen(path, "wb");
+    if(!file)
+        return NULL;
+
+    Timelapse * t = calloc(1, sizeof(Timelapse));
+    t->canvas = canvas;
+    t->pool = pool;
+    t->group = poolGroupCreate();
+    t->file = file;
+    t->shrink = shrink;
+    t->width = (canvas->width + shrink - 1)/shrink;
+    t->height = (canvas->height + shrink - 1)/shrink;
+    t->chromaWidth = (t->width + 1)/2;
+    t->chromaHeight = (t->height + 1)/2;
+    t->frameBytes = (size_t)t->width*t->height + 2*(size_t)t->chromaWidth*t->chromaHeight;
+    t->frame = malloc(t->frameBytes);
+    memoryCharge(SUBSYSTEM_EXPORT, t->frameBytes, 0, 0);
+    dirtyTrackerInit(&t->tracker, canvas);
+    t->tiles = malloc(sizeof(TimelapseTile)*canvas->tilesX*canvas->tilesY);
+    atomic_init(&t->failed, false);
+    atomic_init(&t->remaining, 0);
+
+    if(fprintf(file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", t->width, t->height, TIMELAPSE_RATE) < 0)
+        atomic_store(&t->failed, true);
+    return t;
+}
+
+static uint8_t clampByte(float v)
+{
+    return v <= 0 ? 0 : (v >= 255 ? 255 : (uint8_t)(v + 0.5f));
+}
+
+static void writeFrame(void * arg)
+{
+    Timelapse * t = arg;
+    if(fputs("FRAME\n", t->file) < 0 || fwrite(t->frame, 1, t->frameBytes, t->file) != t->frameBytes)
+        atomic_store(&t->failed, true);
+}
+
+// Shrinks the tile by box filtering its exported bytes, then converts to
+// limited range BT.601 with each chroma sample averaging a 2x2 block.
+// Tiles start on even frame pixels, so no block spans two tiles.
+static void convertTile(void * arg)
+{
+    TimelapseTile * job = arg;
+    Timelapse * t = job->timelapse;
+    const Canvas * c = t->canvas;
+    int k = t->shrink;
+    uint8_t rgb[TILE_PIXELS*3];
+    float cb[TILE_PIXELS], cr[TILE_PIXELS];
+    void * stored = malloc(c->storedBytes);
+    canvasSnapshotRead(t->snapshot, job->tx, job->ty, stored);
+    exportPackStored(c, job->tx, job->ty, stored, rgb, TILE_SIZE*3);
+    free(stored);
+
+    int tileW = canvasTileWidth(c, job->tx), tileH = canvasTileHeight(c, job->ty);
+    int w = (tileW + k - 1)/k, h = (tileH + k - 1)/k;
+    int fx = job->tx*TILE_SIZE/k, fy = job->ty*TILE_SIZE/k;
+    uint8_t * luma = t->frame;
+    for(int y = 0; y < h; ++y) {
+        for(int x = 0; x < w; ++x) {
+            float sum[3] = {0, 0, 0};
+            int n = 0;
+            for(int sy = y*k; sy < (y + 1)*k && sy < tileH; ++sy) {
+                for(int sx = x*k; sx < (x + 1)*k && sx < tileW; ++sx) {
+                    const uint8_t * p = &rgb[(sy*TILE_SIZE + sx)*3];
+                    sum[0] += p[0];
+                    sum[1] += p[1];
+                    sum[2] += p[2];
+                    ++n;
+                }
+            }
+            float r = sum[0]/n, g = sum[1]/n, b = sum[2]/n;
+            luma[(size_t)(fy + y)*t->width + fx + x] = clampByte(16 + (65.481f*r + 128.553f*g + 24.966f*b)/255);
+            cb[y*TILE_SIZE + x] = 128 + (-37.797f*r - 74.203f*g + 112.0f*b)/255;
+            cr[y*TILE_SIZE + x] = 128 + (112.0f*r - 93.786f*g - 18.214f*b)/255;
+        }
+    }
+
+    uint8_t * planeB = t->frame + (size_t)t->width*t->height;
+    uint8_t * planeR = planeB + (size_t)t->chromaWidth*t->chromaHeight;
+    for(int y = 0; y < h; y += 2) {
+        for(int x = 0; x < w; x += 2) {
+            float sumB = 0, sumR = 0;
+            int n = 0;
+            for(int sy = y; sy < y + 2 && sy < h; ++sy) {
+                for(int sx = x; sx < x + 2 && sx < w; ++sx) {
+                    sumB += cb[sy*TILE_SIZE + sx];
+                    sumR += cr[sy*TILE_SIZE + sx];
+                    ++n;
+                }
+            }
+            size_t i = (size_t)(fy + y)/2*t->chromaWidth + (fx + x)/2;
+            planeB[i] = clampByte(sumB/n);
+            planeR[i] = clampByte(sumR/n);
+        }
+    }
+
+    if(atomic_fetch_sub(&t->remaining, 1) == 1)
+        poolSubmitGroup(t->pool, t->group, writeFrame, t);
+}
+
+static void addTile(int tx, int ty, void * ctx)
+{
+    Timelapse * t = ctx;
+    t->tiles[t->pending++] = (TimelapseTile){t, tx, ty};
+}
+
+void timelapseFrame(Timelapse * t)
+{
+    // the previous frame may still be converting into or writing from the
+    // buffer
+    poolGroupWait(t->group);
+    canvasSnapshotRelease(t->snapshot);
+    t->snapshot = canvasSnapshot(t->canvas);
+
+    t->pending = 0;
+    canvasCollectDirty(t->canvas, &t->tracker, addTile, t);
+    if(t->frames == 0) {
+        t->pending = 0;
+        for(int ty = 0; ty < t->canvas->tilesY; ++ty)
+            for(int tx = 0; tx < t->canvas->tilesX; ++tx)
+                addTile(tx, ty, t);
+    }
+    // the last tile to finish hands the frame to the writer
+    atomic_store(&t->remaining, t->pending);
+    for(int i = 0; i < t->pending; ++i)
+        poolSubmitGroup(t->pool, t->group, convertTile, &t->tiles[i]);
+    if(!t->pending)
+        poolSubmitGroup(t->pool, t->group, writeFrame, t);
+    ++t->frames;
+}
+
+int timelapseFrames(const Timelapse * t)
+{
+    return t->frames;
+}
+
+bool timelapseFinish(Timelapse * t)
+{
+    if(!t)
+        return true;
+    poolGroupWait(t->group);
+    poolGroupDestroy(t->group);
+    canvasSnapshotRelease(t->snapshot);
+    bool ok = !atomic_load(&t->failed);
+    ok = fclose(t->file) == 0 && ok;
+    memoryCharge(SUBSYSTEM_EXPORT, -(long long)t->frameBytes, 0, 0);
+    dirtyTrackerFree(&t->tracker);
+    free(t->frame);
+    free(t->tiles);
+    free(t);
+    return ok;
+}
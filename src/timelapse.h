@@ -0,0 +1,29 @@
+#ifndef DAPPER_TIMELAPSE_H
+#define DAPPER_TIMELAPSE_H
+
+#include <stdbool.h>
+#include "canvas.h"
+#include "pool.h"
+
+// Frames per second written into the video header.
+#define TIMELAPSE_RATE 30
+
+typedef struct Timelapse Timelapse;
+
+// Records a canvas being painted as a raw Y4M video (4:2:0, BT.601), one
+// frame per timelapseFrame. The frame is kept between calls and only the
+// tiles touched since the previous frame are converted, as pool jobs
+// reading a snapshot of the canvas, then the last of them queues the write;
+// the caller paints on meanwhile. shrink, a power of two up to
+// TILE_SIZE/2, divides the frame size. Call from a thread outside the
+// pool while no writer holds a tile.
+Timelapse * timelapseStart(Canvas * canvas, Pool * pool, const char * path, int shrink);
+
+void timelapseFrame(Timelapse * t);
+int timelapseFrames(const Timelapse * t);
+
+// Waits for the last frame to be written and closes the file; false if
+// anything failed to write.
+bool timelapseFinish(Timelapse * t);
+
+#endif
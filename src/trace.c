@@ -0,0 +1,118 @@
+#define _POSIX_C_SOURCE 200809L
+#include "trace.h"
+
+#ifdef DAPPER_TRACE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdatomic.h>
+#include <time.h>
+
+struct TraceEvent {
+    const char * name;
+    uint64_t start, duration;
+};
+typedef struct TraceEvent TraceEvent;
+
+// Single writer: only the owning thread advances head. The writer stores
+// the slot and then publishes it with a release store of head.
+struct TraceBuffer {
+    struct TraceBuffer * next;
+    const char * name;
+    int tid;
+    atomic_ullong head;
+    TraceEvent events[TRACE_EVENTS];
+};
+typedef struct TraceBuffer TraceBuffer;
+
+static _Atomic(TraceBuffer *) buffers = NULL;
+static atomic_int nextTid = 1;
+static __thread TraceBuffer * local = NULL;
+
+static uint64_t now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000u + ts.tv_nsec;
+}
+
+// Buffers are never freed: a thread that exits leaves its events behind
+// for the next write, and the list can be walked without locking.
+static TraceBuffer * localBuffer()
+{
+    if(local)
+        return local;
+
+    local = calloc(1, sizeof(TraceBuffer));
+    local->tid = atomic_fetch_add(&nextTid, 1);
+    TraceBuffer * head = atomic_load(&buffers);
+    do {
+        local->next = head;
+    } while(!atomic_compare_exchange_weak(&buffers, &head, local));
+    return local;
+}
+
+TraceScope traceScopeBegin(const char * name)
+{
+    return (TraceScope){name, now()};
+}
+
+void traceScopeEnd(TraceScope * s)
+{
+    uint64_t end = now();
+    TraceBuffer * b = localBuffer();
+    unsigned long long head = atomic_load_explicit(&b->head, memory_order_relaxed);
+    b->events[head % TRACE_EVENTS] = (TraceEvent){s->name, s->start, end - s->start};
+    atomic_store_explicit(&b->head, head + 1, memory_order_release);
+}
+
+void traceThreadName(const char * name)
+{
+    localBuffer()->name = name;
+}
+
+static void writeBuffer(FILE * file, TraceBuffer * b, bool * first)
+{
+    static TraceEvent copy[TRACE_EVENTS];
+
+    if(b->name) {
+        fprintf(file, "%s\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+            *first ? "" : ",", b->tid, b->name);
+        *first = false;
+    }
+
+    // Copy without stopping the writer, then drop anything it may have
+    // overwritten while we were copying.
+    unsigned long long head = atomic_load_explicit(&b->head, memory_order_acquire);
+    unsigned long long begin = head > TRACE_EVENTS ? head - TRACE_EVENTS : 0;
+    for(unsigned long long i = begin; i < head; ++i)
+        copy[i % TRACE_EVENTS] = b->events[i % TRACE_EVENTS];
+    atomic_thread_fence(memory_order_acquire);
+    unsigned long long after = atomic_load_explicit(&b->head, memory_order_relaxed);
+    if(after > TRACE_EVENTS && after - TRACE_EVENTS > begin)
+        begin = after - TRACE_EVENTS;
+
+    for(unsigned long long i = begin; i < head; ++i) {
+        const TraceEvent * e = &copy[i % TRACE_EVENTS];
+        fprintf(file, "%s\n{\"ph\":\"X\",\"name\":\"%s\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+            *first ? "" : ",", e->name, b->tid, e->start*1e-3, e->duration*1e-3);
+        *first = false;
+    }
+}
+
+bool traceWrite(const char * path)
+{
+    FILE * file = fopen(path, "w");
+    if(!file)
+        return false;
+
+    bool first = true;
+    fputs("{\"traceEvents\":[", file);
+    for(TraceBuffer * b = atomic_load(&buffers); b; b = b->next)
+        writeBuffer(file, b, &first);
+    fputs("\n]}\n", file);
+
+    return fclose(file) == 0;
+}
+
+#endif
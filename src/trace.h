@@ -0,0 +1,45 @@
+#ifndef DAPPER_TRACE_H
+#define DAPPER_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Timeline tracing in the Chrome trace event format (chrome://tracing,
+// ui.perfetto.dev). Build with TRACE=1 to enable; otherwise every macro
+// below expands to nothing.
+//
+// TRACE_SCOPE records a complete event from the macro to the end of the
+// enclosing block. Each thread writes into its own ring buffer without
+// locks; traceWrite copies whatever the rings currently hold, so a long
+// session keeps the most recent TRACE_EVENTS events per thread.
+#ifdef DAPPER_TRACE
+
+#define TRACE_EVENTS 16384
+
+struct TraceScope {
+    const char * name;
+    uint64_t start;
+};
+typedef struct TraceScope TraceScope;
+
+TraceScope traceScopeBegin(const char * name);
+void traceScopeEnd(TraceScope * s);
+void traceThreadName(const char * name);
+bool traceWrite(const char * path);
+
+#define TRACE_CONCAT_(a, b) a ## b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) \
+    TraceScope TRACE_CONCAT(traceScope, __LINE__) __attribute__((cleanup(traceScopeEnd))) = traceScopeBegin(name)
+#define TRACE_THREAD(name) traceThreadName(name)
+#define TRACE_WRITE(path) traceWrite(path)
+
+#else
+
+#define TRACE_SCOPE(name) ((void)0)
+#define TRACE_THREAD(name) ((void)0)
+#define TRACE_WRITE(path) false
+
+#endif
+
+#endif
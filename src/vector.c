@@ -0,0 +1,250 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "memory.h"
+#include "tile.h"
+#include "vector.h"
+
+#define VECTOR_CELL 128
+
+// The dabs placed by one event, and the rect they cover.
+struct DabRun {
+    VectorStroke * stroke;
+    Rect bounds;
+    bool placed;
+};
+typedef struct DabRun DabRun;
+
+static Rect unionRect(Rect a, Rect b)
+{
+    float x0 = fminf(a.origin.x, b.origin.x), y0 = fminf(a.origin.y, b.origin.y);
+    float x1 = fmaxf(a.origin.x + a.size.width, b.origin.x + b.size.width);
+    float y1 = fmaxf(a.origin.y + a.size.height, b.origin.y + b.size.height);
+    return (Rect){{x0, y0}, {x1 - x0, y1 - y0}};
+}
+
+static size_t sampleBytes(int count)
+{
+    return sizeof(VectorSample)*(size_t)count;
+}
+
+static size_t dabBytes(int count)
+{
+    return sizeof(Point)*(size_t)count;
+}
+
+VectorLayer * vectorCreate(int width, int height)
+{
+    VectorLayer * v = calloc(1, sizeof(VectorLayer));
+    v->width = width;
+    v->height = height;
+    v->index = spatialCreate(width, height, VECTOR_CELL, SUBSYSTEM_VECTOR);
+    return v;
+}
+
+static void freeStroke(VectorStroke * s)
+{
+    memoryCharge(SUBSYSTEM_VECTOR, -(long long)(sampleBytes(s->capacity) + dabBytes(s->dabCapacity)), 0, 0);
+    free(s->samples);
+    free(s->dabs);
+}
+
+void vectorDestroy(VectorLayer * v)
+{
+    if(!v)
+        return;
+    vectorClear(v);
+    memoryCharge(SUBSYSTEM_VECTOR, -(long long)sizeof(VectorStroke)*v->capacity, 0, 0);
+    spatialDestroy(v->index);
+    free(v->strokes);
+    free(v);
+}
+
+// A new stroke replaces the undone ones.
+static void dropRedo(VectorLayer * v)
+{
+    if(v->total == v->count)
+        return;
+    for(int i = v->count; i < v->total; ++i)
+        freeStroke(&v->strokes[i]);
+    spatialTruncate(v->index, v->count);
+    v->total = v->count;
+}
+
+static void addSample(VectorStroke * s, Point p, double time)
+{
+    if(s->count == s->capacity) {
+        int capacity = s->capacity ? 2*s->capacity : 64;
+        memoryCharge(SUBSYSTEM_VECTOR, sampleBytes(capacity - s->capacity), 0, 0);
+        s->capacity = capacity;
+        s->samples = realloc(s->samples, sizeof(VectorSample)*capacity);
+    }
+    s->samples[s->count++] = (VectorSample){p, time};
+}
+
+// Keeps the dab where the brush engine put it; only its pixel rect matters.
+static void keepDab(Point p, const Brush * brush, void * ctx)
+{
+    DabRun * run = ctx;
+    VectorStroke * s = run->stroke;
+    if(s->dabCount == s->dabCapacity) {
+        int capacity = s->dabCapacity ? 2*s->dabCapacity : 64;
+        memoryCharge(SUBSYSTEM_VECTOR, dabBytes(capacity - s->dabCapacity), 0, 0);
+        s->dabCapacity = capacity;
+        s->dabs = realloc(s->dabs, sizeof(Point)*capacity);
+    }
+    Rect dab = strokeDabRect(p, brush);
+    s->dabs[s->dabCount++] = dab.origin;
+    run->bounds = run->placed ? unionRect(run->bounds, dab) : dab;
+    run->placed = true;
+}
+
+Rect vectorBegin(VectorLayer * v, const Brush * brush, Point p, double time)
+{
+    dropRedo(v);
+    if(v->count == v->capacity) {
+        int capacity = v->capacity ? 2*v->capacity : 64;
+        memoryCharge(SUBSYSTEM_VECTOR, sizeof(VectorStroke)*(long long)(capacity - v->capacity), 0, 0);
+        v->capacity = capacity;
+        v->strokes = realloc(v->strokes, sizeof(VectorStroke)*capacity);
+    }
+
+    int id = v->count;
+    VectorStroke * s = &v->strokes[id];
+    *s = (VectorStroke){*brush};
+    DabRun run = {s};
+    strokeBegin(&v->smoother, brush, p, time, keepDab, &run);
+    addSample(s, p, time);
+    s->bounds = run.bounds;
+    spatialInsert(v->index, id, s->bounds);
+    v->total = v->count = id + 1;
+    v->open = true;
+    return s->bounds;
+}
+
+// The brush engine places the dabs, so the layer renders what flattening
+// will paint.
+static Rect extend(VectorLayer * v, Point p, double time, bool end)
+{
+    if(!v->open)
+        return (Rect){{0, 0}, {0, 0}};
+    int id = v->count - 1;
+    VectorStroke * s = &v->strokes[id];
+    DabRun run = {s};
+    if(end)
+        strokeEnd(&v->smoother, p, time, keepDab, &run);
+    else
+        strokeAdd(&v->smoother, p, time, keepDab, &run);
+    addSample(s, p, time);
+    v->open = !end;
+
+    if(!run.placed)
+        return (Rect){{0, 0}, {0, 0}};
+    s->bounds = unionRect(s->bounds, run.bounds);
+    spatialInsert(v->index, id, run.bounds);
+    return run.bounds;
+}
+
+Rect vectorAdd(VectorLayer * v, Point p, double time)
+{
+    return extend(v, p, time, false);
+}
+
+Rect vectorEnd(VectorLayer * v, Point p, double time)
+{
+    return extend(v, p, time, true);
+}
+
+bool vectorUndo(VectorLayer * v, Rect * changed)
+{
+    if(v->open || v->count == 0)
+        return false;
+    *changed = v->strokes[--v->count].bounds;
+    return true;
+}
+
+bool vectorRedo(VectorLayer * v, Rect * changed)
+{
+    if(v->open || v->count == v->total)
+        return false;
+    *changed = v->strokes[v->count++].bounds;
+    return true;
+}
+
+void vectorClear(VectorLayer * v)
+{
+    for(int i = 0; i < v->total; ++i)
+        freeStroke(&v->strokes[i]);
+    spatialClear(v->index);
+    v->count = v->total = 0;
+    v->open = false;
+}
+
+int vectorQuery(VectorLayer * v, Rect r, const int ** strokes)
+{
+    return spatialQuery(v->index, r, v->count, strokes);
+}
+
+static int clampPixel(float v)
+{
+    return v < 0 ? 0 : (v > TILE_SIZE ? TILE_SIZE : (int)v);
+}
+
+// The first pixel of a tile shown at scale whose centre is at or past
+// canvas coordinate c, o being the tile's origin.
+static int screenPixel(float c, float o, float scale)
+{
+    return clampPixel(ceilf((c - o)*scale - 0.5f));
+}
+
+// Each dab covers the whole canvas pixels placeRect would paint, clipped
+// to the canvas, and a screen pixel shows the canvas pixel under its
+// centre. A stroke's own dabs combine by max so overlaps do not darken.
+bool vectorRenderTile(VectorLayer * v, float scale, int kx, int ky, float * rgba)
+{
+    float span = TILE_SIZE/scale;
+    Rect tile = {{kx*span, ky*span}, {span, span}};
+    const int * ids;
+    int n = vectorQuery(v, tile, &ids);
+    if(!n)
+        return false;
+
+    float cover[TILE_PIXELS];
+    memset(rgba, 0, sizeof(float)*TILE_PIXELS*4);
+    for(int k = 0; k < n; ++k) {
+        const VectorStroke * s = &v->strokes[ids[k]];
+        int x0 = clampPixel(floorf((s->bounds.origin.x - tile.origin.x)*scale - 1));
+        int y0 = clampPixel(floorf((s->bounds.origin.y - tile.origin.y)*scale - 1));
+        int x1 = clampPixel(ceilf((s->bounds.origin.x + s->bounds.size.width - tile.origin.x)*scale + 1));
+        int y1 = clampPixel(ceilf((s->bounds.origin.y + s->bounds.size.height - tile.origin.y)*scale + 1));
+        for(int y = y0; y < y1; ++y)
+            memset(&cover[y*TILE_SIZE + x0], 0, sizeof(float)*(x1 - x0));
+
+        float size = floorf(s->brush.size);
+        for(int i = 0; i < s->dabCount; ++i) {
+            Point d = s->dabs[i];
+            int sx0 = screenPixel(fmaxf(d.x, 0), tile.origin.x, scale);
+            int sy0 = screenPixel(fmaxf(d.y, 0), tile.origin.y, scale);
+            int sx1 = screenPixel(fminf(d.x + size, v->width), tile.origin.x, scale);
+            int sy1 = screenPixel(fminf(d.y + size, v->height), tile.origin.y, scale);
+            for(int y = sy0; y < sy1; ++y)
+                for(int x = sx0; x < sx1; ++x)
+                    cover[y*TILE_SIZE + x] = 1;
+        }
+
+        Color color = s->brush.color;
+        for(int y = y0; y < y1; ++y) {
+            for(int x = x0; x < x1; ++x) {
+                float a = cover[y*TILE_SIZE + x]*color.a;
+                if(a <= 0)
+                    continue;
+                float * out = &rgba[(y*TILE_SIZE + x)*4];
+                out[0] = color.r*a + out[0]*(1 - a);
+                out[1] = color.g*a + out[1]*(1 - a);
+                out[2] = color.b*a + out[2]*(1 - a);
+                out[3] = a + out[3]*(1 - a);
+            }
+        }
+    }
+    return true;
+}
@@ -0,0 +1,71 @@
+#ifndef DAPPER_VECTOR_H
+#define DAPPER_VECTOR_H
+
+#include <stdbool.h>
+#include "spatial.h"
+#include "stroke.h"
+
+struct VectorSample {
+    Point position;
+    double time;
+};
+typedef struct VectorSample VectorSample;
+
+// A brush stroke kept as data: the raw samples, so it can be replayed
+// through the brush engine exactly as if it had been painted, and the
+// dabs that replay will place, which is what gets rendered.
+struct VectorStroke {
+    Brush brush;
+    VectorSample * samples;
+    int count, capacity;
+    Point * dabs;
+    int dabCount, dabCapacity;
+    Rect bounds;
+};
+typedef struct VectorStroke VectorStroke;
+
+// Strokes that stay resolution independent until flattened into the
+// canvas. Each is rendered dab by dab, the way flattening will paint it,
+// at whatever zoom it is shown. Strokes past count have been undone and
+// come back with vectorRedo until a new stroke replaces them.
+//
+// A spatial index over the strokes' dabs, extended event by event as a
+// stroke is drawn, finds the strokes near a tile without looking
+// at the others.
+struct VectorLayer {
+    int width, height;
+    VectorStroke * strokes;
+    int count, total, capacity;
+    bool open;
+    Stroke smoother;
+
+    SpatialIndex * index;
+};
+typedef struct VectorLayer VectorLayer;
+
+VectorLayer * vectorCreate(int width, int height);
+void vectorDestroy(VectorLayer * v);
+
+// Building a stroke. Each returns the canvas rect that needs redrawing.
+Rect vectorBegin(VectorLayer * v, const Brush * brush, Point p, double time);
+Rect vectorAdd(VectorLayer * v, Point p, double time);
+Rect vectorEnd(VectorLayer * v, Point p, double time);
+
+// False when there is nothing to undo or redo; otherwise changed is the
+// canvas rect that needs redrawing.
+bool vectorUndo(VectorLayer * v, Rect * changed);
+bool vectorRedo(VectorLayer * v, Rect * changed);
+
+// Drops every stroke, including the undone ones.
+void vectorClear(VectorLayer * v);
+
+// The shown strokes whose bounds meet r, oldest first. The array belongs
+// to the layer and is valid until the next query.
+int vectorQuery(VectorLayer * v, Rect r, const int ** strokes);
+
+// Renders the TILE_SIZE square at (kx, ky) of the layer drawn at scale
+// screen pixels per canvas pixel, as premultiplied RGBA floats. Returns
+// false, leaving rgba untouched, when no stroke reaches the tile.
+bool vectorRenderTile(VectorLayer * v, float scale, int kx, int ky, float * rgba);
+
+#endif
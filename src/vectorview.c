@@ -0,0 +1,341 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "glformat.h"
+#include "memory.h"
+#include "program.h"
+#include "srgb.h"
+#include "vectorview.h"
+
+#define GLSL(src) "#version 150 core\n" #src
+
+#define BUCKETS_PER_OCTAVE 4
+// Tiles rendered per update; tiles with no strokes cost nothing.
+#define RENDER_BUDGET 12
+#define VERTEX_FLOATS 5
+
+static const GLchar * layerVertexSource = GLSL(
+    uniform mat4 projection;
+    uniform mat4 transform;
+    in vec2 position;
+    in vec3 texcoord;
+    out vec3 Texcoord;
+
+    void main() {
+        Texcoord = texcoord;
+        gl_Position = projection*transform*vec4(position, 0.0, 1.0);
+    }
+);
+
+static const GLchar * layerFragmentSource = GLSL(
+    in vec3 Texcoord;
+    out vec4 outColor;
+    uniform sampler2DArray tiles;
+
+    void main() {
+        outColor = texture(tiles, Texcoord);
+    }
+);
+
+struct Slot {
+    int bucket, kx, ky;
+    unsigned lastUsed;
+    bool used, stale;
+};
+typedef struct Slot Slot;
+
+struct VectorView {
+    VectorLayer * layer;
+    CanvasFormat format;
+    GLuint texture, program, vao, vbo;
+    GLint projectionLoc, transformLoc;
+
+    Slot * slots;
+    int slotCount;
+    int shown;
+    bool started;
+    Rect view;
+    unsigned frame;
+
+    float * pixels;
+    uint8_t * bytes;
+    GLfloat * vertices;
+    int vertexCapacity;
+};
+
+struct KeyRange {
+    int kx0, ky0, kx1, ky1;
+};
+typedef struct KeyRange KeyRange;
+
+static float bucketScale(int bucket)
+{
+    return exp2f((float)bucket/BUCKETS_PER_OCTAVE);
+}
+
+VectorView * vectorViewCreate(VectorLayer * layer, CanvasFormat format, int slots)
+{
+    VectorView * w = calloc(1, sizeof(VectorView));
+    w->layer = layer;
+    w->format = format;
+
+    GLint maxLayers;
+    glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+    w->slotCount = slots < maxLayers ? slots : maxLayers;
+    w->slots = calloc(w->slotCount, sizeof(Slot));
+    w->pixels = malloc(sizeof(float)*TILE_PIXELS*4);
+    w->bytes = malloc(TILE_PIXELS*4);
+    memoryCharge(SUBSYSTEM_VECTOR, (sizeof(float) + 1)*TILE_PIXELS*4, 0, 0);
+
+    // sRGB tiles keep the layer in linear light like the canvas under it
+    glGenTextures(1, &w->texture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, w->texture);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, format == CANVAS_SRGB8 ? GL_SRGB8_ALPHA8 : GL_RGBA8,
+        TILE_SIZE, TILE_SIZE, w->slotCount, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    memoryCharge(SUBSYSTEM_TEXTURES, 0, (long long)TILE_PIXELS*4*w->slotCount, 0);
+
+    w->program = programBuild(layerVertexSource, layerFragmentSource);
+    w->projectionLoc = glGetUniformLocation(w->program, "projection");
+    w->transformLoc = glGetUniformLocation(w->program, "transform");
+
+    GLint previousVao;
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previousVao);
+    glGenVertexArrays(1, &w->vao);
+    glBindVertexArray(w->vao);
+    glGenBuffers(1, &w->vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, w->vbo);
+    GLint posAttrib = glGetAttribLocation(w->program, "position");
+    glEnableVertexAttribArray(posAttrib);
+    glVertexAttribPointer(posAttrib, 2, GL_FLOAT, GL_FALSE, VERTEX_FLOATS * sizeof(GLfloat), 0);
+    GLint texAttrib = glGetAttribLocation(w->program, "texcoord");
+    glEnableVertexAttribArray(texAttrib);
+    glVertexAttribPointer(texAttrib, 3, GL_FLOAT, GL_FALSE, VERTEX_FLOATS * sizeof(GLfloat), (void*)(2 * sizeof(GLfloat)));
+    glBindVertexArray(previousVao);
+
+    return w;
+}
+
+void vectorViewDestroy(VectorView * w)
+{
+    if(!w)
+        return;
+    glDeleteBuffers(1, &w->vbo);
+    glDeleteVertexArrays(1, &w->vao);
+    glDeleteProgram(w->program);
+    glDeleteTextures(1, &w->texture);
+    memoryCharge(SUBSYSTEM_TEXTURES, 0, -(long long)TILE_PIXELS*4*w->slotCount, 0);
+    memoryCharge(SUBSYSTEM_VECTOR, -(long long)(sizeof(float) + 1)*TILE_PIXELS*4, 0, 0);
+    free(w->vertices);
+    free(w->pixels);
+    free(w->bytes);
+    free(w->slots);
+    free(w);
+}
+
+// Canvas pixels covered by a tile of the given bucket.
+static Rect keyRect(int bucket, int kx, int ky)
+{
+    float span = TILE_SIZE/bucketScale(bucket);
+    return (Rect){{kx*span, ky*span}, {span, span}};
+}
+
+static bool rectsMeet(Rect a, Rect b)
+{
+    return a.origin.x < b.origin.x + b.size.width && b.origin.x < a.origin.x + a.size.width
+        && a.origin.y < b.origin.y + b.size.height && b.origin.y < a.origin.y + a.size.height;
+}
+
+static KeyRange keysFor(const VectorView * w, int bucket, Rect view)
+{
+    float s = bucketScale(bucket);
+    int tilesX = ceilf(w->layer->width*s/TILE_SIZE);
+    int tilesY = ceilf(w->layer->height*s/TILE_SIZE);
+    KeyRange k = {
+        floorf(view.origin.x*s/TILE_SIZE),
+        floorf(view.origin.y*s/TILE_SIZE),
+        floorf((view.origin.x + view.size.width)*s/TILE_SIZE),
+        floorf((view.origin.y + view.size.height)*s/TILE_SIZE)
+    };
+    k.kx0 = k.kx0 < 0 ? 0 : k.kx0;
+    k.ky0 = k.ky0 < 0 ? 0 : k.ky0;
+    k.kx1 = k.kx1 < tilesX ? k.kx1 : tilesX - 1;
+    k.ky1 = k.ky1 < tilesY ? k.ky1 : tilesY - 1;
+    return k;
+}
+
+static int keyCount(KeyRange k)
+{
+    return (k.kx1 - k.kx0 + 1)*(k.ky1 - k.ky0 + 1);
+}
+
+void vectorViewInvalidate(VectorView * w, Rect changed)
+{
+    for(int i = 0; i < w->slotCount; ++i) {
+        Slot * s = &w->slots[i];
+        if(!s->used)
+            continue;
+        if(rectsMeet(keyRect(s->bucket, s->kx, s->ky), changed))
+            s->stale = true;
+    }
+}
+
+static Slot * findSlot(VectorView * w, int bucket, int kx, int ky)
+{
+    for(int i = 0; i < w->slotCount; ++i) {
+        Slot * s = &w->slots[i];
+        if(s->used && s->bucket == bucket && s->kx == kx && s->ky == ky)
+            return s;
+    }
+    return NULL;
+}
+
+// A free slot, or else the one seen least recently before this frame.
+static Slot * claimSlot(VectorView * w)
+{
+    Slot * best = NULL;
+    for(int i = 0; i < w->slotCount; ++i) {
+        Slot * s = &w->slots[i];
+        if(!s->used)
+            return s;
+        if(s->lastUsed != w->frame && (!best || s->lastUsed < best->lastUsed))
+            best = s;
+    }
+    return best;
+}
+
+// Alpha is stored linearly even in sRGB textures.
+static void upload(VectorView * w, int layer)
+{
+    if(w->format == CANVAS_SRGB8) {
+        srgbFromLinear(w->bytes, w->pixels, TILE_PIXELS*4);
+        for(int i = 0; i < TILE_PIXELS; ++i)
+            w->bytes[i*4 + 3] = lrintf(w->pixels[i*4 + 3]*255.0f);
+    } else {
+        for(int i = 0; i < TILE_PIXELS*4; ++i) {
+            float v = w->pixels[i];
+            w->bytes[i] = v <= 0 ? 0 : (v >= 1 ? 255 : lrintf(v*255.0f));
+        }
+    }
+    glBindTexture(GL_TEXTURE_2D_ARRAY, w->texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, TILE_SIZE, TILE_SIZE, 1, GL_RGBA, GL_UNSIGNED_BYTE, w->bytes);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+// Brings the bucket's visible tiles up to date within the budget. Returns
+// true once all of them are ready; tiles without strokes need no slot.
+static bool refresh(VectorView * w, int bucket, int * budget)
+{
+    KeyRange k = keysFor(w, bucket, w->view);
+    bool ready = true;
+    for(int ky = k.ky0; ky <= k.ky1; ++ky) {
+        for(int kx = k.kx0; kx <= k.kx1; ++kx) {
+            Slot * s = findSlot(w, bucket, kx, ky);
+            if(s)
+                s->lastUsed = w->frame;
+            if(s && !s->stale)
+                continue;
+            if(*budget <= 0) {
+                ready = false;
+                continue;
+            }
+            if(!vectorRenderTile(w->layer, bucketScale(bucket), kx, ky, w->pixels)) {
+                if(s)
+                    s->used = false;
+                continue;
+            }
+            --*budget;
+            if(!s && !(s = claimSlot(w))) {
+                ready = false;
+                continue;
+            }
+            *s = (Slot){bucket, kx, ky, w->frame, true, false};
+            upload(w, s - w->slots);
+        }
+    }
+    return ready;
+}
+
+void vectorViewUpdate(VectorView * w, Rect view, float scale)
+{
+    int wanted = lroundf(BUCKETS_PER_OCTAVE*log2f(scale));
+    w->view = view;
+    ++w->frame;
+
+    // a bucket far from the zoom would need too many tiles to stand in
+    if(!w->started || 2*keyCount(keysFor(w, w->shown, view)) > w->slotCount) {
+        w->shown = wanted;
+        w->started = true;
+    }
+    int budget = RENDER_BUDGET;
+    refresh(w, w->shown, &budget);
+    if(wanted != w->shown && refresh(w, wanted, &budget))
+        w->shown = wanted;
+}
+
+static void pushQuad(VectorView * w, int * count, Rect q, Rect source, int layer)
+{
+    if(*count + 6 > w->vertexCapacity) {
+        w->vertexCapacity = w->vertexCapacity ? 2*w->vertexCapacity : 6*64;
+        w->vertices = realloc(w->vertices, sizeof(GLfloat)*VERTEX_FLOATS*w->vertexCapacity);
+    }
+
+    float x0 = q.origin.x, y0 = q.origin.y;
+    float x1 = x0 + q.size.width, y1 = y0 + q.size.height;
+    float u0 = (x0 - source.origin.x)/source.size.width, v0 = (y0 - source.origin.y)/source.size.height;
+    float u1 = (x1 - source.origin.x)/source.size.width, v1 = (y1 - source.origin.y)/source.size.height;
+    GLfloat quad[6][VERTEX_FLOATS] = {
+        {x0, y0, u0, v0, layer}, {x1, y0, u1, v0, layer}, {x1, y1, u1, v1, layer},
+        {x0, y0, u0, v0, layer}, {x1, y1, u1, v1, layer}, {x0, y1, u0, v1, layer}
+    };
+    memcpy(&w->vertices[*count*VERTEX_FLOATS], quad, sizeof(quad));
+    *count += 6;
+}
+
+void vectorViewDraw(VectorView * w, const GLfloat * projection, const GLfloat * transform)
+{
+    int count = 0;
+    for(int i = 0; i < w->slotCount; ++i) {
+        Slot * s = &w->slots[i];
+        if(!s->used || s->bucket != w->shown)
+            continue;
+        Rect k = keyRect(s->bucket, s->kx, s->ky);
+        if(!rectsMeet(k, w->view))
+            continue;
+        // strokes are clipped to the canvas like the pixels under them
+        float x1 = fminf(k.origin.x + k.size.width, w->layer->width);
+        float y1 = fminf(k.origin.y + k.size.height, w->layer->height);
+        pushQuad(w, &count, (Rect){k.origin, {x1 - k.origin.x, y1 - k.origin.y}}, k, i);
+    }
+    if(!count)
+        return;
+
+    GLint previousProgram, previousVao;
+    glGetIntegerv(GL_CURRENT_PROGRAM, &previousProgram);
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previousVao);
+
+    glUseProgram(w->program);
+    glUniformMatrix4fv(w->projectionLoc, 1, false, projection);
+    glUniformMatrix4fv(w->transformLoc, 1, false, transform);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, w->texture);
+    glBindVertexArray(w->vao);
+    glBindBuffer(GL_ARRAY_BUFFER, w->vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*VERTEX_FLOATS*count, w->vertices, GL_STREAM_DRAW);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    canvasLinearBegin(w->format);
+    glDrawArrays(GL_TRIANGLES, 0, count);
+    canvasLinearEnd(w->format);
+    glDisable(GL_BLEND);
+
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    glBindVertexArray(previousVao);
+    glUseProgram(previousProgram);
+}
@@ -0,0 +1,28 @@
+#ifndef DAPPER_VECTORVIEW_H
+#define DAPPER_VECTORVIEW_H
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+#include "canvas.h"
+#include "vector.h"
+
+typedef struct VectorView VectorView;
+
+// Shows a vector layer over the canvas. The layer is rendered on the CPU
+// in TILE_SIZE tiles at the zoom bucket nearest the current scale (four
+// buckets per octave), and rendered tiles are cached in a texture array
+// until the strokes under them change. Panning only renders the tiles
+// that come into view; after a zoom the previous bucket stays on screen,
+// scaled, until every visible tile of the new one is ready.
+VectorView * vectorViewCreate(VectorLayer * layer, CanvasFormat format, int slots);
+void vectorViewDestroy(VectorView * w);
+
+// Marks the cached tiles that changed covers, in canvas pixels, for
+// rendering again.
+void vectorViewInvalidate(VectorView * w, Rect changed);
+
+// view and scale as for residencyUpdate. Renders a few tiles per call.
+void vectorViewUpdate(VectorView * w, Rect view, float scale);
+void vectorViewDraw(VectorView * w, const GLfloat * projection, const GLfloat * transform);
+
+#endif
@@ -0,0 +1,159 @@
+#define GLEW_STATIC
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+#include <stdlib.h>
+#include "live.h"
+#include "program.h"
+#include "viewer.h"
+
+#define GLSL(src) "#version 150 core\n" #src
+
+#define VIEWER_WIDTH 800
+#define VIEWER_HEIGHT 600
+// Seconds between looks for a painter while there is none.
+#define RETRY_INTERVAL 0.5
+#define TITLE "Drawing App - Viewer"
+#define TITLE_WAITING "Drawing App - Viewer (waiting for a canvas)"
+
+// A unit quad scaled to fit the canvas into the window.
+static const GLchar * viewVertexSource = GLSL(
+    uniform vec2 scale;
+    in vec2 position;
+    out vec2 Texcoord;
+
+    void main() {
+        Texcoord = position;
+        gl_Position = vec4((2.0*position - 1.0)*scale*vec2(1.0, -1.0), 0.0, 1.0);
+    }
+);
+
+static const GLchar * viewFragmentSource = GLSL(
+    in vec2 Texcoord;
+    out vec4 outColor;
+    uniform sampler2D tex;
+
+    void main() {
+        outColor = texture(tex, Texcoord);
+    }
+);
+
+struct Viewer {
+    LiveView * live;
+    int width, height;
+    GLuint texture;
+};
+typedef struct Viewer Viewer;
+
+static void uploadTile(int tx, int ty, const uint8_t * rgb, void * ctx)
+{
+    Viewer * v = ctx;
+    int w = v->width - tx*TILE_SIZE, h = v->height - ty*TILE_SIZE;
+    glTexSubImage2D(GL_TEXTURE_2D, 0, tx*TILE_SIZE, ty*TILE_SIZE,
+        w < TILE_SIZE ? w : TILE_SIZE, h < TILE_SIZE ? h : TILE_SIZE, GL_RGB, GL_UNSIGNED_BYTE, rgb);
+}
+
+static bool follow(Viewer * v, const char * name)
+{
+    if(!(v->live = liveOpen(name)))
+        return false;
+    liveSize(v->live, &v->width, &v->height);
+    glGenTextures(1, &v->texture);
+    glBindTexture(GL_TEXTURE_2D, v->texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, v->width, v->height, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    return true;
+}
+
+static void unfollow(Viewer * v)
+{
+    glDeleteTextures(1, &v->texture);
+    v->texture = 0;
+    liveClose(v->live);
+    v->live = NULL;
+}
+
+int viewerRun(const char * name)
+{
+    if(!glfwInit())
+        return EXIT_FAILURE;
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    GLFWwindow * window = glfwCreateWindow(VIEWER_WIDTH, VIEWER_HEIGHT, TITLE_WAITING, NULL, NULL);
+    if(!window) {
+        glfwTerminate();
+        return EXIT_FAILURE;
+    }
+    glfwMakeContextCurrent(window);
+    glfwSwapInterval(1);
+    glewExperimental = GL_TRUE;
+    glewInit();
+
+    GLuint program = programBuild(viewVertexSource, viewFragmentSource);
+    glUseProgram(program);
+    GLint scaleLoc = glGetUniformLocation(program, "scale");
+
+    GLuint vao, vbo;
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+    glGenBuffers(1, &vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    GLfloat quad[] = {0, 0, 1, 0, 0, 1, 1, 1};
+    glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW);
+    GLint posAttrib = glGetAttribLocation(program, "position");
+    glEnableVertexAttribArray(posAttrib);
+    glVertexAttribPointer(posAttrib, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(GLfloat), 0);
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, TILE_SIZE);
+
+    Viewer v = {NULL, 0, 0, 0};
+    double lastTry = -RETRY_INTERVAL;
+    while(!glfwWindowShouldClose(window)) {
+        double now = glfwGetTime();
+        if(v.live && !liveAlive(v.live, now)) {
+            unfollow(&v);
+            glfwSetWindowTitle(window, TITLE_WAITING);
+        }
+        if(!v.live && now - lastTry >= RETRY_INTERVAL) {
+            lastTry = now;
+            if(follow(&v, name))
+                glfwSetWindowTitle(window, TITLE);
+        }
+
+        int fw, fh;
+        glfwGetFramebufferSize(window, &fw, &fh);
+        glViewport(0, 0, fw, fh);
+        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+
+        if(v.live) {
+            glBindTexture(GL_TEXTURE_2D, v.texture);
+            if(liveCollect(v.live, uploadTile, &v))
+                glGenerateMipmap(GL_TEXTURE_2D);
+            // letterboxed to keep the canvas's aspect ratio
+            float canvasAspect = (float)v.width/v.height, windowAspect = (float)fw/(fh ? fh : 1);
+            if(canvasAspect > windowAspect)
+                glUniform2f(scaleLoc, 1.0f, windowAspect/canvasAspect);
+            else
+                glUniform2f(scaleLoc, canvasAspect/windowAspect, 1.0f);
+            glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+        }
+
+        glfwSwapBuffers(window);
+        glfwPollEvents();
+    }
+
+    if(v.live)
+        unfollow(&v);
+    glDeleteBuffers(1, &vbo);
+    glDeleteVertexArrays(1, &vao);
+    glDeleteProgram(program);
+    glfwDestroyWindow(window);
+    glfwTerminate();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,11 @@
+#ifndef DAPPER_VIEWER_H
+#define DAPPER_VIEWER_H
+
+// Opens a window showing the canvas a painting process publishes under
+// name (see live.h), fitted to the window and read only. Only tiles that
+// changed are uploaded, and nothing flows back to the painter. Waits for a
+// painter to appear and follows the next one when it closes. Returns the
+// process exit status once the window is closed.
+int viewerRun(const char * name);
+
+#endif